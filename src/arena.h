@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Linear allocator for records that live for one frame. Reset() rewinds it at the end of the frame
+//and, if the frame went past the capacity, regrows it once to the high water mark plus headroom.
+//Steady state frames never allocate, and growth happens between passes instead of mid-pass.
+template<class T>
+struct FrameArena {
+	std::vector<T> storage; //Sized to the capacity, only the first count records are live
+	size_t count = 0;
+	size_t highWater = 0;        //Most records any frame has used
+	uint32_t midFrameGrowths = 0; //Times a frame outgrew the arena while filling it
+
+	T *Allocate(size_t n = 1) {
+		if (count + n > storage.size()) {
+			//Rare: only the first frames and sudden spikes get here
+			storage.resize((count + n) * 2);
+			midFrameGrowths++;
+		}
+		T *records = storage.data() + count;
+		count += n;
+		return records;
+	}
+	void Push(const T &record) { *Allocate() = record; }
+
+	void Reset() {
+		if (count > highWater) highWater = count;
+		size_t wanted = highWater + highWater / 4;
+		if (storage.size() < wanted) storage.resize(wanted);
+		count = 0;
+	}
+
+	T *data() { return storage.data(); }
+	const T *data() const { return storage.data(); }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T &operator[](size_t i) { return storage[i]; }
+	const T &operator[](size_t i) const { return storage[i]; }
+	T *begin() { return storage.data(); }
+	T *end() { return storage.data() + count; }
+	const T *begin() const { return storage.data(); }
+	const T *end() const { return storage.data() + count; }
+};
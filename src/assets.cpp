@@ -0,0 +1,414 @@
+#include "assets.h"
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+AssetManager assets = {
+	.textureLookup = {},
+	.meshLookup = {},
+	.textures = {},
+	.meshes = {},
+	.freeTextureSlots = {},
+	.freeMeshSlots = {},
+	.textureFormat = TEXTURE_RGBA8,
+	.textureMemoryBudget = 0,
+	.residentTextureBytes = 0,
+	.frame = 0,
+};
+
+enum AssetKind {
+	TEXTURE_ASSET,
+	MESH_ASSET
+};
+
+//A decode request, filled in with the result by a loader thread
+struct AssetLoadJob {
+	AssetKind kind;
+	int handle;
+	uint32_t generation;
+	std::string path;
+	TextureFormat textureFormat;
+	bool succeeded;
+	Texture texture;
+	Mesh mesh;
+};
+
+struct AssetLoader {
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::deque<AssetLoadJob> pending;
+	std::vector<AssetLoadJob> completed;
+	bool stopping;
+};
+static AssetLoader loader;
+
+//Magenta/grey checkerboard shown while the real texture streams in
+static uint32_t placeholderPixels[8 * 8];
+static Texture placeholderTexture = {0, 0, TEXTURE_RGBA8, nullptr, nullptr};
+
+static const Texture* PlaceholderTexture() {
+	if (!placeholderTexture.pixels) {
+		for (int y = 0; y < 8; y++)
+			for (int x = 0; x < 8; x++)
+				placeholderPixels[y * 8 + x] = ((x ^ y) & 1) ? 0xFFFF00FF : 0xFF808080;
+		placeholderTexture = {8, 8, TEXTURE_RGBA8, placeholderPixels, nullptr};
+	}
+	return &placeholderTexture;
+}
+
+//Unit cube shown while the real mesh streams in
+static const Mesh* PlaceholderMesh() {
+	static Mesh cube;
+	if (!cube.faces.empty()) return &cube;
+
+	const Vec3f sides[6] = {{1,0,0}, {-1,0,0}, {0,1,0}, {0,-1,0}, {0,0,1}, {0,0,-1}};
+	for (Vec3f n : sides) {
+		Vec3f u = n.y != 0 ? Vec3f(1,0,0) : Vec3f(0,1,0);
+		Vec3f v = Vec3Cross(n, u);
+		Vec3f center = n * 0.5f;
+		Vec3f c00 = (center - u * 0.5f) - v * 0.5f;
+		Vec3f c10 = (center + u * 0.5f) - v * 0.5f;
+		Vec3f c11 = (center + u * 0.5f) + v * 0.5f;
+		Vec3f c01 = (center - u * 0.5f) + v * 0.5f;
+
+		//Hard edges: every corner takes the side's normal
+		Face quad[2] = {
+			{c00, c10, c11, {0,0}, {1,0}, {1,1}, n, n, n},
+			{c00, c11, c01, {0,0}, {1,1}, {0,1}, n, n, n},
+		};
+		for (Face &f : quad) {
+			//Keep the winding consistent with backface culling (normal facing out)
+			if (Vec3Dot(Vec3Cross(f.b - f.a, f.c - f.a), n) < 0) {
+				std::swap(f.b, f.c);
+				std::swap(f.bUV, f.cUV);
+			}
+			cube.faces.push_back(f);
+		}
+	}
+	BuildMeshClusters(cube);
+	BuildMeshEdges(cube);
+	return &cube;
+}
+
+static bool IsValidTexture(TextureHandle handle) {
+	return handle >= 0 and handle < (int)assets.textures.size() and assets.textures[handle].refCount > 0;
+}
+
+static bool IsValidMesh(MeshHandle handle) {
+	return handle >= 0 and handle < (int)assets.meshes.size() and assets.meshes[handle].refCount > 0;
+}
+
+static void UnloadTextureSlot(TextureSlot &slot) {
+	if (slot.state != ASSET_RESIDENT) return;
+	assets.residentTextureBytes -= TextureBytes(slot.texture);
+	UnloadPngTexture(slot.texture);
+	slot.state = ASSET_UNLOADED;
+}
+
+//Evicts least recently used textures (never ones used this frame) until the incoming bytes fit the budget
+static void EvictTextures(size_t incomingBytes) {
+	if (assets.textureMemoryBudget == 0) return;
+
+	while (assets.residentTextureBytes + incomingBytes > assets.textureMemoryBudget) {
+		TextureSlot *lru = nullptr;
+		for (TextureSlot &slot : assets.textures) {
+			if (slot.state != ASSET_RESIDENT or slot.lastUsedFrame >= assets.frame) continue;
+			if (!lru or slot.lastUsedFrame < lru->lastUsedFrame) lru = &slot;
+		}
+		if (!lru) break; //Everything resident is in use this frame, go over budget
+		UnloadTextureSlot(*lru);
+	}
+}
+
+//Decodes and, if configured, block compresses a texture. Safe to call from the loader threads.
+static bool LoadTextureAsset(Texture &texture, const char* filename, TextureFormat format) {
+	if (!LoadPngTexture(texture, filename)) return false;
+	CompressTexture(texture, format);
+	return true;
+}
+
+static void MakeTextureResident(TextureSlot &slot, const Texture &decoded) {
+	EvictTextures(TextureBytes(decoded));
+	slot.texture = decoded;
+	slot.state = ASSET_RESIDENT;
+	assets.residentTextureBytes += TextureBytes(decoded);
+}
+
+static void QueueLoad(AssetKind kind, int handle, uint32_t generation, const std::string &path) {
+	{
+		std::lock_guard<std::mutex> lock(loader.mutex);
+		loader.pending.push_back(AssetLoadJob{
+			.kind = kind,
+			.handle = handle,
+			.generation = generation,
+			.path = path,
+			.textureFormat = assets.textureFormat,
+			.succeeded = false,
+			.texture = {0, 0, TEXTURE_RGBA8, nullptr, nullptr},
+			.mesh = {},
+		});
+	}
+	loader.wakeUp.notify_one();
+}
+
+//////////////////////////////////////////////////
+/// Textures
+//////////////////////////////////////////////////
+TextureHandle AcquireTexture(const char* filename) {
+	auto it = assets.textureLookup.find(filename);
+	if (it != assets.textureLookup.end()) {
+		assets.textures[it->second].refCount++;
+		return it->second;
+	}
+
+	int handle;
+	if (!assets.freeTextureSlots.empty()) {
+		handle = assets.freeTextureSlots.back();
+		assets.freeTextureSlots.pop_back();
+	} else {
+		handle = (int)assets.textures.size();
+		assets.textures.push_back({});
+	}
+
+	assets.textures[handle] = TextureSlot{
+		.path = filename,
+		.refCount = 1,
+		.generation = assets.textures[handle].generation + 1,
+		.state = ASSET_UNLOADED,
+		.texture = {0, 0, TEXTURE_RGBA8, nullptr, nullptr},
+		.lastUsedFrame = 0,
+	};
+	assets.textureLookup[filename] = handle;
+	return handle;
+}
+
+void RetainTexture(TextureHandle handle) {
+	if (IsValidTexture(handle)) assets.textures[handle].refCount++;
+}
+
+void ReleaseTexture(TextureHandle handle) {
+	if (!IsValidTexture(handle)) return;
+
+	TextureSlot &slot = assets.textures[handle];
+	if (--slot.refCount > 0) return;
+
+	UnloadTextureSlot(slot);
+	slot.state = ASSET_UNLOADED;
+	assets.textureLookup.erase(slot.path);
+	slot.path.clear();
+	assets.freeTextureSlots.push_back(handle);
+}
+
+//Starts decoding in the background without waiting for the first Get*() call
+void PrefetchTexture(TextureHandle handle) {
+	if (!IsValidTexture(handle) or loader.threads.empty()) return;
+
+	TextureSlot &slot = assets.textures[handle];
+	if (slot.state != ASSET_UNLOADED) return;
+	slot.state = ASSET_LOADING;
+	QueueLoad(TEXTURE_ASSET, handle, slot.generation, slot.path);
+}
+
+const Texture* GetTexture(TextureHandle handle) {
+	if (!IsValidTexture(handle)) return nullptr;
+
+	TextureSlot &slot = assets.textures[handle];
+	slot.lastUsedFrame = assets.frame;
+
+	switch (slot.state) {
+	case ASSET_RESIDENT: return &slot.texture;
+	case ASSET_FAILED: return nullptr;
+	case ASSET_LOADING: return PlaceholderTexture();
+	case ASSET_UNLOADED: break;
+	}
+
+	if (!loader.threads.empty()) {
+		PrefetchTexture(handle);
+		return PlaceholderTexture();
+	}
+
+	Texture decoded;
+	if (!LoadTextureAsset(decoded, slot.path.c_str(), assets.textureFormat)) {
+		slot.state = ASSET_FAILED; //Don't retry every frame
+		return nullptr;
+	}
+	MakeTextureResident(slot, decoded);
+	return &slot.texture;
+}
+
+//////////////////////////////////////////////////
+/// Meshes
+//////////////////////////////////////////////////
+MeshHandle AcquireMesh(const char* filename) {
+	auto it = assets.meshLookup.find(filename);
+	if (it != assets.meshLookup.end()) {
+		assets.meshes[it->second].refCount++;
+		return it->second;
+	}
+
+	int handle;
+	if (!assets.freeMeshSlots.empty()) {
+		handle = assets.freeMeshSlots.back();
+		assets.freeMeshSlots.pop_back();
+	} else {
+		handle = (int)assets.meshes.size();
+		assets.meshes.push_back({});
+	}
+
+	assets.meshes[handle] = MeshSlot{
+		.path = filename,
+		.refCount = 1,
+		.generation = assets.meshes[handle].generation + 1,
+		.state = ASSET_UNLOADED,
+		.mesh = {},
+	};
+	assets.meshLookup[filename] = handle;
+	return handle;
+}
+
+void RetainMesh(MeshHandle handle) {
+	if (IsValidMesh(handle)) assets.meshes[handle].refCount++;
+}
+
+void ReleaseMesh(MeshHandle handle) {
+	if (!IsValidMesh(handle)) return;
+
+	MeshSlot &slot = assets.meshes[handle];
+	if (--slot.refCount > 0) return;
+
+	UnloadObjFile(slot.mesh);
+	slot.mesh.faces.shrink_to_fit();
+	slot.state = ASSET_UNLOADED;
+	assets.meshLookup.erase(slot.path);
+	slot.path.clear();
+	assets.freeMeshSlots.push_back(handle);
+}
+
+void PrefetchMesh(MeshHandle handle) {
+	if (!IsValidMesh(handle) or loader.threads.empty()) return;
+
+	MeshSlot &slot = assets.meshes[handle];
+	if (slot.state != ASSET_UNLOADED) return;
+	slot.state = ASSET_LOADING;
+	QueueLoad(MESH_ASSET, handle, slot.generation, slot.path);
+}
+
+const Mesh* GetMesh(MeshHandle handle) {
+	if (!IsValidMesh(handle)) return nullptr;
+
+	MeshSlot &slot = assets.meshes[handle];
+	switch (slot.state) {
+	case ASSET_RESIDENT: return &slot.mesh;
+	case ASSET_FAILED: return nullptr;
+	case ASSET_LOADING: return PlaceholderMesh();
+	case ASSET_UNLOADED: break;
+	}
+
+	if (!loader.threads.empty()) {
+		PrefetchMesh(handle);
+		return PlaceholderMesh();
+	}
+
+	slot.state = LoadObjFile(slot.mesh, slot.path.c_str()) ? ASSET_RESIDENT : ASSET_FAILED;
+	return slot.state == ASSET_RESIDENT ? &slot.mesh : nullptr;
+}
+
+//////////////////////////////////////////////////
+/// Budget
+//////////////////////////////////////////////////
+void SetTextureMemoryBudget(size_t bytes) {
+	assets.textureMemoryBudget = bytes;
+	EvictTextures(0);
+}
+
+//Called once per frame after rendering, trims resident textures back under the budget
+void EndAssetFrame() {
+	assets.frame++;
+	EvictTextures(0);
+}
+
+//////////////////////////////////////////////////
+/// Background loading
+//////////////////////////////////////////////////
+static void LoaderThreadMain() {
+	while (true) {
+		AssetLoadJob job;
+		{
+			std::unique_lock<std::mutex> lock(loader.mutex);
+			loader.wakeUp.wait(lock, [] { return loader.stopping or !loader.pending.empty(); });
+			if (loader.stopping) return;
+			job = std::move(loader.pending.front());
+			loader.pending.pop_front();
+		}
+
+		if (job.kind == TEXTURE_ASSET) job.succeeded = LoadTextureAsset(job.texture, job.path.c_str(), job.textureFormat);
+		else job.succeeded = LoadObjFile(job.mesh, job.path.c_str());
+
+		std::lock_guard<std::mutex> lock(loader.mutex);
+		loader.completed.push_back(std::move(job));
+	}
+}
+
+void StartAssetLoaders(int threadCount) {
+	if (!loader.threads.empty()) return;
+
+	loader.stopping = false;
+	for (int i = 0; i < threadCount; i++)
+		loader.threads.emplace_back(LoaderThreadMain);
+}
+
+void StopAssetLoaders() {
+	{
+		std::lock_guard<std::mutex> lock(loader.mutex);
+		loader.stopping = true;
+	}
+	loader.wakeUp.notify_all();
+	for (std::thread &thread : loader.threads) thread.join();
+	loader.threads.clear();
+
+	for (AssetLoadJob &job : loader.completed) UnloadPngTexture(job.texture);
+	loader.completed.clear();
+	loader.pending.clear();
+
+	//Anything still in flight goes back to being loaded on demand
+	for (TextureSlot &slot : assets.textures)
+		if (slot.state == ASSET_LOADING) slot.state = ASSET_UNLOADED;
+	for (MeshSlot &slot : assets.meshes)
+		if (slot.state == ASSET_LOADING) slot.state = ASSET_UNLOADED;
+}
+
+//Swaps finished loads into their slots. Called at the start of a frame so a frame
+//never sees an asset change halfway through.
+void PublishLoadedAssets() {
+	std::vector<AssetLoadJob> completed;
+	{
+		std::lock_guard<std::mutex> lock(loader.mutex);
+		completed.swap(loader.completed);
+	}
+
+	for (AssetLoadJob &job : completed) {
+		if (job.kind == TEXTURE_ASSET) {
+			bool current = IsValidTexture(job.handle) and
+				assets.textures[job.handle].generation == job.generation and
+				assets.textures[job.handle].state == ASSET_LOADING;
+			if (!current) { UnloadPngTexture(job.texture); continue; }
+
+			TextureSlot &slot = assets.textures[job.handle];
+			if (job.succeeded) MakeTextureResident(slot, job.texture);
+			else slot.state = ASSET_FAILED;
+		} else {
+			bool current = IsValidMesh(job.handle) and
+				assets.meshes[job.handle].generation == job.generation and
+				assets.meshes[job.handle].state == ASSET_LOADING;
+			if (!current) continue;
+
+			MeshSlot &slot = assets.meshes[job.handle];
+			slot.mesh = std::move(job.mesh);
+			slot.state = job.succeeded ? ASSET_RESIDENT : ASSET_FAILED;
+		}
+	}
+}
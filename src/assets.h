@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "model.h"
+
+//Textures and meshes are deduplicated by path and shared through ref-counted handles.
+//Data is decoded lazily on the first Get*() call. Pointers returned by Get*() stay
+//valid until the end of the frame (textures used this frame are never evicted).
+//
+//When loader threads are running, decoding happens off the render thread: Get*()
+//returns a low-res placeholder until PublishLoadedAssets() swaps the real data in
+//at the start of a frame.
+
+enum AssetState {
+	ASSET_UNLOADED,
+	ASSET_LOADING,
+	ASSET_RESIDENT,
+	ASSET_FAILED
+};
+
+struct TextureSlot {
+	std::string path;
+	int refCount;
+	uint32_t generation; //Bumped on slot reuse so stale async results are dropped
+	AssetState state;
+	Texture texture; //pixels is nullptr while not resident
+	uint64_t lastUsedFrame;
+};
+
+struct MeshSlot {
+	std::string path;
+	int refCount;
+	uint32_t generation;
+	AssetState state;
+	Mesh mesh;
+};
+
+struct AssetManager {
+	std::unordered_map<std::string, int> textureLookup;
+	std::unordered_map<std::string, int> meshLookup;
+	//Deques, so acquiring a new asset never moves the slots that Get*() pointers (and an in flight
+	//geometry job) point into
+	std::deque<TextureSlot> textures;
+	std::deque<MeshSlot> meshes;
+	std::vector<int> freeTextureSlots;
+	std::vector<int> freeMeshSlots;
+	TextureFormat textureFormat; //Format textures are converted to after decoding
+	size_t textureMemoryBudget; //In bytes, 0 means unlimited
+	size_t residentTextureBytes;
+	uint64_t frame;
+};
+extern AssetManager assets;
+
+TextureHandle AcquireTexture(const char* filename);
+void RetainTexture(TextureHandle handle);
+void ReleaseTexture(TextureHandle handle);
+void PrefetchTexture(TextureHandle handle);
+const Texture* GetTexture(TextureHandle handle);
+
+MeshHandle AcquireMesh(const char* filename);
+void RetainMesh(MeshHandle handle);
+void ReleaseMesh(MeshHandle handle);
+void PrefetchMesh(MeshHandle handle);
+const Mesh* GetMesh(MeshHandle handle);
+
+void SetTextureMemoryBudget(size_t bytes);
+void EndAssetFrame();
+
+void StartAssetLoaders(int threadCount);
+void StopAssetLoaders();
+void PublishLoadedAssets();
@@ -0,0 +1,287 @@
+#include "bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numbers>
+#include <thread>
+#include <vector>
+#include "clipping.h"
+#include "display.h"
+#include "lighting.h"
+#include "linear_algebra.h"
+#include "model.h"
+#include "procedural_assets.h"
+#include "renderer.h"
+
+static const int BENCH_WIDTH = 1280;
+static const int BENCH_HEIGHT = 720;
+
+//Synthetic assets, written under ASSETS_PATH before the run and removed after it
+static const char *BENCH_ASSET_DIR = "bench/";
+static const char *BENCH_OBJ = "bench/sphere.obj";
+static const char *BENCH_PNG = "bench/checker.png";
+
+//Stores through a pointer the compiler can't see through, so the work producing value can't be dropped
+template<class T>
+static void KeepResult(const T &value) {
+	static T storage;
+	static T *volatile sink = &storage;
+	*sink = value;
+}
+
+//Reloads value every time, so work on loop invariant inputs can't be hoisted out of the timed loop
+template<class T>
+static const T &Opaque(const T &value) {
+	static const T *volatile source;
+	source = &value;
+	return *source;
+}
+
+//////////////////////////////////////////////////
+/// Inputs
+//////////////////////////////////////////////////
+struct BenchInputs {
+	Mat4f a, b;
+	Vec4f v;
+	Triangle clipInside, clipOutside, clipStraddling;
+	Triangle rasterSmall, rasterLarge, rasterSliver;
+	Texture texture;
+};
+static BenchInputs inputs;
+
+//Raster space triangle, winding as the pipeline produces it
+static Triangle ScreenTriangle(Vec4f p0, Vec4f p1, Vec4f p2) {
+	Triangle tri = {};
+	tri.points[0] = p0; tri.points[1] = p1; tri.points[2] = p2;
+	tri.texCoords[0] = {0, 0}; tri.texCoords[1] = {1, 0}; tri.texCoords[2] = {0, 1};
+	for (int i = 0; i < 3; i++) tri.normals[i] = {0, 0, -1};
+	tri.normal = {0, 0, -1};
+	return tri;
+}
+
+//Projects view space points
+static Triangle ClipSpaceTriangle(Vec4f p0, Vec4f p1, Vec4f p2) {
+	Triangle tri = {};
+	Vec4f view[3] = {p0, p1, p2};
+	for (int i = 0; i < 3; i++) tri.points[i] = Vec4MultMat4(view[i], renderer.projectionMat);
+	tri.texCoords[0] = {0, 0}; tri.texCoords[1] = {0, 1}; tri.texCoords[2] = {1, 0};
+	return tri;
+}
+
+static bool CreateInputs() {
+	std::string assetDir = std::string(ASSETS_PATH) + BENCH_ASSET_DIR;
+	std::filesystem::create_directories(assetDir);
+	if (!WriteSphereObj(std::string(ASSETS_PATH) + BENCH_OBJ, 128, 128)) return false;
+	if (!WriteCheckerPng(std::string(ASSETS_PATH) + BENCH_PNG, 1024)) return false;
+	if (!LoadPngTexture(inputs.texture, BENCH_PNG)) return false;
+
+	inputs.a = GetRotationMat(0.3f, 1.2f, -0.4f) * GetTranslationMat(1, 2, 3);
+	inputs.b = GetPerspectiveMat(std::numbers::pi_v<float> / 3, BENCH_WIDTH, BENCH_HEIGHT, 0.1f, 100);
+	inputs.v = {0.5f, -1.5f, 4.0f, 1.0f};
+
+	inputs.clipInside = ClipSpaceTriangle({-0.5f, -0.5f, 5, 1}, {-0.5f, 0.5f, 5, 1}, {0.5f, -0.5f, 5.5f, 1});
+	inputs.clipOutside = ClipSpaceTriangle({20, 0, 5, 1}, {20, 1, 5, 1}, {21, 0, 5.5f, 1});
+	//Through the near plane and the right side
+	inputs.clipStraddling = ClipSpaceTriangle({0, 0, 0.05f, 1}, {0, 0.5f, 2, 1}, {3, 0, 2, 1});
+
+	inputs.rasterSmall = ScreenTriangle({100.3f, 100.6f, 0, 5}, {108.1f, 100.2f, 0, 5}, {100.7f, 107.9f, 0, 5});
+	inputs.rasterLarge = ScreenTriangle({100.3f, 60.6f, 0, 5}, {1180.1f, 100.2f, 0, 6}, {300.7f, 680.9f, 0, 4});
+	inputs.rasterSliver = ScreenTriangle({20.3f, 30.6f, 0, 5}, {1260.1f, 690.2f, 0, 5}, {1259.2f, 691.8f, 0, 5});
+	return true;
+}
+
+static void DestroyInputs() {
+	UnloadPngTexture(inputs.texture);
+	std::filesystem::remove_all(std::string(ASSETS_PATH) + BENCH_ASSET_DIR);
+}
+
+//////////////////////////////////////////////////
+/// Benchmarks
+//////////////////////////////////////////////////
+//The six planes in ProcessFace() order
+static void ClipAllPlanes(const Triangle &tri, int iterations) {
+	for (int i = 0; i < iterations; i++) {
+		Polygon poly = CreatePolygonFromTriangle(Opaque(tri));
+		ClipPolygonAxisSide(X_AXIS, 1.0, poly);
+		ClipPolygonAxisSide(X_AXIS, -1.0, poly);
+		ClipPolygonAxisSide(Y_AXIS, 1.0, poly);
+		ClipPolygonAxisSide(Y_AXIS, -1.0, poly);
+		ClipPolygonAxisSide(Z_AXIS, 1.0, poly);
+		ClipPolygonAxisSide(Z_AXIS, -1.0, poly);
+		KeepResult(poly.elementCount);
+	}
+}
+
+//Every draw starts from a cleared depth buffer, so the time includes filling the depth tiles the
+//triangle touches (compare clear/depth_materialize_frame)
+static void RasterizeTextured(const Triangle &tri, int iterations) {
+	for (int i = 0; i < iterations; i++) {
+		ClearZBuffer();
+		RasterizeTriangle(Opaque(tri), true, 0xFFFFFFFF, &inputs.texture);
+	}
+}
+
+struct Benchmark {
+	const char *name;
+	void (*run)(int iterations);
+};
+
+static const Benchmark benchmarks[] = {
+	{"math/Vec4MultMat4", [](int n) { for (int i = 0; i < n; i++) KeepResult(Vec4MultMat4(Opaque(inputs.v), Opaque(inputs.a))); }},
+	{"math/Mat4f_multiply", [](int n) { for (int i = 0; i < n; i++) { Mat4f a = Opaque(inputs.a); KeepResult(a * Opaque(inputs.b)); } }},
+	{"math/Mat4f_Inverse", [](int n) { for (int i = 0; i < n; i++) { Mat4f a = Opaque(inputs.a); KeepResult(a.Inverse()); } }},
+	{"clip/inside", [](int n) { ClipAllPlanes(inputs.clipInside, n); }},
+	{"clip/outside", [](int n) { ClipAllPlanes(inputs.clipOutside, n); }},
+	{"clip/straddling", [](int n) { ClipAllPlanes(inputs.clipStraddling, n); }},
+	{"raster/small", [](int n) { RasterizeTextured(inputs.rasterSmall, n); }},
+	{"raster/large", [](int n) { RasterizeTextured(inputs.rasterLarge, n); }},
+	{"raster/sliver", [](int n) { RasterizeTextured(inputs.rasterSliver, n); }},
+	{"raster/DrawTexel", [](int n) {
+		Vec3f weights = {0.2f, 0.3f, 0.5f};
+		for (int i = 0; i < n; i++) {
+			//Walks a row so every texel passes the depth test once the buffer is cleared
+			int x = i % BENCH_WIDTH;
+			if (x == 0) ClearZBuffer();
+			DrawTexel(x, 360, Opaque(inputs.rasterLarge), inputs.texture, weights);
+		}
+	}},
+	{"clear/ClearColorBuffer", [](int n) { for (int i = 0; i < n; i++) ClearColorBuffer(0xFF000000); }},
+	{"clear/ClearZBuffer", [](int n) { for (int i = 0; i < n; i++) ClearZBuffer(); }},
+	//What the fast clear defers: every tile filled once
+	{"clear/depth_materialize_frame", [](int n) {
+		for (int i = 0; i < n; i++) {
+			ClearZBuffer();
+			MaterializeDepthRect(display.depthBuffer, 0, 0, BENCH_WIDTH, BENCH_HEIGHT);
+		}
+	}},
+	{"clear/color_materialize_frame", [](int n) {
+		for (int i = 0; i < n; i++) {
+			ClearColorBuffer(0xFF000000);
+			MaterializeColorRect(display.colorBuffer, 0, 0, BENCH_WIDTH, BENCH_HEIGHT);
+		}
+	}},
+	{"asset/LoadObjFile_32k_faces", [](int n) {
+		for (int i = 0; i < n; i++) {
+			Mesh mesh;
+			LoadObjFile(mesh, BENCH_OBJ);
+			KeepResult(mesh.faces.size());
+		}
+	}},
+	{"asset/LoadPngTexture_1024", [](int n) {
+		for (int i = 0; i < n; i++) {
+			Texture texture;
+			LoadPngTexture(texture, BENCH_PNG);
+			KeepResult(texture.pixels[0]);
+			UnloadPngTexture(texture);
+		}
+	}},
+};
+
+//////////////////////////////////////////////////
+/// Harness
+//////////////////////////////////////////////////
+struct BenchResult {
+	const char *name;
+	long long iterations; //Over all timed batches
+	double medianNs; //Per iteration, median batch
+	double minNs; //Per iteration, fastest batch
+};
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Grows the batch until it takes about a twentieth of the time budget, then times batches until the budget is spent
+static BenchResult RunBenchmark(const Benchmark &benchmark, double minSeconds) {
+	double batchSeconds = std::max(minSeconds / 20, 0.001);
+	int batchSize = 1;
+	while (true) {
+		auto start = std::chrono::steady_clock::now();
+		benchmark.run(batchSize);
+		double seconds = SecondsSince(start);
+		if (seconds >= batchSeconds or batchSize >= (1 << 30)) break;
+		//Jump close to the target, at most 10x at once
+		double scale = seconds > 0 ? std::min(batchSeconds / seconds * 1.2, 10.0) : 10.0;
+		batchSize = (int)std::min(batchSize * std::max(scale, 2.0), (double)(1 << 30));
+	}
+
+	std::vector<double> batchNs;
+	auto budgetStart = std::chrono::steady_clock::now();
+	while (batchNs.size() < 5 or SecondsSince(budgetStart) < minSeconds) {
+		auto start = std::chrono::steady_clock::now();
+		benchmark.run(batchSize);
+		batchNs.push_back(SecondsSince(start) * 1e9 / batchSize);
+	}
+	std::sort(batchNs.begin(), batchNs.end());
+	return {benchmark.name, (long long)batchSize * (long long)batchNs.size(), batchNs[batchNs.size() / 2], batchNs[0]};
+}
+
+static void WriteJson(const std::string &path, const std::vector<BenchResult> &results) {
+	std::ofstream file(path);
+	file << "{\n  \"context\": {\n";
+	file << "    \"executable\": \"main\",\n";
+	file << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+#ifdef NDEBUG
+	file << "    \"library_build_type\": \"release\",\n";
+#else
+	file << "    \"library_build_type\": \"debug\",\n";
+#endif
+	file << "    \"lighting_kernels\": \"" << (LightingUsesSimd() ? "sse" : "scalar") << "\"\n";
+	file << "  },\n  \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult &r = results[i];
+		file << "    {\"name\": \"" << r.name << "\", \"run_type\": \"iteration\", \"iterations\": " << r.iterations
+			<< ", \"real_time\": " << r.medianNs << ", \"cpu_time\": " << r.medianNs
+			<< ", \"min_time\": " << r.minNs << ", \"time_unit\": \"ns\"}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	file << "  ]\n}\n";
+}
+
+bool ParseBenchOptions(int argc, char* argv[], BenchOptions &options) {
+	options = {.filter = "", .minSeconds = 0.5, .jsonPath = ""};
+	bool bench = false;
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--bench") == 0) {
+			bench = true;
+			if (hasValue and strncmp(argv[i + 1], "--", 2) != 0) options.filter = argv[++i];
+		}
+		else if (strcmp(argv[i], "--bench-time") == 0 and hasValue) options.minSeconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "--bench-json") == 0 and hasValue) options.jsonPath = argv[++i];
+	}
+	return bench;
+}
+
+int RunBenchmarks(const BenchOptions &options) {
+	SetupHeadless(BENCH_WIDTH, BENCH_HEIGHT);
+	if (!CreateInputs()) {
+		std::cout << "Bench: couldn't create the synthetic assets under " << ASSETS_PATH << BENCH_ASSET_DIR << std::endl;
+		DestroyInputs();
+		CleanUp();
+		return 1;
+	}
+	ClearColorBuffer(0xFF000000);
+	ClearZBuffer();
+
+	std::vector<BenchResult> results;
+	char line[160];
+	snprintf(line, sizeof(line), "%-32s %14s %14s %12s", "Benchmark", "Median ns", "Min ns", "Iterations");
+	std::cout << line << std::endl;
+	for (const Benchmark &benchmark : benchmarks) {
+		if (!options.filter.empty() and !strstr(benchmark.name, options.filter.c_str())) continue;
+		BenchResult result = RunBenchmark(benchmark, options.minSeconds);
+		snprintf(line, sizeof(line), "%-32s %14.1f %14.1f %12lld", result.name, result.medianNs, result.minNs, result.iterations);
+		std::cout << line << std::endl;
+		results.push_back(result);
+	}
+	if (!options.jsonPath.empty()) WriteJson(options.jsonPath, results);
+
+	DestroyInputs();
+	CleanUp();
+	return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+
+//Microbenchmarks of the hot kernels (math, clipping, rasterization, clears, asset loading), run
+//headlessly on the main thread with no job system workers. Every benchmark is timed in batches for
+//at least minSeconds and reports the median and the fastest batch per iteration. Started with --bench.
+struct BenchOptions {
+	std::string filter; //Runs only the benchmarks whose name contains it, all if empty
+	double minSeconds; //Per benchmark
+	std::string jsonPath; //Also writes the results there, in Google Benchmark's JSON layout, if not empty
+};
+
+//True if the command line asks for a benchmark run:
+//  --bench [filter] [--bench-time seconds] [--bench-json path]
+bool ParseBenchOptions(int argc, char* argv[], BenchOptions &options);
+//Returns the process exit code
+int RunBenchmarks(const BenchOptions &options);
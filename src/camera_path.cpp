@@ -0,0 +1,91 @@
+#include "camera_path.h"
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+static const float TAU = 2.0f * std::numbers::pi_v<float>;
+
+//The model turning on all three axes, one turn every TAU seconds
+static CameraPath CreateTurntablePath() {
+	CameraPath path = {.name = "turntable", .movesCamera = false, .keys = {}};
+	path.keys.push_back({0.0f, {.position = {0, 0, 0}, .yaw = 0, .rotation = {0, 0, 0}}});
+	path.keys.push_back({TAU, {.position = {0, 0, 0}, .yaw = 0, .rotation = {TAU, TAU, TAU}}});
+	return path;
+}
+
+//Circles the instance grid looking at its center while the model slowly turns
+static CameraPath CreateOrbitPath() {
+	const int STEPS = 16;
+	const float SECONDS = 20.0f;
+	Vec3f center = {0, 0, 7.5f};
+	float radius = 9.0f;
+
+	CameraPath path = {.name = "orbit", .movesCamera = true, .keys = {}};
+	for (int i = 0; i <= STEPS; i++) {
+		//yaw (sin, 0, cos) is the view direction, the camera sits opposite it
+		float angle = TAU * i / STEPS;
+		float height = 1.5f * std::sin(2.0f * angle);
+		Vec3f position = {center.x - radius * std::sin(angle), center.y + height, center.z - radius * std::cos(angle)};
+		path.keys.push_back({SECONDS * i / STEPS, {.position = position, .yaw = angle, .rotation = {0, angle, 0}}});
+	}
+	return path;
+}
+
+//Walks down the middle column of instances and through the models, close enough to clip them
+//against the near plane, then turns around and walks back
+static CameraPath CreateFlythroughPath() {
+	CameraPath path = {.name = "flythrough", .movesCamera = true, .keys = {}};
+	auto key = [&](float time, Vec3f position, float yaw) {
+		path.keys.push_back({time, {.position = position, .yaw = yaw, .rotation = {0.3f, time * 0.25f, 0}}});
+	};
+	key(0.0f,  {0.0f, 0.3f, -2.0f}, 0.0f);
+	key(3.0f,  {0.4f, 0.1f, 4.2f},  0.1f);
+	key(6.0f,  {-0.3f, 0.0f, 9.5f}, -0.15f);
+	key(9.0f,  {0.2f, 0.2f, 14.0f}, 0.05f);
+	key(11.0f, {0.0f, 0.5f, 17.0f}, std::numbers::pi_v<float>);
+	key(15.0f, {1.2f, 0.5f, 9.0f},  std::numbers::pi_v<float> + 0.2f);
+	key(19.0f, {0.0f, 0.3f, -2.0f}, TAU);
+	return path;
+}
+
+static const std::vector<CameraPath> &GetCameraPaths() {
+	static const std::vector<CameraPath> paths = {CreateTurntablePath(), CreateOrbitPath(), CreateFlythroughPath()};
+	return paths;
+}
+
+const CameraPath* FindCameraPath(const char *name) {
+	for (const CameraPath &path : GetCameraPaths()) {
+		if (strcmp(path.name, name) == 0) return &path;
+	}
+	return nullptr;
+}
+
+std::vector<const char*> GetCameraPathNames() {
+	std::vector<const char*> names;
+	for (const CameraPath &path : GetCameraPaths()) names.push_back(path.name);
+	return names;
+}
+
+float GetCameraPathDuration(const CameraPath &path) {
+	return path.keys.back().time;
+}
+
+CameraPose SampleCameraPath(const CameraPath &path, float time) {
+	float duration = GetCameraPathDuration(path);
+	time = duration > 0 ? std::fmod(time, duration) : 0;
+	if (time < 0) time += duration;
+
+	size_t next = 1;
+	while (next < path.keys.size() - 1 and path.keys[next].time < time) next++;
+	const CameraPathKey &a = path.keys[next - 1];
+	const CameraPathKey &b = path.keys[next];
+	float t = b.time > a.time ? (time - a.time) / (b.time - a.time) : 0;
+
+	Vec3f position = a.pose.position; Vec3f toPosition = b.pose.position;
+	Vec3f rotation = a.pose.rotation; Vec3f toRotation = b.pose.rotation;
+	return {
+		.position = position + (toPosition - position) * t,
+		.yaw = a.pose.yaw + (b.pose.yaw - a.pose.yaw) * t,
+		.rotation = rotation + (toRotation - rotation) * t,
+	};
+}
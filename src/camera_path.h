@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+#include "linear_algebra.h"
+
+//Scripted camera and model motion, keyframed over time. Sampling is a pure function of the time,
+//so replaying a path gives the same frames on every run (showcase mode, the frame benchmark).
+struct CameraPose {
+	Vec3f position; //Camera, world space
+	float yaw; //Camera.yawAngle
+	Vec3f rotation; //Renderer.rotation, the model's
+};
+
+struct CameraPathKey {
+	float time; //Seconds from the start of the path
+	CameraPose pose;
+};
+
+struct CameraPath {
+	const char *name;
+	bool movesCamera; //Otherwise only the model rotation is scripted and the camera stays under user control
+	std::vector<CameraPathKey> keys; //Ascending time, the first at 0. Loops after the last.
+};
+
+//nullptr if there is no path of that name
+const CameraPath* FindCameraPath(const char *name);
+//Names of all paths, for help texts
+std::vector<const char*> GetCameraPathNames();
+float GetCameraPathDuration(const CameraPath &path);
+//Linear between the keys around time, wrapped into the path's duration
+CameraPose SampleCameraPath(const CameraPath &path, float time);
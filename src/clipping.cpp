@@ -68,18 +68,23 @@ float LerpFloat(float a, float b, float t) {
 
 void ClipPolygonAxisSide(Axis axis, float side, Polygon &polygon){
 	const int startElementCount = polygon.elementCount;
+	//A previous plane already clipped the whole polygon away
+	if (startElementCount == 0) return;
 
 	Vec4f clippedVertices[MAX_NUM_POLY_VERTICES];
 	TexCoord clippedUVs[MAX_NUM_POLY_VERTICES];
+	Vec3f clippedNormals[MAX_NUM_POLY_VERTICES];
 	int clippedElementCount = 0;
 
 	Vec4f prevVertex = polygon.vertices[startElementCount - 1];
 	TexCoord prevTexCoord = polygon.texCoords[startElementCount - 1];
+	Vec3f prevNormal = polygon.normals[startElementCount - 1];
 	int prevDot = (side * Vec4GetAxis(prevVertex, axis)) <= Vec4GetAxis(prevVertex, W_AXIS) ? 1 : -1;
 
 	for (int i = 0; i < startElementCount; i++) {
 		Vec4f currVertex = polygon.vertices[i];
 		TexCoord currTexCoord = polygon.texCoords[i];
+		Vec3f currNormal = polygon.normals[i];
 		int currDot = (side * Vec4GetAxis(currVertex, axis)) <= Vec4GetAxis(currVertex, W_AXIS) ? 1 : -1;
 
 		//If one of the vertices is inside while the other is outside
@@ -96,6 +101,7 @@ void ClipPolygonAxisSide(Axis axis, float side, Polygon &polygon){
 				.u = LerpFloat(prevTexCoord.u, currTexCoord.u, t),
 				.v = LerpFloat(prevTexCoord.v, currTexCoord.v, t),
 			};
+			clippedNormals[clippedElementCount] = prevNormal + ((currNormal - prevNormal) * t);
 			clippedElementCount++;
 		}
 
@@ -103,25 +109,44 @@ void ClipPolygonAxisSide(Axis axis, float side, Polygon &polygon){
 		if (currDot > 0) {
 			clippedVertices[clippedElementCount] = currVertex;
 			clippedUVs[clippedElementCount] = currTexCoord;
+			clippedNormals[clippedElementCount] = currNormal;
 			clippedElementCount++;
 		}
 
 		prevVertex = currVertex;
 		prevTexCoord = currTexCoord;
+		prevNormal = currNormal;
 		prevDot = currDot;
 	}
 
 	for (int i = 0; i < clippedElementCount; i++) {
 		polygon.vertices[i] = clippedVertices[i];
 		polygon.texCoords[i] = clippedUVs[i];
+		polygon.normals[i] = clippedNormals[i];
 	}
 	polygon.elementCount = clippedElementCount;
 }
 
+//Same plane test as ClipPolygonAxisSide, for a single segment. Returns false if the segment is fully outside.
+bool ClipLineAxisSide(Axis axis, float side, Vec4f &a, Vec4f &b) {
+	float distA = Vec4GetAxis(a, W_AXIS) - Vec4GetAxis(a, axis) * side;
+	float distB = Vec4GetAxis(b, W_AXIS) - Vec4GetAxis(b, axis) * side;
+
+	if (distA < 0 and distB < 0) return false;
+	if (distA >= 0 and distB >= 0) return true;
+
+	const float t = distA / (distA - distB);
+	Vec4f intersection = a + ((b - a) * t);
+	if (distA < 0) a = intersection;
+	else b = intersection;
+	return true;
+}
+
 Polygon CreatePolygonFromTriangle(const Triangle &tri) {
 	return Polygon{
 		.vertices = {tri.points[0], tri.points[1], tri.points[2]},
 		.texCoords = {tri.texCoords[0], tri.texCoords[1], tri.texCoords[2]},
+		.normals = {tri.normals[0], tri.normals[1], tri.normals[2]},
 		.elementCount = 3,
 	};
 }
@@ -138,6 +163,9 @@ void CreateTrisFromPolygon(Polygon &poly, Triangle tris[], int &count) {
 		tris[i].texCoords[0] = poly.texCoords[index0];
 		tris[i].texCoords[1] = poly.texCoords[index1];
 		tris[i].texCoords[2] = poly.texCoords[index2];
+		tris[i].normals[0] = poly.normals[index0];
+		tris[i].normals[1] = poly.normals[index1];
+		tris[i].normals[2] = poly.normals[index2];
 	}
 	count = poly.elementCount - 2;
 }
@@ -35,6 +35,7 @@ struct Frustum {
 struct Polygon {
 	Vec4f vertices[MAX_NUM_POLY_VERTICES];
 	TexCoord texCoords[MAX_NUM_POLY_VERTICES];
+	Vec3f normals[MAX_NUM_POLY_VERTICES];
 	int elementCount;
 };
 
@@ -45,5 +46,6 @@ extern Clipping clipping;
 
 Frustum InitFrustumPlanes(float vertFov, float horFov, float zNear, float zFar);
 void ClipPolygonAxisSide(Axis axis, float side, Polygon &polygon);
+bool ClipLineAxisSide(Axis axis, float side, Vec4f &a, Vec4f &b);
 Polygon CreatePolygonFromTriangle(const Triangle &tri);
 void CreateTrisFromPolygon(Polygon &poly, Triangle tris[], int &count);
@@ -0,0 +1,178 @@
+#include "deferred.h"
+#include <algorithm>
+#include <cmath>
+#include "jobs.h"
+
+GBuffer CreateGBuffer(int width, int height) {
+	int tilesWide = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesHigh = (height + TILE_SIZE - 1) / TILE_SIZE;
+	size_t pixelCount = (size_t)width * height;
+	GBuffer buffer = {
+		.width = width,
+		.height = height,
+		.reciprocalW = new float[pixelCount],
+		.normals = new uint32_t[pixelCount],
+		.albedo = new uint32_t[pixelCount],
+		.materials = new uint8_t[pixelCount],
+		.tilesWide = tilesWide,
+		.tilesHigh = tilesHigh,
+		.tileStates = new uint8_t[tilesWide * tilesHigh],
+	};
+	ClearGBuffer(buffer);
+	return buffer;
+}
+
+void DestroyGBuffer(GBuffer &buffer) {
+	delete[] buffer.reciprocalW;
+	delete[] buffer.normals;
+	delete[] buffer.albedo;
+	delete[] buffer.materials;
+	delete[] buffer.tileStates;
+	buffer.reciprocalW = nullptr;
+	buffer.normals = nullptr;
+	buffer.albedo = nullptr;
+	buffer.materials = nullptr;
+	buffer.tileStates = nullptr;
+}
+
+//Same fast clear scheme as the color/depth buffers, only the material IDs need resetting on first write
+void ClearGBuffer(GBuffer &buffer) {
+	std::fill_n(buffer.tileStates, buffer.tilesWide * buffer.tilesHigh, (uint8_t)TILE_CLEARED);
+}
+
+void MaterializeGBufferRect(GBuffer &buffer, int xMin, int yMin, int xMax, int yMax) {
+	if (xMin >= xMax or yMin >= yMax) return;
+	for (int ty = yMin / TILE_SIZE; ty <= (yMax - 1) / TILE_SIZE; ty++) {
+		for (int tx = xMin / TILE_SIZE; tx <= (xMax - 1) / TILE_SIZE; tx++) {
+			uint8_t &state = buffer.tileStates[ty * buffer.tilesWide + tx];
+			if (state == TILE_DIRTY) continue;
+
+			int x0 = tx * TILE_SIZE; int x1 = std::min(x0 + TILE_SIZE, buffer.width);
+			int y0 = ty * TILE_SIZE; int y1 = std::min(y0 + TILE_SIZE, buffer.height);
+			for (int y = y0; y < y1; y++) std::fill(buffer.materials + y * buffer.width + x0, buffer.materials + y * buffer.width + x1, (uint8_t)MATERIAL_NONE);
+			state = TILE_DIRTY;
+		}
+	}
+}
+
+struct ScreenRect {
+	int x0, y0, x1, y1;
+};
+
+//Conservative screen rect of a light's sphere of influence, from its projected bounding box corners
+static ScreenRect GetLightScreenRect(const Vec3f &p, float radius, int width, int height, float projX, float projY) {
+	const ScreenRect fullScreen = {0, 0, width, height};
+	if (p.z - radius <= 0.001f) return fullScreen; //Reaches behind the camera
+
+	float ndcMinX = 1e30f, ndcMaxX = -1e30f, ndcMinY = 1e30f, ndcMaxY = -1e30f;
+	for (int i = 0; i < 8; i++) {
+		float x = p.x + ((i & 1) ? radius : -radius);
+		float y = p.y + ((i & 2) ? radius : -radius);
+		float z = p.z + ((i & 4) ? radius : -radius);
+		float ndcX = x * projX / z; float ndcY = y * projY / z;
+		ndcMinX = std::min(ndcMinX, ndcX); ndcMaxX = std::max(ndcMaxX, ndcX);
+		ndcMinY = std::min(ndcMinY, ndcY); ndcMaxY = std::max(ndcMaxY, ndcY);
+	}
+
+	//NDC -> Raster space (y flipped)
+	ScreenRect rect = {
+		.x0 = (int)std::floor((ndcMinX + 1) * 0.5f * width),
+		.y0 = (int)std::floor((1 - ndcMaxY) * 0.5f * height),
+		.x1 = (int)std::ceil((ndcMaxX + 1) * 0.5f * width),
+		.y1 = (int)std::ceil((1 - ndcMinY) * 0.5f * height),
+	};
+	rect.x0 = std::max(rect.x0, 0); rect.y0 = std::max(rect.y0, 0);
+	rect.x1 = std::min(rect.x1, width); rect.y1 = std::min(rect.y1, height);
+	return rect;
+}
+
+//Per worker, keeps its capacity from tile to tile
+struct TileScratch {
+	std::vector<int> pixels; //Covered pixel indices
+	std::vector<int> lights;
+	LightingEnvironment environment; //The lights that reach the tile
+	std::vector<float> attributes;
+};
+
+//Lights are culled per tile against the tile's screen rect and depth range, then every covered pixel
+//in the tile is lit by one ShadePoints() call with the lights that survived
+static void ShadeGBufferTile(const GBuffer &buffer, ColorBuffer &colorBuffer, int tile, const LightingEnvironment *env, const ShadowMap *shadows, const std::vector<ScreenRect> &lightRects, float projX, float projY, TileScratch &scratch) {
+	int x0 = (tile % buffer.tilesWide) * TILE_SIZE; int x1 = std::min(x0 + TILE_SIZE, buffer.width);
+	int y0 = (tile / buffer.tilesWide) * TILE_SIZE; int y1 = std::min(y0 + TILE_SIZE, buffer.height);
+
+	//Covered pixels and the depth range of their geometry
+	float minW = 1e30f, maxW = 0;
+	scratch.pixels.clear();
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			int index = y * buffer.width + x;
+			if (buffer.materials[index] == MATERIAL_NONE) continue;
+			scratch.pixels.push_back(index);
+			float w = 1.0f / buffer.reciprocalW[index];
+			minW = std::min(minW, w); maxW = std::max(maxW, w);
+		}
+	}
+	if (scratch.pixels.empty()) return;
+	MaterializeColorRect(colorBuffer, x0, y0, x1, y1);
+
+	if (!env) {
+		for (int index : scratch.pixels) StoreColor(colorBuffer, index, buffer.albedo[index]);
+		return;
+	}
+
+	scratch.lights.clear();
+	for (int i = 0; i < env->pointCount; i++) {
+		const ScreenRect &r = lightRects[i];
+		if (r.x0 >= x1 or r.x1 <= x0 or r.y0 >= y1 or r.y1 <= y0) continue;
+		if (env->z[i] + env->radius[i] < minW or env->z[i] - env->radius[i] > maxW) continue;
+		scratch.lights.push_back(i);
+	}
+	SelectPointLights(*env, scratch.lights.data(), (int)scratch.lights.size(), scratch.environment);
+
+	int count = (int)scratch.pixels.size();
+	scratch.attributes.resize((size_t)count * 13);
+	float *px = scratch.attributes.data(); float *py = px + count; float *pz = py + count;
+	float *nx = pz + count;                float *ny = nx + count; float *nz = ny + count;
+	float *dr = nz + count;                float *dg = dr + count; float *db = dg + count;
+	float *sr = db + count;                float *sg = sr + count; float *sb = sg + count;
+	float *visibility = sb + count;
+
+	for (int i = 0; i < count; i++) {
+		int index = scratch.pixels[i];
+		int x = index % buffer.width; int y = index / buffer.width;
+		//Raster space + 1/w -> camera space (camera z is the clip w)
+		float w = 1.0f / buffer.reciprocalW[index];
+		float ndcX = (x + 0.5f) / buffer.width * 2.0f - 1.0f;
+		float ndcY = 1.0f - (y + 0.5f) / buffer.height * 2.0f;
+		Vec3f position = {ndcX * w / projX, ndcY * w / projY, w};
+		Vec3f normal = DecodeNormal(buffer.normals[index]);
+		px[i] = position.x; py[i] = position.y; pz[i] = position.z;
+		nx[i] = normal.x; ny[i] = normal.y; nz[i] = normal.z;
+		visibility[i] = shadows ? SampleShadow(*shadows, position) : 1.0f;
+	}
+
+	ShadePoints(scratch.environment, count, px, py, pz, nx, ny, nz, dr, dg, db, sr, sg, sb, visibility);
+
+	for (int i = 0; i < count; i++) {
+		int index = scratch.pixels[i];
+		Vec3f albedo = UnpackAlbedo(buffer.albedo[index]);
+		StoreColorHDR(colorBuffer, index, albedo.x * dr[i] + sr[i], albedo.y * dg[i] + sg[i], albedo.z * db[i] + sb[i], 1.0f);
+	}
+}
+
+//Tiles are independent of each other and shade in parallel
+void ShadeGBuffer(const GBuffer &buffer, ColorBuffer &colorBuffer, const LightingEnvironment *env, const ShadowMap *shadows, float projX, float projY) {
+	std::vector<ScreenRect> lightRects(env ? env->pointCount : 0);
+	for (size_t i = 0; i < lightRects.size(); i++) {
+		Vec3f position = {env->x[i], env->y[i], env->z[i]};
+		lightRects[i] = GetLightScreenRect(position, env->radius[i], buffer.width, buffer.height, projX, projY);
+	}
+
+	ParallelFor(0, buffer.tilesWide * buffer.tilesHigh, 1, [&](int first, int last) {
+		TileScratch scratch;
+		for (int tile = first; tile < last; tile++) {
+			if (buffer.tileStates[tile] != TILE_DIRTY) continue;
+			ShadeGBufferTile(buffer, colorBuffer, tile, env, shadows, lightRects, projX, projY, scratch);
+		}
+	});
+}
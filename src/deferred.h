@@ -0,0 +1,73 @@
+#pragma once
+#include "framebuffer.h"
+#include "lighting.h"
+#include "linear_algebra.h"
+#include "shadow.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+//Deferred shading: the geometry pass writes the surface attributes of the closest triangle
+//per pixel into the G-buffer, then a tiled lighting pass shades every visible pixel exactly once.
+//Lighting cost is bounded by screen pixels x lights per tile, not by overdraw.
+
+//Material ID 0 marks pixels no geometry was written to (they keep the background). Every material
+//is lit with the frame's LightingEnvironment, by the same kernels as the forward path.
+enum MaterialId : uint8_t {
+	MATERIAL_NONE,
+	MATERIAL_DEFAULT
+};
+
+struct GBuffer {
+	int width;
+	int height;
+	float *reciprocalW; //Depth for view position reconstruction, same 1/w as the depth buffer
+	uint32_t *normals;  //Camera space, octahedral encoded into two snorm16
+	uint32_t *albedo;   //RGBA8
+	uint8_t *materials;
+	int tilesWide;
+	int tilesHigh;
+	uint8_t *tileStates; //TILE_CLEARED tiles have no geometry and are skipped by the lighting pass
+};
+
+GBuffer CreateGBuffer(int width, int height);
+void DestroyGBuffer(GBuffer &buffer);
+void ClearGBuffer(GBuffer &buffer);
+void MaterializeGBufferRect(GBuffer &buffer, int xMin, int yMin, int xMax, int yMax);
+
+//env is camera space, null leaves the albedo unlit. shadows is null without sun shadows.
+//projX/projY are the [0][0] and [1][1] entries of the projection matrix.
+void ShadeGBuffer(const GBuffer &buffer, ColorBuffer &colorBuffer, const LightingEnvironment *env, const ShadowMap *shadows, float projX, float projY);
+
+//Octahedral normal encoding, the normal must be unit length
+inline uint32_t EncodeNormal(Vec3f n) {
+	float invL1 = 1.0f / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+	float x = n.x * invL1; float y = n.y * invL1;
+	if (n.z < 0) {
+		float foldedX = (1.0f - std::abs(y)) * (x >= 0 ? 1.0f : -1.0f);
+		float foldedY = (1.0f - std::abs(x)) * (y >= 0 ? 1.0f : -1.0f);
+		x = foldedX; y = foldedY;
+	}
+	int16_t ex = (int16_t)std::lround(x * 32767.0f);
+	int16_t ey = (int16_t)std::lround(y * 32767.0f);
+	return (uint16_t)ex | ((uint32_t)(uint16_t)ey << 16);
+}
+
+inline Vec3f DecodeNormal(uint32_t packed) {
+	float x = (int16_t)(packed & 0xFFFF) / 32767.0f;
+	float y = (int16_t)(packed >> 16) / 32767.0f;
+	float z = 1.0f - std::abs(x) - std::abs(y);
+	if (z < 0) {
+		float unfoldedX = (1.0f - std::abs(y)) * (x >= 0 ? 1.0f : -1.0f);
+		float unfoldedY = (1.0f - std::abs(x)) * (y >= 0 ? 1.0f : -1.0f);
+		x = unfoldedX; y = unfoldedY;
+	}
+	return Vec3f(x, y, z).Normalized();
+}
+
+inline void WriteGBuffer(GBuffer &buffer, int index, float reciprocalW, uint32_t normal, uint32_t albedo, uint8_t material) {
+	buffer.reciprocalW[index] = reciprocalW;
+	buffer.normals[index] = normal;
+	buffer.albedo[index] = albedo;
+	buffer.materials[index] = material;
+}
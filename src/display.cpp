@@ -1,61 +1,176 @@
 #include "display.h"
+#include "jobs.h"
 #include "linear_algebra.h"
+#include "profiler.h"
 #include "renderer.h"
+#include "shaders.h"
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <iostream>
 #include <ostream>
+#include <vector>
 
 Display display = {
-	.colorBuffer = nullptr,
-	.zBuffer = nullptr,
+	.colorBuffer = {},
+	.presentBuffer = {},
+	.depthBuffer = {},
+	.multisample = {},
+	.gbuffer = {},
+	.visibility = {},
+	.shadowMap = {},
+	.oit = {},
+	.exposure = 1.0f,
+	.whitePoint = 4.0f,
 };
 
+RasterStats rasterStats = {};
+
+//Both clears only flag the tiles, memory is filled lazily (see framebuffer.h)
 void ClearColorBuffer(uint32_t color) {
-	for (int i = 0; i < renderer.windowWidth * renderer.windowHeight; i++)
-		display.colorBuffer[i] = color;
+	FastClearColorBuffer(display.colorBuffer, color);
+	ResetMultisampleBuffer(display.multisample);
 }
 
 void ClearZBuffer() {
-	for (int i = 0; i < renderer.windowWidth * renderer.windowHeight; i++)
-		display.zBuffer[i] = 0.0;
+	FastClearDepthBuffer(display.depthBuffer);
 }
 
-void DrawGrid(int step) {
-	for(int i = 0; i < renderer.windowHeight; i += step) {
-		for(int j = 0; j < renderer.windowWidth; j += step) {
-				display.colorBuffer[(i * renderer.windowWidth) + j] = 0xFF606060;
+//Recreates the sample storage (1, 2, 4 or 8 samples). Both buffers come back cleared.
+void SetSampleCount(int samples) {
+	DepthBuffer &depth = display.depthBuffer;
+	DepthFormat format = depth.format; float scale = depth.scale;
+	DestroyDepthBuffer(depth);
+	depth = CreateDepthBuffer(format, renderer.windowWidth, renderer.windowHeight, samples, scale);
+
+	DestroyMultisampleBuffer(display.multisample);
+	display.multisample = CreateMultisampleBuffer(samples, renderer.windowWidth, renderer.windowHeight);
+}
+
+template<DepthFormat F>
+static uint64_t CountCoveredPixels(const DepthBuffer &buffer) {
+	const typename DepthTraits<F>::Storage *depth = DepthAs<F>(buffer);
+	uint64_t covered = 0;
+	for (int t = 0; t < buffer.tilesWide * buffer.tilesHigh; t++) {
+		if (buffer.tileStates[t] != TILE_DIRTY) continue;
+		int x0 = (t % buffer.tilesWide) * TILE_SIZE; int x1 = std::min(x0 + TILE_SIZE, buffer.width);
+		int y0 = (t / buffer.tilesWide) * TILE_SIZE; int y1 = std::min(y0 + TILE_SIZE, buffer.height);
+		for (int y = y0; y < y1; y++) {
+			for (int x = x0; x < x1; x++) {
+				int index = (y * buffer.width + x) * buffer.samples;
+				for (int s = 0; s < buffer.samples; s++) {
+					if (DepthTraits<F>::Passes(depth[index + s], DepthTraits<F>::CLEAR)) { covered++; break; }
+				}
+			}
 		}
 	}
+	return covered;
+}
+
+//Pixels where any sample holds geometry, for the overdraw readout
+uint64_t CountCoveredPixels() {
+	switch (display.depthBuffer.format) {
+	case DEPTH_F32: return CountCoveredPixels<DEPTH_F32>(display.depthBuffer);
+	case DEPTH_UNORM16: return CountCoveredPixels<DEPTH_UNORM16>(display.depthBuffer);
+	case DEPTH_UNORM24_S8: return CountCoveredPixels<DEPTH_UNORM24_S8>(display.depthBuffer);
+	}
+	return 0;
+}
+
+//Averages the edge pixels into the color buffer, must run before anything is drawn without MSAA
+void ResolveSamples() {
+	if (display.multisample.sampleCount > 1) ResolveMultisampleBuffer(display.multisample, display.colorBuffer);
+}
+
+void DrawGrid(int step) {
+	DrawGridPattern(display.colorBuffer, step, 0xFF606060);
 }
 
 void DrawPixel(int x, int y, uint32_t color) {
-	if(x >= 0 and y >= 0 and x < renderer.windowWidth and y < renderer.windowHeight)
-		display.colorBuffer[(y * renderer.windowWidth) + x] = color;
+	if(x >= 0 and y >= 0 and x < renderer.windowWidth and y < renderer.windowHeight) {
+		MaterializeColorPixel(display.colorBuffer, x, y);
+		StoreColor(display.colorBuffer, (y * renderer.windowWidth) + x, color);
+	}
 	// else std::cout << "Out of window bounds DrawPixel() call. Coords: " << x << ", " << y << std::endl;
 }
 
+//Horizontal run [xMin, xMax] on row y. Must already be inside the screen.
+static inline void DrawSpan(int y, int xMin, int xMax, uint32_t color) {
+	MaterializeColorRect(display.colorBuffer, xMin, y, xMax + 1, y + 1);
+	FillColorSpan(display.colorBuffer, y, xMin, xMax + 1, color);
+}
+
+enum OutCode {
+	OUT_INSIDE = 0,
+	OUT_LEFT = 1,
+	OUT_RIGHT = 2,
+	OUT_TOP = 4,
+	OUT_BOTTOM = 8
+};
+
+static int GetOutCode(double x, double y, int xMax, int yMax) {
+	int code = OUT_INSIDE;
+	if (x < 0) code |= OUT_LEFT;
+	else if (x > xMax) code |= OUT_RIGHT;
+	if (y < 0) code |= OUT_TOP;
+	else if (y > yMax) code |= OUT_BOTTOM;
+	return code;
+}
+
+//Cohen-Sutherland, clips the segment to [0, xMax] x [0, yMax]. Returns false if nothing is left.
+static bool ClipLine(int &x0, int &y0, int &x1, int &y1, int xMax, int yMax) {
+	double ax = x0, ay = y0, bx = x1, by = y1;
+	int codeA = GetOutCode(ax, ay, xMax, yMax);
+	int codeB = GetOutCode(bx, by, xMax, yMax);
+
+	while (true) {
+		if (!(codeA | codeB)) break; //Both inside
+		if (codeA & codeB) return false; //Both on the same outer side
+
+		int code = codeA ? codeA : codeB;
+		double x, y;
+		if (code & OUT_BOTTOM) { x = ax + (bx - ax) * (yMax - ay) / (by - ay); y = yMax; }
+		else if (code & OUT_TOP) { x = ax + (bx - ax) * (0 - ay) / (by - ay); y = 0; }
+		else if (code & OUT_RIGHT) { y = ay + (by - ay) * (xMax - ax) / (bx - ax); x = xMax; }
+		else { y = ay + (by - ay) * (0 - ax) / (bx - ax); x = 0; }
+
+		if (code == codeA) { ax = x; ay = y; codeA = GetOutCode(ax, ay, xMax, yMax); }
+		else { bx = x; by = y; codeB = GetOutCode(bx, by, xMax, yMax); }
+	}
+
+	x0 = std::clamp((int)lround(ax), 0, xMax); y0 = std::clamp((int)lround(ay), 0, yMax);
+	x1 = std::clamp((int)lround(bx), 0, xMax); y1 = std::clamp((int)lround(by), 0, yMax);
+	return true;
+}
+
 //Bresensham's line algorithm
+//The line is clipped once up front, then consecutive pixels on the same row are written as one span
 void DrawLine(int x0, int y0, int x1, int y1, uint32_t color) {
+	if (!ClipLine(x0, y0, x1, y1, renderer.windowWidth - 1, renderer.windowHeight - 1)) return;
+
 	int dx = abs(x1 - x0);
 	int sx = x0 < x1 ? 1 : -1;
 	int dy = -abs(y1 - y0);
 	int sy = y0 < y1 ? 1 : -1;
 	int error = dx + dy;
+	int spanStart = x0;
 
 	while (true) {
-		DrawPixel(x0, y0, color);
 		if(x0 == x1 and y0 == y1) break;
 		int e2 = 2 * error;
+		int prevX = x0;
 		if (e2 >= dy) { //advance in x
 			error = error + dy;
 			x0 = x0 + sx;
 		}
-		if (e2 <= dx) { //advance in y
+		if (e2 <= dx) { //advance in y, flush the run on the row we are leaving
+			DrawSpan(y0, std::min(spanStart, prevX), std::max(spanStart, prevX), color);
 			error = error + dx;
 			y0 = y0 + sy;
+			spanStart = x0;
 		}
 	}
+	DrawSpan(y0, std::min(spanStart, x0), std::max(spanStart, x0), color);
 }
 
 void DrawTriangle(const Triangle &tri, uint32_t color) {
@@ -65,10 +180,127 @@ void DrawTriangle(const Triangle &tri, uint32_t color) {
 }
 
 void DrawFilledRect(int x, int y, int w, int h, uint32_t color) {
-	for (int i = 0; i < h; i++) { for (int j = 0; j < w; j++) { DrawPixel(j+x, i+y, color); } }
+	int xMin = std::max(x, 0); int xMax = std::min(x + w, renderer.windowWidth);
+	int yMin = std::max(y, 0); int yMax = std::min(y + h, renderer.windowHeight);
+	if (xMin >= xMax or yMin >= yMax) return;
+
+	MaterializeColorRect(display.colorBuffer, xMin, yMin, xMax, yMax);
+	for (int i = yMin; i < yMax; i++) FillColorSpan(display.colorBuffer, i, xMin, xMax, color);
+}
+
+//Wireframe lines are pulled slightly towards the camera so edges lying on the surface win the depth test
+static const float LINE_DEPTH_BIAS = 0.005f;
+
+//Lines are binned to the framebuffer tiles and every tile only plots its own pixels, so tiles are independent
+//and draw in parallel.
+//The minor axis position is computed in closed form per major axis step (no Bresenham error term),
+//which makes the pixels of a line split across tiles identical to drawing it in one go.
+template<DepthFormat DF>
+static void DrawLineInTile(const Line &line, int tileX0, int tileY0, int tileX1, int tileY1, const Float4 &color, uint32_t packedColor, bool antialiased) {
+	float ax = line.points[0].x; float ay = line.points[0].y; float aInvW = 1.0f / line.points[0].w;
+	float bx = line.points[1].x; float by = line.points[1].y; float bInvW = 1.0f / line.points[1].w;
+
+	//Step along the longer axis, (u, v) = (major, minor)
+	bool steep = std::abs(by - ay) > std::abs(bx - ax);
+	if (steep) { std::swap(ax, ay); std::swap(bx, by); }
+	if (ax > bx) { std::swap(ax, bx); std::swap(ay, by); std::swap(aInvW, bInvW); }
+	float length = bx - ax;
+	if (length <= 0) return;
+	float slope = (by - ay) / length;
+
+	int majorMin = steep ? tileY0 : tileX0; int majorMax = steep ? tileY1 : tileX1;
+	int minorMin = steep ? tileX0 : tileY0; int minorMax = steep ? tileX1 : tileY1;
+
+	//Columns whose pixel centers lie on the segment
+	int uStart = std::max((int)ceil(ax - 0.5f), majorMin);
+	int uEnd = std::min((int)floor(bx - 0.5f) + 1, majorMax);
+
+	auto plot = [&](int u, int v, float invW, float coverage) {
+		if (v < minorMin or v >= minorMax) return;
+		int x = steep ? v : u; int y = steep ? u : v;
+		int index = (renderer.windowWidth * y) + x;
+		if (!DepthTest<DF>(display.depthBuffer, index * display.depthBuffer.samples, invW * (1.0f + LINE_DEPTH_BIAS))) return;
+		if (!antialiased) { StoreColor(display.colorBuffer, index, packedColor); return; }
+
+		Float4 dst = LoadColor(display.colorBuffer, index);
+		StoreColorHDR(display.colorBuffer, index,
+			dst.r + (color.r - dst.r) * coverage,
+			dst.g + (color.g - dst.g) * coverage,
+			dst.b + (color.b - dst.b) * coverage,
+			dst.a + (color.a - dst.a) * coverage
+		);
+	};
+
+	for (int u = uStart; u < uEnd; u++) {
+		float t = ((u + 0.5f) - ax) / length;
+		float v = ay + slope * ((u + 0.5f) - ax);
+		float invW = aInvW + (bInvW - aInvW) * t;
+
+		if (antialiased) {
+			//Xiaolin Wu, coverage split between the two pixels straddling the line
+			float vCenter = v - 0.5f;
+			int v0 = (int)floor(vCenter);
+			float fraction = vCenter - v0;
+			plot(u, v0, invW, 1.0f - fraction);
+			plot(u, v0 + 1, invW, fraction);
+		} else {
+			plot(u, (int)floor(v), invW, 1.0f);
+		}
+	}
 }
 
-void DrawTexel(int x, int y, const Triangle &tri, uint32_t *texture, const Vec3f &weights) {
+template<DepthFormat DF>
+static void DrawLinesTiled(const std::vector<Line> &lines, uint32_t color, bool antialiased) {
+	ColorBuffer &colorBuffer = display.colorBuffer;
+	int tileCount = colorBuffer.tilesWide * colorBuffer.tilesHigh;
+
+	//Bins keep their capacity between frames
+	static std::vector<std::vector<int>> bins;
+	bins.resize(tileCount);
+	for (std::vector<int> &bin : bins) bin.clear();
+
+	for (int i = 0; i < (int)lines.size(); i++) {
+		const Line &line = lines[i];
+		//One pixel of slack for the second Wu pixel and rounding at the ends
+		int xMin = std::max((int)floor(std::min(line.points[0].x, line.points[1].x)) - 1, 0);
+		int yMin = std::max((int)floor(std::min(line.points[0].y, line.points[1].y)) - 1, 0);
+		int xMax = std::min((int)ceil(std::max(line.points[0].x, line.points[1].x)) + 1, renderer.windowWidth - 1);
+		int yMax = std::min((int)ceil(std::max(line.points[0].y, line.points[1].y)) + 1, renderer.windowHeight - 1);
+		if (xMin > xMax or yMin > yMax) continue;
+
+		for (int ty = yMin / TILE_SIZE; ty <= yMax / TILE_SIZE; ty++)
+			for (int tx = xMin / TILE_SIZE; tx <= xMax / TILE_SIZE; tx++)
+				bins[ty * colorBuffer.tilesWide + tx].push_back(i);
+	}
+
+	Float4 colorF = PixelTraits<PIXEL_RGBA8>::Decode(color);
+	ParallelFor(0, tileCount, 1, [&](int first, int last) {
+		for (int t = first; t < last; t++) {
+			if (bins[t].empty()) continue;
+			MaterializeColorTile(colorBuffer, t);
+			MaterializeDepthTile(display.depthBuffer, t);
+
+			int tileX0 = (t % colorBuffer.tilesWide) * TILE_SIZE;
+			int tileY0 = (t / colorBuffer.tilesWide) * TILE_SIZE;
+			int tileX1 = std::min(tileX0 + TILE_SIZE, renderer.windowWidth);
+			int tileY1 = std::min(tileY0 + TILE_SIZE, renderer.windowHeight);
+			for (int i : bins[t]) DrawLineInTile<DF>(lines[i], tileX0, tileY0, tileX1, tileY1, colorF, color, antialiased);
+		}
+	});
+}
+
+//Batched, depth tested line pass (wireframe overlay). Lines don't write depth.
+void DrawLines(const std::vector<Line> &lines, uint32_t color, bool antialiased) {
+	if (lines.empty()) return;
+	switch (display.depthBuffer.format) {
+	case DEPTH_F32: DrawLinesTiled<DEPTH_F32>(lines, color, antialiased); break;
+	case DEPTH_UNORM16: DrawLinesTiled<DEPTH_UNORM16>(lines, color, antialiased); break;
+	case DEPTH_UNORM24_S8: DrawLinesTiled<DEPTH_UNORM24_S8>(lines, color, antialiased); break;
+	}
+}
+
+//Perspective correct texture lookup. Also returns the interpolated 1/w used for the depth test.
+static inline uint32_t ShadeTexel(const Triangle &tri, const Texture &texture, const Vec3f &weights, float &reciprocalW) {
 	float alpha = weights.x; float beta = weights.y; float gamma = weights.z;
 	
 	float u0 = tri.texCoords[0].u; float v0 = tri.texCoords[0].v;
@@ -87,99 +319,53 @@ void DrawTexel(int x, int y, const Triangle &tri, uint32_t *texture, const Vec3f
 	interpolatedU /= interpolatedReciprocatedW;
 	interpolatedV /= interpolatedReciprocatedW;
 
-	int textureX = abs((int)(interpolatedU * model.textureWidth)) % model.textureWidth;
-	int textureY = abs((int)(interpolatedV * model.textureHeight)) % model.textureHeight;
+	int textureX = abs((int)(interpolatedU * texture.width)) % texture.width;
+	int textureY = abs((int)(interpolatedV * texture.height)) % texture.height;
+
+	reciprocalW = interpolatedReciprocatedW;
+	return SampleTexel(texture, textureX, textureY);
+}
 
+//Single sample path
+template<DepthFormat DF>
+static inline void DrawTexel(int x, int y, const Triangle &tri, const Texture &texture, const Vec3f &weights) {
 	//Possibly unnecessary
 	bool inBounds = x >= 0 and y >= 0 and x < renderer.windowWidth and y < renderer.windowHeight;
 	if (!inBounds) return;
 
-	//Only draw the pixel if the depth value is less than the previous drawn pixel
-	if (interpolatedReciprocatedW > display.zBuffer[(renderer.windowWidth * y) + x]) {
-		uint32_t color = texture[(model.textureWidth * textureY) + textureX];
-		DrawPixel(x, y, color);
-		display.zBuffer[(renderer.windowWidth * y) + x] = interpolatedReciprocatedW;
-	}
-}
+	float reciprocalW;
+	uint32_t texel = ShadeTexel(tri, texture, weights, reciprocalW);
 
-bool isEdgeTopLeft(const Vec4f &start, const Vec4f &end){
-	Vec4f edge = end - start;
-	bool isTopEdge = edge.y == 0 and edge.x > 0;
-	bool isLeftEdge = edge.y < 0;
-	return isTopEdge or isLeftEdge;
+	//Only draw the pixel if it is closer than the previously drawn pixel
+	int index = (renderer.windowWidth * y) + x;
+	if (DepthTestAndWrite<DF>(display.depthBuffer, index * display.depthBuffer.samples, reciprocalW)) {
+		StoreColor(display.colorBuffer, index, texel);
+	}
 }
 
-//Bounding Box Barycentric Rasterization
-void RasterizeTriangle(const Triangle &tri, bool isTextured, uint32_t color, uint32_t *texture){
-	Vec4f v0 = tri.points[0];
-	Vec4f v1 = tri.points[1];
-	Vec4f v2 = tri.points[2];
-	
-	//Finding the bounds of the box
-	int xMin = floor(std::min({v0.x, v1.x, v2.x}));
-	int yMin = floor(std::min({v0.y, v1.y, v2.y}));
-	int xMax = ceil(std::max({v0.x, v1.x, v2.x}));
-	int yMax = ceil(std::max({v0.y, v1.y, v2.y}));
-
-	//The constant deltas of the area that we get by 2D crossing the two edges of the smaller triangle for the barycentric weights.
-	//Giving us the numerator.
-	float deltaW0Col = (v1.y - v2.y);
-	float deltaW1Col = (v2.y - v0.y);
-	float deltaW2Col = (v0.y - v1.y);
-	float deltaW0Row = (v2.x - v1.x);
-	float deltaW1Row = (v0.x - v2.x);
-	float deltaW2Row = (v1.x - v0.x);
-
-	//Area of the bigger triangle for the denominator of the barycentric weights.
-	float area;
-	if (isTextured) { area = Vec2Cross(Vec2f(v1 - v0), Vec2f(v2 - v0)); }
-
-	//Fill convention (top-left rasterization rule)
-	//if the edge is not top left we will forego fill rights
-	float bias0 = isEdgeTopLeft(v1, v2) ? 0 : -0.0001;
-	float bias1 = isEdgeTopLeft(v2, v0) ? 0 : -0.0001;
-	float bias2 = isEdgeTopLeft(v0, v1) ? 0 : -0.0001;
-
-	//The starting pixel
-	Vec4f p0 = {xMin + 0.5f, yMin + 0.5f, 0, 0};
-	//The starting values for the numerator of the barycentric calculation for this row
-	float w0Row = Vec2Cross(Vec2f(v2 - v1), Vec2f(p0 - v1)) + bias0;
-	float w1Row = Vec2Cross(Vec2f(v0 - v2), Vec2f(p0 - v2)) + bias1;
-	float w2Row = Vec2Cross(Vec2f(v1 - v0), Vec2f(p0 - v0)) + bias2;
-
-	//Loop over the candidate pixels within the boundry
-	for (int y = yMin; y < yMax; y++) {
-		float w0 = w0Row;
-		float w1 = w1Row;
-		float w2 = w2Row;
-
-		for (int x = xMin; x < xMax; x++) {
-			bool isInside = w0 >= 0 and w1 >= 0 and w2 >= 0;
-			if (isInside) { 
-				if (isTextured) { 
-					DrawTexel(x, y, tri, model.meshTexture, {w0/area, w1/area, w2/area});
-				}
-				else { DrawPixel(x, y, color); }
-			}
-
-			w0 += deltaW0Col;
-			w1 += deltaW1Col;
-			w2 += deltaW2Col;
-		}
-
-		w0Row += deltaW0Row;
-		w1Row += deltaW1Row;
-		w2Row += deltaW2Row;
+void DrawTexel(int x, int y, const Triangle &tri, const Texture &texture, const Vec3f &weights) {
+	if (x < 0 or y < 0 or x >= renderer.windowWidth or y >= renderer.windowHeight) return;
+	MaterializeColorRect(display.colorBuffer, x, y, x + 1, y + 1);
+	MaterializeDepthRect(display.depthBuffer, x, y, x + 1, y + 1);
+	switch (display.depthBuffer.format) {
+	case DEPTH_F32: DrawTexel<DEPTH_F32>(x, y, tri, texture, weights); break;
+	case DEPTH_UNORM16: DrawTexel<DEPTH_UNORM16>(x, y, tri, texture, weights); break;
+	case DEPTH_UNORM24_S8: DrawTexel<DEPTH_UNORM24_S8>(x, y, tri, texture, weights); break;
 	}
+}
 
+//Runtime flavour of the shader pipeline, branches once per triangle
+void RasterizeTriangle(const Triangle &tri, bool isTextured, uint32_t color, const Texture *texture) {
+	if (isTextured) DrawTrianglesWithShader(&tri, 1, TextureShader{texture});
+	else DrawTrianglesWithShader(&tri, 1, FlatColorShader{color});
 }
 
 void DrawFilledTriangle(const Triangle &tri, uint32_t color) {
 	RasterizeTriangle(tri, false, color, nullptr);
 }
 
-void DrawTexturedTriangle(Triangle &tri, uint32_t *texture) {
-	RasterizeTriangle(tri, true, 0, texture);
+void DrawTexturedTriangle(Triangle &tri, const Texture &texture) {
+	RasterizeTriangle(tri, true, 0, &texture);
 }
 
 Vec4f GetScreenCoords(const Vec4f &camCoords, const Mat4f &projMat, int windowWidth, int windowHeight, bool project) {
@@ -205,13 +391,43 @@ Vec4f GetScreenCoords(const Vec4f &camCoords, const Mat4f &projMat, int windowWi
 	return v;
 }
 
-void RenderColorBuffer() {
-	SDL_UpdateTexture(
-		renderer.sdlColorBufferTexture, 
-		NULL, 
-		display.colorBuffer, 
-		(int)(sizeof(uint32_t) * renderer.windowWidth)
-	);
+Vec3f GetViewCoords(const Vec4f &rasterCoords, const Mat4f &projMat, int windowWidth, int windowHeight) {
+	//Raster space -> NDC, then undo the projection using w (the camera space z)
+	float ndcX = rasterCoords.x / (windowWidth / 2.0f) - 1.0f;
+	float ndcY = 1.0f - rasterCoords.y / (windowHeight / 2.0f);
+	float w = rasterCoords.w;
+	return {ndcX * w / projMat.data[0][0], ndcY * w / projMat.data[1][1], w};
+}
+
+//RGB565 targets are uploaded as is, everything else is presented as RGBA8
+uint32_t GetSdlPixelFormat(PixelFormat format) {
+	return format == PIXEL_RGB565 ? SDL_PIXELFORMAT_RGB565 : SDL_PIXELFORMAT_RGBA32;
+}
+
+//The texture stays locked from ResolveColorBufferAsync() to CopyResolvedColorBuffer(), SDL calls
+//only happen on the main thread, the job just writes the locked pixels
+static bool textureLocked = false;
+
+void ResolveColorBufferAsync(const ColorBuffer &buffer, JobCounter &counter) {
+	void *texturePixels; int texturePitch;
+	textureLocked = SDL_LockTexture(renderer.sdlColorBufferTexture, NULL, &texturePixels, &texturePitch) == 0;
+	if (!textureLocked) return;
+	RunJob([&buffer, texturePixels, texturePitch] {
+		PROFILE_SCOPE("present resolve");
+		ResolveColorBuffer(buffer, texturePixels, texturePitch, display.exposure, display.whitePoint);
+	}, &counter);
+}
+
+void CopyResolvedColorBuffer(JobCounter &counter) {
+	WaitForJobs(counter);
+	if (textureLocked) SDL_UnlockTexture(renderer.sdlColorBufferTexture);
+	textureLocked = false;
 
 	SDL_RenderCopy(renderer.sdlRenderer, renderer.sdlColorBufferTexture, NULL, NULL);
 }
+
+void RenderColorBuffer() {
+	JobCounter resolveJob;
+	ResolveColorBufferAsync(display.colorBuffer, resolveJob);
+	CopyResolvedColorBuffer(resolveJob);
+}
@@ -1,26 +1,55 @@
 #pragma once
+#include "deferred.h"
+#include "framebuffer.h"
 #include "linear_algebra.h"
 #include "model.h"
+#include "oit.h"
+#include "raster.h"
+#include "shadow.h"
+#include "visibility.h"
 #include <cstdint>
+#include <vector>
+
+struct JobCounter;
 
 struct Display{
-	uint32_t* colorBuffer;
-	float* zBuffer;
+	ColorBuffer colorBuffer; //Raster target
+	ColorBuffer presentBuffer; //With two frames in flight, the previous frame's image, presented while colorBuffer is drawn
+	DepthBuffer depthBuffer;
+	MultisampleBuffer multisample;
+	GBuffer gbuffer;
+	VisibilityBuffer visibility;
+	ShadowMap shadowMap;
+	OitBuffer oit;
+	float exposure; //HDR resolve only
+	float whitePoint; //HDR resolve only
 };
 extern Display display;
 
 void ClearColorBuffer(uint32_t color);
 void ClearZBuffer();
+void SetSampleCount(int samples);
+void ResolveSamples();
+uint64_t CountCoveredPixels();
 
 void DrawGrid(int step);
 void DrawPixel(int x, int y, uint32_t color);
 void DrawLine(int x0, int y0, int x1, int y1, uint32_t color);
 void DrawTriangle(const Triangle &tri, uint32_t color);
+void DrawLines(const std::vector<Line> &lines, uint32_t color, bool antialiased);
 void DrawFilledRect(int x, int y, int w, int h, uint32_t color);
 void DrawFilledTriangle(const Triangle &tri, uint32_t color);
-void DrawTexel(int x, int y, const Triangle &tri, uint32_t *texture, const Vec3f &weights);
-void DrawTexturedTriangle(Triangle &tri, uint32_t *texture);
+void RasterizeTriangle(const Triangle &tri, bool isTextured, uint32_t color, const Texture *texture);
+void DrawTexel(int x, int y, const Triangle &tri, const Texture &texture, const Vec3f &weights);
+void DrawTexturedTriangle(Triangle &tri, const Texture &texture);
 
 Vec4f GetScreenCoords(const Vec4f &camCoords, const Mat4f &projMat, int windowWidth, int windowHeight, bool project);
+//Inverse of GetScreenCoords() for a raster point that kept its clip w
+Vec3f GetViewCoords(const Vec4f &rasterCoords, const Mat4f &projMat, int windowWidth, int windowHeight);
 
+uint32_t GetSdlPixelFormat(PixelFormat format);
+//Resolves buffer into the SDL texture as a job counted by counter, so the main thread can keep
+//drawing. CopyResolvedColorBuffer() waits on the same counter and copies the texture to the screen.
+void ResolveColorBufferAsync(const ColorBuffer &buffer, JobCounter &counter);
+void CopyResolvedColorBuffer(JobCounter &counter);
 void RenderColorBuffer();
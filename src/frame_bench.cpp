@@ -0,0 +1,188 @@
+#include "frame_bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "assets.h"
+#include "camera.h"
+#include "camera_path.h"
+#include "jobs.h"
+#include "lighting.h"
+#include "profiler.h"
+#include "renderer.h"
+
+//Simulated time per frame, independent of how long frames take to draw
+static const float FRAME_STEP = 1.0f / 60.0f;
+
+struct TimingSummary {
+	double mean, p50, p95, p99, max;
+};
+
+//Nearest rank percentiles
+static TimingSummary Summarize(std::vector<double> samples) {
+	if (samples.empty()) return {};
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&](double p) {
+		size_t rank = (size_t)std::ceil(p / 100.0 * samples.size());
+		return samples[std::clamp(rank, (size_t)1, samples.size()) - 1];
+	};
+	double sum = 0;
+	for (double sample : samples) sum += sample;
+	return {sum / samples.size(), percentile(50), percentile(95), percentile(99), samples.back()};
+}
+
+static const char *ShadingPathName(ShadingPath path) {
+	switch (path) {
+	case SHADING_FORWARD: return "forward";
+	case SHADING_DEFERRED: return "deferred";
+	case SHADING_VISIBILITY: return "visibility";
+	}
+	return "";
+}
+
+bool ParseFrameBenchOptions(int argc, char* argv[], FrameBenchOptions &options) {
+	options = {
+		.path = "orbit",
+		.frames = 600,
+		.warmupFrames = 30,
+		.width = 1280,
+		.height = 720,
+		.workerThreads = -1,
+		.instanceCount = 9,
+		.jsonPath = "",
+		.tracePath = "",
+	};
+	bool bench = false;
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--frame-bench") == 0) {
+			bench = true;
+			if (hasValue and strncmp(argv[i + 1], "--", 2) != 0) options.path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--frames") == 0 and hasValue) options.frames = std::max(atoi(argv[++i]), 1);
+		else if (strcmp(argv[i], "--warmup") == 0 and hasValue) options.warmupFrames = std::max(atoi(argv[++i]), 0);
+		else if (strcmp(argv[i], "--size") == 0 and hasValue) sscanf_s(argv[++i], "%dx%d", &options.width, &options.height);
+		else if (strcmp(argv[i], "--workers") == 0 and hasValue) options.workerThreads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--instances") == 0 and hasValue) options.instanceCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--frame-json") == 0 and hasValue) options.jsonPath = argv[++i];
+		else if (strcmp(argv[i], "--trace") == 0 and hasValue) options.tracePath = argv[++i];
+	}
+	return bench;
+}
+
+int RunFrameBenchmark(const FrameBenchOptions &options) {
+	const CameraPath *path = FindCameraPath(options.path.c_str());
+	if (!path) {
+		std::cout << "Frame bench: no camera path named " << options.path << ", try:";
+		for (const char *name : GetCameraPathNames()) std::cout << " " << name;
+		std::cout << std::endl;
+		return 1;
+	}
+	if (options.width <= 0 or options.height <= 0) {
+		std::cout << "Frame bench: bad size " << options.width << "x" << options.height << std::endl;
+		return 1;
+	}
+
+	SetupHeadless(options.width, options.height);
+	int workerThreads = options.workerThreads >= 0 ? options.workerThreads : std::max((int)std::thread::hardware_concurrency() - 1, 0);
+	StopJobSystem();
+	StartJobSystem(workerThreads);
+	renderer.instanceCount = std::clamp(options.instanceCount, 1, (int)renderer.instances.size());
+
+	const Mesh *mesh = GetMesh(model.mesh);
+	const Texture *texture = GetTexture(model.texture);
+	if (!mesh or !texture) {
+		std::cout << "Frame bench: couldn't load the crab assets." << std::endl;
+		CleanUp();
+		return 1;
+	}
+
+	//Per timed frame: the geometry build, every draw stage, and the whole frame
+	std::vector<double> geometryMs, frameMs;
+	std::vector<double> stageMs[STAGE_COUNT];
+	uint64_t trianglesDrawn = 0;
+	for (int i = 0; i < options.warmupFrames + options.frames; i++) {
+		CameraPose pose = SampleCameraPath(*path, i * FRAME_STEP);
+		if (path->movesCamera) {
+			camera.position = pose.position;
+			camera.yawAngle = pose.yaw;
+		}
+		renderer.rotation = pose.rotation;
+		renderer.deltaTime = FRAME_STEP;
+		if (i == options.warmupFrames and !options.tracePath.empty() and !StartProfileCapture(options.frames, options.tracePath)) {
+			std::cout << "Frame bench: built without the profiler, no trace" << std::endl;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		RenderHeadless(mesh, texture);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (i < options.warmupFrames) continue;
+
+		const FrameGeometry &frame = renderer.frames[renderer.drawnFrame];
+		geometryMs.push_back(frame.buildMs);
+		for (int s = 0; s < STAGE_COUNT; s++) stageMs[s].push_back(renderer.stageMs[s]);
+		frameMs.push_back(ms);
+		trianglesDrawn += frame.trisToRender.size();
+	}
+
+	struct Series { const char *name; TimingSummary summary; };
+	std::vector<Series> series;
+	series.push_back({"geometry", Summarize(geometryMs)});
+	for (int s = 0; s < STAGE_COUNT; s++) series.push_back({FRAME_STAGE_NAMES[s], Summarize(stageMs[s])});
+	series.push_back({"frame", Summarize(frameMs)});
+	double totalSeconds = 0;
+	for (double ms : frameMs) totalSeconds += ms / 1000.0;
+	double fps = options.frames / totalSeconds;
+
+	char line[160];
+	std::cout << "Frame bench: " << path->name << ", " << options.frames << " frames at " << options.width << "x" << options.height
+		<< ", " << workerThreads << " workers, " << renderer.instanceCount << " instances, "
+		<< renderer.sampleCount << "x MSAA, " << ShadingPathName(renderer.shadingPath) << std::endl;
+	snprintf(line, sizeof(line), "%-10s %10s %10s %10s %10s %10s", "Stage (ms)", "mean", "p50", "p95", "p99", "max");
+	std::cout << line << std::endl;
+	for (const Series &s : series) {
+		snprintf(line, sizeof(line), "%-10s %10.3f %10.3f %10.3f %10.3f %10.3f", s.name, s.summary.mean, s.summary.p50, s.summary.p95, s.summary.p99, s.summary.max);
+		std::cout << line << std::endl;
+	}
+	snprintf(line, sizeof(line), "%.1f fps average, %.0f triangles per frame", fps, (double)trianglesDrawn / options.frames);
+	std::cout << line << std::endl;
+
+	if (!options.jsonPath.empty()) {
+		std::ofstream file(options.jsonPath);
+		file << "{\n  \"scene\": {\n";
+		file << "    \"path\": \"" << path->name << "\",\n";
+		file << "    \"frames\": " << options.frames << ",\n";
+		file << "    \"warmup_frames\": " << options.warmupFrames << ",\n";
+		file << "    \"width\": " << options.width << ",\n";
+		file << "    \"height\": " << options.height << ",\n";
+		file << "    \"workers\": " << workerThreads << ",\n";
+		file << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+		file << "    \"instances\": " << renderer.instanceCount << ",\n";
+		file << "    \"sample_count\": " << renderer.sampleCount << ",\n";
+		file << "    \"shading_path\": \"" << ShadingPathName(renderer.shadingPath) << "\",\n";
+		file << "    \"lighting_kernels\": \"" << (LightingUsesSimd() ? "sse" : "scalar") << "\",\n";
+#ifdef NDEBUG
+		file << "    \"build_type\": \"release\"\n";
+#else
+		file << "    \"build_type\": \"debug\"\n";
+#endif
+		file << "  },\n  \"stages_ms\": {\n";
+		for (size_t i = 0; i < series.size(); i++) {
+			const TimingSummary &s = series[i].summary;
+			file << "    \"" << series[i].name << "\": {\"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p95\": " << s.p95
+				<< ", \"p99\": " << s.p99 << ", \"max\": " << s.max << "}" << (i + 1 < series.size() ? "," : "") << "\n";
+		}
+		file << "  },\n";
+		file << "  \"fps_mean\": " << fps << ",\n";
+		file << "  \"triangles_per_frame\": " << (double)trianglesDrawn / options.frames << "\n}\n";
+	}
+
+	CleanUp();
+	return 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+
+//End to end frame benchmark: loads the crab scene headlessly, replays a scripted camera path at a fixed
+//60 Hz step (so every run draws the same frames) without any frame cap, and reports per stage
+//timing percentiles. Frames are built and drawn one after the other, so the stages add up to the
+//frame time. Started with --frame-bench.
+struct FrameBenchOptions {
+	std::string path; //Camera path name, see camera_path.h
+	int frames; //Timed frames
+	int warmupFrames; //Drawn first and not timed (asset loads, arena growth, caches)
+	int width;
+	int height;
+	int workerThreads; //-1 picks one per extra core
+	int instanceCount;
+	std::string jsonPath; //Also writes the results there if not empty
+	std::string tracePath; //Chrome trace of the timed frames if not empty, profiling adds to the timings
+};
+
+//True if the command line asks for a frame benchmark:
+//  --frame-bench [path] [--frames N] [--warmup N] [--size WxH] [--workers N] [--instances N] [--frame-json path] [--trace path]
+bool ParseFrameBenchOptions(int argc, char* argv[], FrameBenchOptions &options);
+//Returns the process exit code
+int RunFrameBenchmark(const FrameBenchOptions &options);
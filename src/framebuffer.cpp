@@ -0,0 +1,356 @@
+#include "framebuffer.h"
+#include <algorithm>
+#include "jobs.h"
+
+//Calls Fn<F>(args...) for the buffer's runtime format
+#define DISPATCH_PIXEL_FORMAT(format, Fn, ...) \
+	switch (format) { \
+	case PIXEL_RGB565: Fn<PIXEL_RGB565>(__VA_ARGS__); break; \
+	case PIXEL_RGBA8: Fn<PIXEL_RGBA8>(__VA_ARGS__); break; \
+	case PIXEL_RGBA16F: Fn<PIXEL_RGBA16F>(__VA_ARGS__); break; \
+	case PIXEL_RGBA32F: Fn<PIXEL_RGBA32F>(__VA_ARGS__); break; \
+	}
+
+#define DISPATCH_DEPTH_FORMAT(format, Fn, ...) \
+	switch (format) { \
+	case DEPTH_F32: Fn<DEPTH_F32>(__VA_ARGS__); break; \
+	case DEPTH_UNORM16: Fn<DEPTH_UNORM16>(__VA_ARGS__); break; \
+	case DEPTH_UNORM24_S8: Fn<DEPTH_UNORM24_S8>(__VA_ARGS__); break; \
+	}
+
+struct TileRect {
+	int x0, y0, x1, y1;
+};
+
+static TileRect GetTileRect(int tileIndex, int tilesWide, int width, int height) {
+	int tx = tileIndex % tilesWide;
+	int ty = tileIndex / tilesWide;
+	return TileRect{
+		.x0 = tx * TILE_SIZE,
+		.y0 = ty * TILE_SIZE,
+		.x1 = std::min((tx + 1) * TILE_SIZE, width),
+		.y1 = std::min((ty + 1) * TILE_SIZE, height),
+	};
+}
+
+//First multiple of step that is >= v
+static inline int AlignUp(int v, int step) {
+	return ((v + step - 1) / step) * step;
+}
+
+//////////////////////////////////////////////////
+/// Color
+//////////////////////////////////////////////////
+int BytesPerPixel(PixelFormat format) {
+	switch (format) {
+	case PIXEL_RGB565: return sizeof(PixelTraits<PIXEL_RGB565>::Storage);
+	case PIXEL_RGBA8: return sizeof(PixelTraits<PIXEL_RGBA8>::Storage);
+	case PIXEL_RGBA16F: return sizeof(PixelTraits<PIXEL_RGBA16F>::Storage);
+	case PIXEL_RGBA32F: return sizeof(PixelTraits<PIXEL_RGBA32F>::Storage);
+	}
+	return 0;
+}
+
+ColorBuffer CreateColorBuffer(PixelFormat format, int width, int height) {
+	int tilesWide = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesHigh = (height + TILE_SIZE - 1) / TILE_SIZE;
+	ColorBuffer buffer = {
+		.format = format,
+		.width = width,
+		.height = height,
+		.pixels = new uint8_t[(size_t)width * height * BytesPerPixel(format)],
+		.tilesWide = tilesWide,
+		.tilesHigh = tilesHigh,
+		.tileStates = new uint8_t[tilesWide * tilesHigh],
+		.clearColor = 0,
+		.gridStep = 0,
+		.gridColor = 0,
+	};
+	FastClearColorBuffer(buffer, 0);
+	return buffer;
+}
+
+void DestroyColorBuffer(ColorBuffer &buffer) {
+	delete[] static_cast<uint8_t*>(buffer.pixels);
+	delete[] buffer.tileStates;
+	buffer.pixels = nullptr;
+	buffer.tileStates = nullptr;
+}
+
+//O(tiles): only the metadata is touched
+void FastClearColorBuffer(ColorBuffer &buffer, uint32_t color) {
+	std::fill_n(buffer.tileStates, buffer.tilesWide * buffer.tilesHigh, (uint8_t)TILE_CLEARED);
+	buffer.clearColor = color;
+	buffer.gridStep = 0;
+}
+
+template<PixelFormat F>
+static void MaterializeColor(ColorBuffer &buffer, int tileIndex) {
+	using Storage = typename PixelTraits<F>::Storage;
+	TileRect r = GetTileRect(tileIndex, buffer.tilesWide, buffer.width, buffer.height);
+	Storage clear = PixelTraits<F>::Encode(buffer.clearColor);
+	Storage grid = PixelTraits<F>::Encode(buffer.gridColor);
+	bool hasGrid = buffer.tileStates[tileIndex] == TILE_CLEARED_GRID;
+
+	for (int y = r.y0; y < r.y1; y++) {
+		Storage *row = PixelsAs<F>(buffer) + y * buffer.width;
+		std::fill(row + r.x0, row + r.x1, clear);
+		if (hasGrid and y % buffer.gridStep == 0)
+			for (int x = AlignUp(r.x0, buffer.gridStep); x < r.x1; x += buffer.gridStep) row[x] = grid;
+	}
+}
+
+void MaterializeColorTile(ColorBuffer &buffer, int tileIndex) {
+	if (buffer.tileStates[tileIndex] == TILE_DIRTY) return;
+	DISPATCH_PIXEL_FORMAT(buffer.format, MaterializeColor, buffer, tileIndex);
+	buffer.tileStates[tileIndex] = TILE_DIRTY;
+}
+
+//Makes every tile overlapping [xMin, xMax) x [yMin, yMax) writable. The rect must be inside the buffer.
+void MaterializeColorRect(ColorBuffer &buffer, int xMin, int yMin, int xMax, int yMax) {
+	if (xMin >= xMax or yMin >= yMax) return;
+	for (int ty = yMin / TILE_SIZE; ty <= (yMax - 1) / TILE_SIZE; ty++)
+		for (int tx = xMin / TILE_SIZE; tx <= (xMax - 1) / TILE_SIZE; tx++)
+			MaterializeColorTile(buffer, ty * buffer.tilesWide + tx);
+}
+
+template<PixelFormat F>
+static void FillSpan(ColorBuffer &buffer, int y, int xMin, int xMax, uint32_t color) {
+	typename PixelTraits<F>::Storage *row = PixelsAs<F>(buffer) + y * buffer.width;
+	std::fill(row + xMin, row + xMax, PixelTraits<F>::Encode(color));
+}
+
+//Unchecked horizontal fill of [xMin, xMax) on row y, the caller clips and materializes
+void FillColorSpan(ColorBuffer &buffer, int y, int xMin, int xMax, uint32_t color) {
+	DISPATCH_PIXEL_FORMAT(buffer.format, FillSpan, buffer, y, xMin, xMax, color);
+}
+
+template<PixelFormat F>
+static void DrawGridDots(ColorBuffer &buffer, int tileIndex, int step, uint32_t color) {
+	TileRect r = GetTileRect(tileIndex, buffer.tilesWide, buffer.width, buffer.height);
+	typename PixelTraits<F>::Storage value = PixelTraits<F>::Encode(color);
+	for (int y = AlignUp(r.y0, step); y < r.y1; y += step) {
+		typename PixelTraits<F>::Storage *row = PixelsAs<F>(buffer) + y * buffer.width;
+		for (int x = AlignUp(r.x0, step); x < r.x1; x += step) row[x] = value;
+	}
+}
+
+//Cleared tiles only remember the pattern, it gets written when they are materialized or resolved
+void DrawGridPattern(ColorBuffer &buffer, int step, uint32_t color) {
+	int tileCount = buffer.tilesWide * buffer.tilesHigh;
+	if (buffer.gridStep != 0 and (buffer.gridStep != step or buffer.gridColor != color)) {
+		//Only one pending pattern per clear, bake the previous one into memory
+		for (int t = 0; t < tileCount; t++)
+			if (buffer.tileStates[t] == TILE_CLEARED_GRID) MaterializeColorTile(buffer, t);
+	}
+	buffer.gridStep = step;
+	buffer.gridColor = color;
+
+	for (int t = 0; t < tileCount; t++) {
+		if (buffer.tileStates[t] == TILE_CLEARED) {
+			buffer.tileStates[t] = TILE_CLEARED_GRID;
+		} else if (buffer.tileStates[t] == TILE_DIRTY) {
+			DISPATCH_PIXEL_FORMAT(buffer.format, DrawGridDots, buffer, t, step, color);
+		}
+	}
+}
+
+//Dirty tiles are converted per pixel, cleared tiles are filled with the presented clear value
+template<PixelFormat F>
+static void Resolve(const ColorBuffer &buffer, uint8_t *dst, int dstPitch, float exposure, float whitePoint) {
+	using Traits = PixelTraits<F>;
+	using Presented = typename Traits::Presented;
+	Presented clear = Traits::Present(Traits::Encode(buffer.clearColor), exposure, whitePoint);
+	Presented grid = Traits::Present(Traits::Encode(buffer.gridColor), exposure, whitePoint);
+
+	for (int t = 0; t < buffer.tilesWide * buffer.tilesHigh; t++) {
+		TileRect r = GetTileRect(t, buffer.tilesWide, buffer.width, buffer.height);
+		uint8_t state = buffer.tileStates[t];
+
+		for (int y = r.y0; y < r.y1; y++) {
+			Presented *row = reinterpret_cast<Presented*>(dst + (size_t)y * dstPitch);
+			if (state == TILE_DIRTY) {
+				const typename Traits::Storage *src = PixelsAs<F>(buffer) + y * buffer.width;
+				for (int x = r.x0; x < r.x1; x++) row[x] = Traits::Present(src[x], exposure, whitePoint);
+				continue;
+			}
+			std::fill(row + r.x0, row + r.x1, clear);
+			if (state == TILE_CLEARED_GRID and y % buffer.gridStep == 0)
+				for (int x = AlignUp(r.x0, buffer.gridStep); x < r.x1; x += buffer.gridStep) row[x] = grid;
+		}
+	}
+}
+
+//Writes the buffer into a presentable image: RGB565 stays RGB565, everything else becomes RGBA8.
+//HDR formats are tone mapped on the way.
+void ResolveColorBuffer(const ColorBuffer &buffer, void *dst, int dstPitch, float exposure, float whitePoint) {
+	DISPATCH_PIXEL_FORMAT(buffer.format, Resolve, buffer, static_cast<uint8_t*>(dst), dstPitch, exposure, whitePoint);
+}
+
+//////////////////////////////////////////////////
+/// Depth
+//////////////////////////////////////////////////
+int BytesPerDepthSample(DepthFormat format) {
+	switch (format) {
+	case DEPTH_F32: return sizeof(DepthTraits<DEPTH_F32>::Storage);
+	case DEPTH_UNORM16: return sizeof(DepthTraits<DEPTH_UNORM16>::Storage);
+	case DEPTH_UNORM24_S8: return sizeof(DepthTraits<DEPTH_UNORM24_S8>::Storage);
+	}
+	return 0;
+}
+
+DepthBuffer CreateDepthBuffer(DepthFormat format, int width, int height, int samples, float scale) {
+	int tilesWide = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesHigh = (height + TILE_SIZE - 1) / TILE_SIZE;
+	DepthBuffer buffer = {
+		.format = format,
+		.width = width,
+		.height = height,
+		.samples = samples,
+		.scale = scale,
+		.data = new uint8_t[(size_t)width * height * samples * BytesPerDepthSample(format)],
+		.tilesWide = tilesWide,
+		.tilesHigh = tilesHigh,
+		.tileStates = new uint8_t[tilesWide * tilesHigh],
+	};
+	FastClearDepthBuffer(buffer);
+	return buffer;
+}
+
+void DestroyDepthBuffer(DepthBuffer &buffer) {
+	delete[] static_cast<uint8_t*>(buffer.data);
+	delete[] buffer.tileStates;
+	buffer.data = nullptr;
+	buffer.tileStates = nullptr;
+}
+
+void FastClearDepthBuffer(DepthBuffer &buffer) {
+	std::fill_n(buffer.tileStates, buffer.tilesWide * buffer.tilesHigh, (uint8_t)TILE_CLEARED);
+}
+
+template<DepthFormat F>
+static void MaterializeDepth(DepthBuffer &buffer, int tileIndex) {
+	TileRect r = GetTileRect(tileIndex, buffer.tilesWide, buffer.width, buffer.height);
+	for (int y = r.y0; y < r.y1; y++) {
+		typename DepthTraits<F>::Storage *row = DepthAs<F>(buffer) + (size_t)y * buffer.width * buffer.samples;
+		std::fill(row + r.x0 * buffer.samples, row + r.x1 * buffer.samples, DepthTraits<F>::CLEAR);
+	}
+}
+
+void MaterializeDepthTile(DepthBuffer &buffer, int tileIndex) {
+	if (buffer.tileStates[tileIndex] == TILE_DIRTY) return;
+	DISPATCH_DEPTH_FORMAT(buffer.format, MaterializeDepth, buffer, tileIndex);
+	buffer.tileStates[tileIndex] = TILE_DIRTY;
+}
+
+void MaterializeDepthRect(DepthBuffer &buffer, int xMin, int yMin, int xMax, int yMax) {
+	if (xMin >= xMax or yMin >= yMax) return;
+	for (int ty = yMin / TILE_SIZE; ty <= (yMax - 1) / TILE_SIZE; ty++)
+		for (int tx = xMin / TILE_SIZE; tx <= (xMax - 1) / TILE_SIZE; tx++)
+			MaterializeDepthTile(buffer, ty * buffer.tilesWide + tx);
+}
+
+//////////////////////////////////////////////////
+/// Multisampling
+//////////////////////////////////////////////////
+//Standard D3D sample patterns (1/16 pixel grid), rotated so no two samples share a row or column
+static const SampleOffset SAMPLES_1X[1] = {{0, 0}};
+static const SampleOffset SAMPLES_2X[2] = {{4/16.0f, 4/16.0f}, {-4/16.0f, -4/16.0f}};
+static const SampleOffset SAMPLES_4X[4] = {
+	{-2/16.0f, -6/16.0f}, {6/16.0f, -2/16.0f}, {-6/16.0f, 2/16.0f}, {2/16.0f, 6/16.0f}
+};
+static const SampleOffset SAMPLES_8X[8] = {
+	{1/16.0f, -3/16.0f}, {-1/16.0f, 3/16.0f}, {5/16.0f, 1/16.0f}, {-3/16.0f, -5/16.0f},
+	{-5/16.0f, 5/16.0f}, {-7/16.0f, -1/16.0f}, {3/16.0f, 7/16.0f}, {7/16.0f, -7/16.0f}
+};
+
+const SampleOffset* GetSamplePositions(int sampleCount) {
+	switch (sampleCount) {
+	case 2: return SAMPLES_2X;
+	case 4: return SAMPLES_4X;
+	case 8: return SAMPLES_8X;
+	default: return SAMPLES_1X;
+	}
+}
+
+MultisampleBuffer CreateMultisampleBuffer(int sampleCount, int width, int height) {
+	MultisampleBuffer buffer = {
+		.sampleCount = sampleCount,
+		.width = width,
+		.height = height,
+		.pixelSlots = new uint32_t[(size_t)width * height],
+		.bands = std::vector<SampleSlots>((height + TILE_SIZE - 1) / TILE_SIZE),
+	};
+	std::fill_n(buffer.pixelSlots, (size_t)width * height, NO_SAMPLE_SLOT);
+	return buffer;
+}
+
+void DestroyMultisampleBuffer(MultisampleBuffer &buffer) {
+	delete[] buffer.pixelSlots;
+	buffer.pixelSlots = nullptr;
+	buffer.bands.clear();
+}
+
+//O(expanded pixels), only the pixels that own a slot are touched
+void ResetMultisampleBuffer(MultisampleBuffer &buffer) {
+	for (SampleSlots &band : buffer.bands) {
+		for (int owner : band.owners) buffer.pixelSlots[owner] = NO_SAMPLE_SLOT;
+		band.samples.clear();
+		band.owners.clear();
+	}
+}
+
+//Writes color to the samples in mask. The pixel's tile must be materialized.
+void StoreSamples(MultisampleBuffer &buffer, ColorBuffer &colorBuffer, int index, uint32_t mask, uint32_t color) {
+	StoreSamples(buffer, colorBuffer, index, mask, PixelTraits<PIXEL_RGBA8>::Decode(color));
+}
+
+//Unclamped. Samples hold exactly what the color buffer would, so an expanded pixel resolves to the
+//same value as a compressed one, and HDR targets keep values above 1.
+void StoreSamples(MultisampleBuffer &buffer, ColorBuffer &colorBuffer, int index, uint32_t mask, const Float4 &color) {
+	const uint32_t fullMask = (1u << buffer.sampleCount) - 1;
+	uint32_t &slot = buffer.pixelSlots[index];
+
+	//Fully covered, (re)compress into the color buffer
+	if (mask == fullMask) {
+		slot = NO_SAMPLE_SLOT;
+		StoreColor(colorBuffer, index, color);
+		return;
+	}
+
+	//Expand: every sample starts as the pixel's current color
+	SampleSlots &band = buffer.bands[(index / buffer.width) / TILE_SIZE];
+	if (slot == NO_SAMPLE_SLOT) {
+		slot = (uint32_t)band.owners.size();
+		band.owners.push_back(index);
+		band.samples.insert(band.samples.end(), buffer.sampleCount, LoadColor(colorBuffer, index));
+	}
+
+	Float4 value = QuantizeColor(colorBuffer.format, color);
+	Float4 *samples = band.samples.data() + (size_t)slot * buffer.sampleCount;
+	for (int s = 0; s < buffer.sampleCount; s++) {
+		if (mask & (1u << s)) samples[s] = value;
+	}
+}
+
+//Box filter of every expanded pixel into the color buffer. Compressed pixels are already resolved.
+//Bands write disjoint rows, so they resolve in parallel.
+void ResolveMultisampleBuffer(MultisampleBuffer &buffer, ColorBuffer &colorBuffer) {
+	float weight = 1.0f / buffer.sampleCount;
+	ParallelFor(0, (int)buffer.bands.size(), 1, [&](int first, int last) {
+		for (int b = first; b < last; b++) {
+			const SampleSlots &band = buffer.bands[b];
+			for (uint32_t slot = 0; slot < band.owners.size(); slot++) {
+				int owner = band.owners[slot];
+				if (buffer.pixelSlots[owner] != slot) continue;
+
+				const Float4 *samples = band.samples.data() + (size_t)slot * buffer.sampleCount;
+				Float4 sum = {0, 0, 0, 0};
+				for (int s = 0; s < buffer.sampleCount; s++) {
+					sum.r += samples[s].r; sum.g += samples[s].g; sum.b += samples[s].b; sum.a += samples[s].a;
+				}
+				StoreColorHDR(colorBuffer, owner, sum.r * weight, sum.g * weight, sum.b * weight, sum.a * weight);
+			}
+		}
+	});
+}
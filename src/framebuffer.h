@@ -0,0 +1,328 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+//Storage format of a color buffer, chosen when the buffer is created.
+//Colors enter the pipeline as RGBA8 (0xAABBGGRR) or as linear floats for HDR targets.
+enum PixelFormat {
+	PIXEL_RGB565,  //16 bit, no alpha. Half the bandwidth of RGBA8 for previews
+	PIXEL_RGBA8,
+	PIXEL_RGBA16F, //Half float HDR accumulation, tone mapped on resolve
+	PIXEL_RGBA32F
+};
+
+//Buffers are split into square tiles that carry fast clear metadata. A clear only
+//flags every tile as cleared; a tile's memory is filled with the clear value the first
+//time something writes to it (Materialize*) and cleared tiles are synthesized on resolve.
+const int TILE_SIZE = 64;
+
+enum TileState : uint8_t {
+	TILE_CLEARED,
+	TILE_CLEARED_GRID, //Cleared with the buffer's grid pattern drawn on top
+	TILE_DIRTY         //Memory holds the real contents
+};
+
+struct ColorBuffer {
+	PixelFormat format;
+	int width;
+	int height;
+	void *pixels;
+	int tilesWide;
+	int tilesHigh;
+	uint8_t *tileStates;
+	uint32_t clearColor;
+	int gridStep; //0 when no grid pattern is pending
+	uint32_t gridColor;
+};
+
+//Storage format of the depth buffer. All formats store 1/w so larger values are closer
+//(reversed-Z: precision is spent near the camera) and clear to 0.
+enum DepthFormat {
+	DEPTH_F32,        //Raw 1/w
+	DEPTH_UNORM16,    //1/w normalized by the depth scale, 16 bits
+	DEPTH_UNORM24_S8  //Normalized 1/w in the high 24 bits, stencil in the low 8
+};
+
+struct DepthBuffer {
+	DepthFormat format;
+	int width;
+	int height;
+	int samples; //Per pixel, stored consecutively: sample s of pixel p is at p * samples + s
+	float scale; //Maps the largest possible 1/w (closest point after clipping) to 1.0 for unorm formats
+	void *data;
+	int tilesWide;
+	int tilesHigh;
+	uint8_t *tileStates;
+};
+
+//MSAA color storage. Coverage and depth are per sample, shading is per pixel, so most pixels
+//end up with every sample the same color; those stay compressed in the color buffer itself.
+//Only pixels crossed by an edge get a slot of per sample colors, allocated from per band pools that
+//are reset every frame. Resolve averages the slots back into the color buffer.
+const uint32_t NO_SAMPLE_SLOT = UINT32_MAX;
+const int MAX_SAMPLES = 8;
+
+struct SampleOffset {
+	float x, y; //From the pixel center, in pixels
+};
+
+struct Float4;
+//Expanded pixels of one band of TILE_SIZE rows. Every band allocates on its own, so the banded
+//rasterizers can expand pixels in different bands at the same time.
+struct SampleSlots {
+	std::vector<Float4> samples; //sampleCount colors per slot
+	std::vector<int> owners; //Pixel index per slot, a slot is stale if its owner no longer points to it
+};
+
+struct MultisampleBuffer {
+	int sampleCount; //1 disables MSAA
+	int width;
+	int height;
+	uint32_t *pixelSlots; //Per pixel, NO_SAMPLE_SLOT while compressed, else a slot of the pixel's band
+	std::vector<SampleSlots> bands;
+};
+
+ColorBuffer CreateColorBuffer(PixelFormat format, int width, int height);
+void DestroyColorBuffer(ColorBuffer &buffer);
+void FastClearColorBuffer(ColorBuffer &buffer, uint32_t color);
+void DrawGridPattern(ColorBuffer &buffer, int step, uint32_t color);
+void MaterializeColorTile(ColorBuffer &buffer, int tileIndex);
+void MaterializeColorRect(ColorBuffer &buffer, int xMin, int yMin, int xMax, int yMax);
+void ResolveColorBuffer(const ColorBuffer &buffer, void *dst, int dstPitch, float exposure, float whitePoint);
+void FillColorSpan(ColorBuffer &buffer, int y, int xMin, int xMax, uint32_t color);
+int BytesPerPixel(PixelFormat format);
+
+DepthBuffer CreateDepthBuffer(DepthFormat format, int width, int height, int samples, float scale);
+void DestroyDepthBuffer(DepthBuffer &buffer);
+void FastClearDepthBuffer(DepthBuffer &buffer);
+void MaterializeDepthTile(DepthBuffer &buffer, int tileIndex);
+void MaterializeDepthRect(DepthBuffer &buffer, int xMin, int yMin, int xMax, int yMax);
+int BytesPerDepthSample(DepthFormat format);
+
+MultisampleBuffer CreateMultisampleBuffer(int sampleCount, int width, int height);
+void DestroyMultisampleBuffer(MultisampleBuffer &buffer);
+void ResetMultisampleBuffer(MultisampleBuffer &buffer);
+void StoreSamples(MultisampleBuffer &buffer, ColorBuffer &colorBuffer, int index, uint32_t mask, uint32_t color);
+void StoreSamples(MultisampleBuffer &buffer, ColorBuffer &colorBuffer, int index, uint32_t mask, const Float4 &color);
+void ResolveMultisampleBuffer(MultisampleBuffer &buffer, ColorBuffer &colorBuffer);
+const SampleOffset* GetSamplePositions(int sampleCount);
+
+//Must be called before writing a single pixel that isn't covered by a Materialize*Rect call
+inline void MaterializeColorPixel(ColorBuffer &buffer, int x, int y) {
+	int tileIndex = (y / TILE_SIZE) * buffer.tilesWide + (x / TILE_SIZE);
+	if (buffer.tileStates[tileIndex] != TILE_DIRTY) MaterializeColorTile(buffer, tileIndex);
+}
+
+//////////////////////////////////////////////////
+/// Per format encode/decode
+//////////////////////////////////////////////////
+inline uint16_t FloatToHalf(float f) {
+	uint32_t x; memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((x >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = x & 0x7FFFFF;
+	if (exponent <= 0) return (uint16_t)sign; //Denormals flush to zero
+	if (exponent >= 31) return (uint16_t)(sign | 0x7C00); //Overflow to infinity
+	//Rounding may carry into the exponent, which is the correct result
+	return (uint16_t)(sign | ((exponent << 10) + ((mantissa + 0x1000) >> 13)));
+}
+
+inline float HalfToFloat(uint16_t h) {
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1F;
+	uint32_t mantissa = h & 0x3FF;
+	uint32_t x;
+	if (exponent == 0) x = sign;
+	else if (exponent == 31) x = sign | 0x7F800000 | (mantissa << 13);
+	else x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	float f; memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+inline float ClampUnit(float v) { return v < 0 ? 0 : (v > 1 ? 1 : v); }
+
+//Extended Reinhard, maps whitePoint to 1.0
+inline float ToneMap(float c, float exposure, float whitePoint) {
+	c *= exposure;
+	return c * (1.0f + c / (whitePoint * whitePoint)) / (1.0f + c);
+}
+
+struct Half4 { uint16_t r, g, b, a; };
+struct Float4 { float r, g, b, a; };
+
+//Storage: in-memory pixel. Presented: what the pixel resolves to for display.
+template<PixelFormat F> struct PixelTraits;
+
+template<> struct PixelTraits<PIXEL_RGB565> {
+	using Storage = uint16_t;
+	using Presented = uint16_t;
+	static Storage Encode(uint32_t c) {
+		return (Storage)(((c & 0xF8) << 8) | ((c >> 5) & 0x7E0) | ((c >> 19) & 0x1F));
+	}
+	static Presented Present(Storage s, float, float) { return s; }
+	static Storage EncodeHDR(float r, float g, float b, float) {
+		return (Storage)(((int)(ClampUnit(r) * 31 + 0.5f) << 11) | ((int)(ClampUnit(g) * 63 + 0.5f) << 5) | (int)(ClampUnit(b) * 31 + 0.5f));
+	}
+	static Float4 Decode(Storage s) {
+		return {((s >> 11) & 31) / 31.0f, ((s >> 5) & 63) / 63.0f, (s & 31) / 31.0f, 1.0f};
+	}
+};
+
+template<> struct PixelTraits<PIXEL_RGBA8> {
+	using Storage = uint32_t;
+	using Presented = uint32_t;
+	static Storage Encode(uint32_t c) { return c; }
+	static Presented Present(Storage s, float, float) { return s; }
+	static Storage EncodeHDR(float r, float g, float b, float a) {
+		return (uint32_t)(ClampUnit(r) * 255 + 0.5f) | (uint32_t)(ClampUnit(g) * 255 + 0.5f) << 8 |
+			(uint32_t)(ClampUnit(b) * 255 + 0.5f) << 16 | (uint32_t)(ClampUnit(a) * 255 + 0.5f) << 24;
+	}
+	static Float4 Decode(Storage s) {
+		return {(s & 0xFF) / 255.0f, ((s >> 8) & 0xFF) / 255.0f, ((s >> 16) & 0xFF) / 255.0f, (s >> 24) / 255.0f};
+	}
+};
+
+template<> struct PixelTraits<PIXEL_RGBA16F> {
+	using Storage = Half4;
+	using Presented = uint32_t;
+	static Storage Encode(uint32_t c) {
+		Float4 f = PixelTraits<PIXEL_RGBA8>::Decode(c);
+		return EncodeHDR(f.r, f.g, f.b, f.a);
+	}
+	static Storage EncodeHDR(float r, float g, float b, float a) {
+		return {FloatToHalf(r), FloatToHalf(g), FloatToHalf(b), FloatToHalf(a)};
+	}
+	static Float4 Decode(Storage s) {
+		return {HalfToFloat(s.r), HalfToFloat(s.g), HalfToFloat(s.b), HalfToFloat(s.a)};
+	}
+	static Presented Present(Storage s, float exposure, float whitePoint) {
+		Float4 c = Decode(s);
+		return PixelTraits<PIXEL_RGBA8>::EncodeHDR(ToneMap(c.r, exposure, whitePoint), ToneMap(c.g, exposure, whitePoint), ToneMap(c.b, exposure, whitePoint), 1.0f);
+	}
+};
+
+template<> struct PixelTraits<PIXEL_RGBA32F> {
+	using Storage = Float4;
+	using Presented = uint32_t;
+	static Storage Encode(uint32_t c) { return PixelTraits<PIXEL_RGBA8>::Decode(c); }
+	static Storage EncodeHDR(float r, float g, float b, float a) { return {r, g, b, a}; }
+	static Float4 Decode(Storage s) { return s; }
+	static Presented Present(Storage s, float exposure, float whitePoint) {
+		return PixelTraits<PIXEL_RGBA8>::EncodeHDR(ToneMap(s.r, exposure, whitePoint), ToneMap(s.g, exposure, whitePoint), ToneMap(s.b, exposure, whitePoint), 1.0f);
+	}
+};
+
+template<PixelFormat F>
+inline typename PixelTraits<F>::Storage* PixelsAs(const ColorBuffer &buffer) {
+	return static_cast<typename PixelTraits<F>::Storage*>(buffer.pixels);
+}
+
+//Single pixel stores, the format switch is uniform for a whole frame so it predicts perfectly
+inline void StoreColor(ColorBuffer &buffer, int index, uint32_t color) {
+	switch (buffer.format) {
+	case PIXEL_RGB565: PixelsAs<PIXEL_RGB565>(buffer)[index] = PixelTraits<PIXEL_RGB565>::Encode(color); break;
+	case PIXEL_RGBA8: PixelsAs<PIXEL_RGBA8>(buffer)[index] = color; break;
+	case PIXEL_RGBA16F: PixelsAs<PIXEL_RGBA16F>(buffer)[index] = PixelTraits<PIXEL_RGBA16F>::Encode(color); break;
+	case PIXEL_RGBA32F: PixelsAs<PIXEL_RGBA32F>(buffer)[index] = PixelTraits<PIXEL_RGBA32F>::Encode(color); break;
+	}
+}
+
+inline void StoreColorHDR(ColorBuffer &buffer, int index, float r, float g, float b, float a) {
+	switch (buffer.format) {
+	case PIXEL_RGB565: PixelsAs<PIXEL_RGB565>(buffer)[index] = PixelTraits<PIXEL_RGB565>::EncodeHDR(r, g, b, a); break;
+	case PIXEL_RGBA8: PixelsAs<PIXEL_RGBA8>(buffer)[index] = PixelTraits<PIXEL_RGBA8>::EncodeHDR(r, g, b, a); break;
+	case PIXEL_RGBA16F: PixelsAs<PIXEL_RGBA16F>(buffer)[index] = PixelTraits<PIXEL_RGBA16F>::EncodeHDR(r, g, b, a); break;
+	case PIXEL_RGBA32F: PixelsAs<PIXEL_RGBA32F>(buffer)[index] = PixelTraits<PIXEL_RGBA32F>::EncodeHDR(r, g, b, a); break;
+	}
+}
+
+//Unclamped colors (lit shaders): HDR targets keep values above 1 for the tone mapping resolve
+inline void StoreColor(ColorBuffer &buffer, int index, const Float4 &color) {
+	StoreColorHDR(buffer, index, color.r, color.g, color.b, color.a);
+}
+
+//What a pixel of the given format holds after storing color
+inline Float4 QuantizeColor(PixelFormat format, const Float4 &c) {
+	switch (format) {
+	case PIXEL_RGB565: return PixelTraits<PIXEL_RGB565>::Decode(PixelTraits<PIXEL_RGB565>::EncodeHDR(c.r, c.g, c.b, c.a));
+	case PIXEL_RGBA8: return PixelTraits<PIXEL_RGBA8>::Decode(PixelTraits<PIXEL_RGBA8>::EncodeHDR(c.r, c.g, c.b, c.a));
+	case PIXEL_RGBA16F: return PixelTraits<PIXEL_RGBA16F>::Decode(PixelTraits<PIXEL_RGBA16F>::EncodeHDR(c.r, c.g, c.b, c.a));
+	case PIXEL_RGBA32F: return c;
+	}
+	return c;
+}
+
+inline Float4 LoadColor(const ColorBuffer &buffer, int index) {
+	switch (buffer.format) {
+	case PIXEL_RGB565: return PixelTraits<PIXEL_RGB565>::Decode(PixelsAs<PIXEL_RGB565>(buffer)[index]);
+	case PIXEL_RGBA8: return PixelTraits<PIXEL_RGBA8>::Decode(PixelsAs<PIXEL_RGBA8>(buffer)[index]);
+	case PIXEL_RGBA16F: return PixelTraits<PIXEL_RGBA16F>::Decode(PixelsAs<PIXEL_RGBA16F>(buffer)[index]);
+	case PIXEL_RGBA32F: return PixelsAs<PIXEL_RGBA32F>(buffer)[index];
+	}
+	return {0, 0, 0, 0};
+}
+
+//////////////////////////////////////////////////
+/// Per format depth encode/test
+//////////////////////////////////////////////////
+template<DepthFormat F> struct DepthTraits;
+
+template<> struct DepthTraits<DEPTH_F32> {
+	using Storage = float;
+	static constexpr Storage CLEAR = 0.0f;
+	static Storage Encode(float reciprocalW, float) { return reciprocalW; }
+	static bool Passes(Storage incoming, Storage stored) { return incoming > stored; }
+	static Storage Merge(Storage incoming, Storage) { return incoming; }
+};
+
+template<> struct DepthTraits<DEPTH_UNORM16> {
+	using Storage = uint16_t;
+	static constexpr Storage CLEAR = 0;
+	static Storage Encode(float reciprocalW, float scale) {
+		return (Storage)(ClampUnit(reciprocalW * scale) * 65535.0f + 0.5f);
+	}
+	static bool Passes(Storage incoming, Storage stored) { return incoming > stored; }
+	static Storage Merge(Storage incoming, Storage) { return incoming; }
+};
+
+template<> struct DepthTraits<DEPTH_UNORM24_S8> {
+	using Storage = uint32_t;
+	static constexpr Storage CLEAR = 0;
+	static Storage Encode(float reciprocalW, float scale) {
+		return (Storage)(ClampUnit(reciprocalW * scale) * 16777215.0f + 0.5f) << 8;
+	}
+	static bool Passes(Storage incoming, Storage stored) { return (incoming >> 8) > (stored >> 8); }
+	//Depth writes leave the stencil bits alone
+	static Storage Merge(Storage incoming, Storage stored) { return (incoming & ~0xFFu) | (stored & 0xFFu); }
+};
+
+template<DepthFormat F>
+inline typename DepthTraits<F>::Storage* DepthAs(const DepthBuffer &buffer) {
+	return static_cast<typename DepthTraits<F>::Storage*>(buffer.data);
+}
+
+//Depth test and write in one, returns true if the sample is visible
+template<DepthFormat F>
+inline bool DepthTestAndWrite(DepthBuffer &buffer, int index, float reciprocalW) {
+	typename DepthTraits<F>::Storage incoming = DepthTraits<F>::Encode(reciprocalW, buffer.scale);
+	typename DepthTraits<F>::Storage &stored = DepthAs<F>(buffer)[index];
+	if (!DepthTraits<F>::Passes(incoming, stored)) return false;
+	stored = DepthTraits<F>::Merge(incoming, stored);
+	return true;
+}
+
+//Read only, passes only on exactly the stored depth (shading pass after a depth prepass)
+template<DepthFormat F>
+inline bool DepthEqual(const DepthBuffer &buffer, int index, float reciprocalW) {
+	typename DepthTraits<F>::Storage incoming = DepthTraits<F>::Encode(reciprocalW, buffer.scale);
+	typename DepthTraits<F>::Storage stored = DepthAs<F>(buffer)[index];
+	return !DepthTraits<F>::Passes(incoming, stored) and !DepthTraits<F>::Passes(stored, incoming);
+}
+
+//Read only test, passes on equal depth so overlays drawn on top of the geometry they came from stay visible
+template<DepthFormat F>
+inline bool DepthTest(const DepthBuffer &buffer, int index, float reciprocalW) {
+	typename DepthTraits<F>::Storage incoming = DepthTraits<F>::Encode(reciprocalW, buffer.scale);
+	return !DepthTraits<F>::Passes(DepthAs<F>(buffer)[index], incoming);
+}
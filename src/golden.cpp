@@ -0,0 +1,317 @@
+#include "golden.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include "assets.h"
+#include "camera.h"
+#include "display.h"
+#include "jobs.h"
+#include "lighting.h"
+#include "png.h"
+#include "procedural_assets.h"
+#include "renderer.h"
+
+//The goldens are only valid at this size
+static const int GOLDEN_WIDTH = 640;
+static const int GOLDEN_HEIGHT = 360;
+
+//The knot's inputs, generated under ASSETS_PATH for the run and removed after it, so every scene
+//comes from the repo alone
+static const char *GOLDEN_ASSET_DIR = "golden_inputs/";
+static const char *GOLDEN_OBJ = "golden_inputs/knot.obj";
+static const char *GOLDEN_PNG = "golden_inputs/checker.png";
+
+struct GoldenScene {
+	const char *name;
+	void (*configure)(); //Changes the settings from ResetSceneSettings()
+	bool quads; //Draws the shared edge quad grid instead of the knot
+};
+
+//Every scene starts from the same settings, so the order they run in doesn't matter
+static void ResetSceneSettings() {
+	renderer.renderMode = RenderMode::TEXTURED;
+	renderer.renderWireframe = false;
+	renderer.sampleCount = 1;
+	renderer.antialiasedWireframe = true;
+	renderer.backfaceCulling = true;
+	renderer.rotation = {0, 0, 0};
+	renderer.showcase = false;
+	renderer.shadingPath = SHADING_FORWARD;
+	renderer.lightCount = 8;
+	renderer.lighting = LIGHTING_PHONG;
+	renderer.shadows = true;
+	renderer.depthPrepass = false;
+	renderer.instanceCount = 1;
+	renderer.sortFrontToBack = true;
+	renderer.transparency = TRANSPARENCY_OFF;
+	renderer.opacity = 0.5f;
+	camera.position = {0, 0, 0};
+	camera.yawAngle = 0;
+}
+
+static const GoldenScene scenes[] = {
+	{"knot_front",          [] {}, false},
+	{"knot_turned",         [] { renderer.rotation = {0.6f, 2.1f, 0.0f}; }, false},
+	{"knot_gouraud",        [] { renderer.rotation = {-0.4f, 4.0f, 0.3f}; renderer.lighting = LIGHTING_GOURAUD; }, false},
+	{"knot_unlit_prepass",  [] { renderer.rotation = {0.2f, 1.0f, 0.0f}; renderer.lighting = LIGHTING_NONE; renderer.depthPrepass = true; }, false},
+	{"knot_deferred",       [] { renderer.rotation = {0.3f, 5.0f, 0.0f}; renderer.shadingPath = SHADING_DEFERRED; }, false},
+	{"knot_visibility",     [] { renderer.rotation = {0.3f, 5.0f, 0.0f}; renderer.shadingPath = SHADING_VISIBILITY; }, false},
+	{"knot_oit",            [] { renderer.rotation = {0.5f, 3.0f, 0.0f}; renderer.transparency = TRANSPARENCY_OIT; }, false},
+	{"knot_instances_wire", [] { renderer.rotation = {0.0f, 0.8f, 0.0f}; renderer.instanceCount = 9; renderer.renderWireframe = true; }, false},
+	//The knot reaches through the near plane, every clipped polygon case shows up
+	{"knot_near_clip",      [] { renderer.rotation = {0.4f, 0.7f, 0.0f}; camera.position = {0.2f, 0.1f, 4.1f}; }, false},
+	{"knot_near_clip_yaw",  [] { camera.position = {0.9f, 0.0f, 4.3f}; camera.yawAngle = -0.5f; }, false},
+	//Blended, so a pixel covered twice along a shared edge shows as a brighter seam and a missed one as a dark gap
+	{"quads_shared_edges",  [] { renderer.rotation = {0.0f, 0.0f, 0.35f}; renderer.renderMode = RenderMode::FILLED; renderer.transparency = TRANSPARENCY_BLEND; }, true},
+	{"quads_tilted",        [] { renderer.rotation = {0.9f, 0.4f, 0.1f}; renderer.renderMode = RenderMode::FILLED; renderer.transparency = TRANSPARENCY_BLEND; }, true},
+};
+
+//Square grid of quads in the z = 0 plane facing the camera, two triangles each, every inner edge shared
+static Mesh CreateQuadGrid(int quadsPerSide) {
+	Mesh mesh;
+	float step = 2.0f / quadsPerSide;
+	Vec3f normal = {0, 0, -1};
+	for (int y = 0; y < quadsPerSide; y++) {
+		for (int x = 0; x < quadsPerSide; x++) {
+			float x0 = -1.0f + x * step, x1 = x0 + step;
+			float y0 = -1.0f + y * step, y1 = y0 + step;
+			TexCoord uv00 = {(x0 + 1) / 2, (y0 + 1) / 2}, uv01 = {(x0 + 1) / 2, (y1 + 1) / 2};
+			TexCoord uv10 = {(x1 + 1) / 2, (y0 + 1) / 2}, uv11 = {(x1 + 1) / 2, (y1 + 1) / 2};
+			//Clockwise as seen from the camera
+			mesh.faces.push_back({{x0, y0, 0}, {x0, y1, 0}, {x1, y1, 0}, uv00, uv01, uv11, normal, normal, normal});
+			mesh.faces.push_back({{x0, y0, 0}, {x1, y1, 0}, {x1, y0, 0}, uv00, uv11, uv10, normal, normal, normal});
+		}
+	}
+	BuildMeshClusters(mesh);
+	BuildMeshEdges(mesh);
+	return mesh;
+}
+
+//Writes the knot and its texture, then loads them back through the same loaders the app uses
+static bool CreateKnotInputs(Mesh &mesh, Texture &texture) {
+	std::error_code error;
+	std::filesystem::create_directories(std::string(ASSETS_PATH) + GOLDEN_ASSET_DIR, error);
+	if (error) return false;
+	if (!WriteTorusKnotObj(std::string(ASSETS_PATH) + GOLDEN_OBJ, 256, 16)) return false;
+	if (!WriteCheckerPng(std::string(ASSETS_PATH) + GOLDEN_PNG, 512)) return false;
+	return LoadObjFile(mesh, GOLDEN_OBJ) and LoadPngTexture(texture, GOLDEN_PNG);
+}
+
+static void DestroyKnotInputs(Mesh &mesh, Texture &texture) {
+	UnloadObjFile(mesh);
+	UnloadPngTexture(texture);
+	std::error_code error;
+	std::filesystem::remove_all(std::string(ASSETS_PATH) + GOLDEN_ASSET_DIR, error);
+}
+
+//Lighting is accumulated unclamped: under a bright sun a lit surface drawn to an RGBA32F target
+//must keep values above 1 for the resolve to tone map, through the multisampled path as well.
+//Returns the brightest channel, 0 if nothing was drawn.
+static const int HDR_SAMPLE_COUNTS[] = {1, 4};
+static float RenderHdrQuads(const Mesh &quads, int sampleCount) {
+	ColorBuffer ldrBuffer = display.colorBuffer;
+	display.colorBuffer = CreateColorBuffer(PIXEL_RGBA32F, GOLDEN_WIDTH, GOLDEN_HEIGHT);
+	ResetSceneSettings();
+	renderer.renderMode = RenderMode::FILLED;
+	renderer.rotation = {0.0f, 0.0f, 0.35f};
+	renderer.shadows = false;
+	renderer.sampleCount = sampleCount;
+	DirectionalLight sun = renderer.sun;
+	renderer.sun.intensity = 4.0f;
+	RenderHeadless(&quads, nullptr);
+	renderer.sun = sun;
+
+	//Cleared tiles were never written
+	const ColorBuffer &buffer = display.colorBuffer;
+	float brightest = 0;
+	for (int y = 0; y < buffer.height; y++) {
+		for (int x = 0; x < buffer.width; x++) {
+			if (buffer.tileStates[(y / TILE_SIZE) * buffer.tilesWide + x / TILE_SIZE] != TILE_DIRTY) continue;
+			Float4 c = LoadColor(buffer, y * buffer.width + x);
+			brightest = std::max({brightest, c.r, c.g, c.b});
+		}
+	}
+	DestroyColorBuffer(display.colorBuffer);
+	display.colorBuffer = ldrBuffer;
+	renderer.sampleCount = 1;
+	return brightest;
+}
+
+static void ReadColorBuffer(std::vector<uint8_t> &pixels) {
+	pixels.resize((size_t)display.colorBuffer.width * display.colorBuffer.height * 4);
+	ResolveColorBuffer(display.colorBuffer, pixels.data(), display.colorBuffer.width * 4, display.exposure, display.whitePoint);
+}
+
+//With two frames in flight the next frame's geometry is built by jobs while this one is drawn, which
+//must not change a pixel. Wireframe and shadows are on, so all three geometry jobs run.
+//Returns how many frames differ from drawing them one at a time.
+static const int IN_FLIGHT_FRAMES = 6;
+static int CheckFramesInFlight(const Mesh &knot, const Texture &texture) {
+	auto setup = [](int frame) {
+		ResetSceneSettings();
+		renderer.rotation = {0.3f, 0.5f * frame, 0.0f};
+		renderer.renderWireframe = true;
+	};
+	std::vector<std::vector<uint8_t>> expected(IN_FLIGHT_FRAMES);
+	for (int frame = 0; frame < IN_FLIGHT_FRAMES; frame++) {
+		setup(frame);
+		RenderHeadless(&knot, &texture);
+		ReadColorBuffer(expected[frame]);
+	}
+
+	int differing = 0;
+	std::vector<uint8_t> image;
+	RenderHeadlessInFlight(&knot, &texture, IN_FLIGHT_FRAMES, setup, [&](int frame) {
+		ReadColorBuffer(image);
+		if (image != expected[frame]) differing++;
+	});
+	return differing;
+}
+
+struct ImageDiff {
+	int mismatchedPixels; //Past the tolerance
+	int maxDelta; //Largest per channel difference
+};
+
+//Also fills diffImage with the per pixel difference, scaled up so single steps are visible
+static ImageDiff CompareImages(const std::vector<uint8_t> &actual, const std::vector<uint8_t> &expected, int tolerance, std::vector<uint8_t> &diffImage) {
+	ImageDiff diff = {0, 0};
+	diffImage.assign(actual.size(), 0);
+	for (size_t i = 0; i < actual.size(); i += 4) {
+		int pixelDelta = 0;
+		for (int c = 0; c < 4; c++) pixelDelta = std::max(pixelDelta, std::abs(actual[i + c] - expected[i + c]));
+		diff.maxDelta = std::max(diff.maxDelta, pixelDelta);
+		if (pixelDelta > tolerance) diff.mismatchedPixels++;
+		uint8_t shown = (uint8_t)std::min(pixelDelta * 16, 255);
+		diffImage[i] = shown; diffImage[i + 1] = shown; diffImage[i + 2] = shown; diffImage[i + 3] = 255;
+	}
+	return diff;
+}
+
+bool ParseGoldenOptions(int argc, char* argv[], GoldenOptions &options) {
+	options = {.directory = std::string(ASSETS_PATH) + "goldens/", .update = false, .tolerance = 0, .maxMismatch = 0.0f, .allowMissing = false};
+	bool golden = false;
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--golden") == 0) golden = true;
+		else if (strcmp(argv[i], "--update-goldens") == 0) golden = options.update = true;
+		else if (strcmp(argv[i], "--tolerance") == 0 and hasValue) options.tolerance = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--max-mismatch") == 0 and hasValue) options.maxMismatch = (float)atof(argv[++i]);
+		else if (strcmp(argv[i], "--allow-missing") == 0) options.allowMissing = true;
+		else if (strcmp(argv[i], "--golden-dir") == 0 and hasValue) {
+			options.directory = argv[++i];
+			if (options.directory.back() != '/' and options.directory.back() != '\\') options.directory += '/';
+		}
+	}
+	return golden;
+}
+
+int RunGoldenTests(const GoldenOptions &options) {
+	SetupHeadless(GOLDEN_WIDTH, GOLDEN_HEIGHT);
+
+	Mesh knot, quads = CreateQuadGrid(8);
+	Texture knotTexture = {};
+	bool haveKnot = CreateKnotInputs(knot, knotTexture);
+	if (!haveKnot) std::cout << "Golden: couldn't write and load the knot under " << ASSETS_PATH << GOLDEN_ASSET_DIR << std::endl;
+
+	//No workers (everything inline), one worker, and one per extra core
+	std::vector<int> threadCounts = {0, 1, std::max((int)std::thread::hardware_concurrency() - 1, 2)};
+
+	std::cout << "Golden: " << std::size(scenes) << " scenes at " << GOLDEN_WIDTH << "x" << GOLDEN_HEIGHT
+		<< ", " << (LightingUsesSimd() ? "SSE" : "scalar") << " lighting, tolerance " << options.tolerance
+		<< ", max mismatch " << options.maxMismatch << std::endl;
+
+	if (options.update) std::filesystem::create_directories(options.directory);
+
+	int failures = 0, skipped = 0;
+	std::vector<uint8_t> reference, image, expected, diffImage;
+	for (const GoldenScene &scene : scenes) {
+		if (!scene.quads and !haveKnot) {
+			std::cout << (options.allowMissing ? "SKIP " : "FAIL ") << scene.name << ": no knot" << std::endl;
+			if (options.allowMissing) skipped++;
+			else failures++;
+			continue;
+		}
+		std::string path = options.directory + scene.name + ".png";
+		bool passed = true;
+
+		reference.clear();
+		for (int threads : threadCounts) {
+			if (threads != GetJobWorkerCount()) {
+				StopJobSystem();
+				StartJobSystem(threads);
+			}
+			ResetSceneSettings();
+			scene.configure();
+			RenderHeadless(scene.quads ? &quads : &knot, scene.quads ? nullptr : &knotTexture);
+			ReadColorBuffer(image);
+
+			if (reference.empty()) reference = image;
+			else if (image != reference) {
+				std::cout << "  " << scene.name << ": " << threads << " workers differ from " << threadCounts[0] << std::endl;
+				passed = false;
+			}
+		}
+
+		if (options.update) {
+			if (!WritePng(path.c_str(), reference.data(), GOLDEN_WIDTH, GOLDEN_HEIGHT)) {
+				std::cout << "  " << scene.name << ": couldn't write " << path << std::endl;
+				passed = false;
+			}
+		} else {
+			int width, height;
+			if (!ReadPng(path.c_str(), expected, width, height)) {
+				std::cout << "  " << scene.name << ": no golden at " << path << " (run with --update-goldens)" << std::endl;
+				passed = false;
+			} else if (width != GOLDEN_WIDTH or height != GOLDEN_HEIGHT) {
+				std::cout << "  " << scene.name << ": golden is " << width << "x" << height << std::endl;
+				passed = false;
+			} else {
+				ImageDiff diff = CompareImages(reference, expected, options.tolerance, diffImage);
+				int allowed = (int)(options.maxMismatch * GOLDEN_WIDTH * GOLDEN_HEIGHT);
+				if (diff.mismatchedPixels > allowed) {
+					std::cout << "  " << scene.name << ": " << diff.mismatchedPixels << " pixels past the tolerance, max delta " << diff.maxDelta << std::endl;
+					//Next to the golden, for a look at what changed
+					WritePng((options.directory + scene.name + ".actual.png").c_str(), reference.data(), GOLDEN_WIDTH, GOLDEN_HEIGHT);
+					WritePng((options.directory + scene.name + ".diff.png").c_str(), diffImage.data(), GOLDEN_WIDTH, GOLDEN_HEIGHT);
+					passed = false;
+				}
+			}
+		}
+
+		std::cout << (passed ? "PASS " : "FAIL ") << scene.name << std::endl;
+		if (!passed) failures++;
+	}
+
+	//Not an image comparison, checked once
+	for (int sampleCount : HDR_SAMPLE_COUNTS) {
+		float brightest = RenderHdrQuads(quads, sampleCount);
+		bool passed = brightest > 1.0f;
+		std::cout << (passed ? "PASS " : "FAIL ") << "hdr_accumulation x" << sampleCount << " (brightest channel " << brightest << ")" << std::endl;
+		if (!passed) failures++;
+	}
+
+	//At the last worker count, so the geometry jobs really overlap the drawing
+	if (haveKnot) {
+		int differing = CheckFramesInFlight(knot, knotTexture);
+		std::cout << (differing ? "FAIL " : "PASS ") << "frames_in_flight (" << differing << " of " << IN_FLIGHT_FRAMES << " frames differ)" << std::endl;
+		if (differing) failures++;
+	} else {
+		std::cout << (options.allowMissing ? "SKIP " : "FAIL ") << "frames_in_flight: no knot" << std::endl;
+		if (options.allowMissing) skipped++;
+		else failures++;
+	}
+
+	int checks = (int)(std::size(scenes) + std::size(HDR_SAMPLE_COUNTS)) + 1 - skipped;
+	std::cout << "Golden: " << checks - failures << "/" << checks << " passed"
+		<< (skipped ? ", " + std::to_string(skipped) + " skipped" : "") << (options.update ? ", goldens updated" : "") << std::endl;
+	DestroyKnotInputs(knot, knotTexture);
+	CleanUp();
+	return failures ? 1 : 0;
+}
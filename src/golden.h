@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+
+//Golden image regression run: renders a fixed set of scenes headlessly and compares them against
+//stored PNGs. Every scene is drawn once per worker thread count (none, one, all cores) and those
+//images must match bit for bit, whatever the tolerance. Started with --golden, see ParseGoldenOptions().
+struct GoldenOptions {
+	std::string directory; //Where the goldens live, ASSETS_PATH "goldens/" by default
+	bool update; //Write the current images as the new goldens instead of comparing
+	int tolerance; //Largest per channel difference that still matches, 0 is exact
+	float maxMismatch; //Fraction of pixels allowed past the tolerance
+	bool allowMissing; //A scene whose input couldn't be loaded is skipped rather than failed
+};
+
+//True if the command line asks for a golden run:
+//  --golden [--tolerance N] [--max-mismatch F] [--golden-dir path] [--allow-missing]
+//  --update-goldens [--golden-dir path]
+bool ParseGoldenOptions(int argc, char* argv[], GoldenOptions &options);
+//Returns the process exit code, 0 when every scene matched
+int RunGoldenTests(const GoldenOptions &options);
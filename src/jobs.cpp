@@ -0,0 +1,167 @@
+#include "jobs.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+
+struct Job {
+	std::function<void()> function;
+	JobCounter *counter;
+};
+
+struct JobQueue {
+	std::mutex mutex;
+	std::deque<Job> jobs;
+};
+
+struct JobSystem {
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<JobQueue>> queues; //Queue 0 belongs to every thread outside the pool
+	std::atomic<int> queued = 0;
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp; //Jobs were queued, a counter dropped to zero, or stopping
+	bool stopping;
+};
+static JobSystem jobSystem;
+
+//Empty rounds WaitForJobs() spins before it sleeps, so a wait on a job about to finish skips the wake up
+static const int WAIT_SPINS = 64;
+
+//Index of the calling thread's queue
+static thread_local int queueIndex = 0;
+
+static void PushJob(Job job) {
+	JobQueue &queue = *jobSystem.queues[queueIndex];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+		jobSystem.queued++;
+	}
+	//Taking the lock orders this against a worker that just found nothing and is about to sleep
+	{ std::lock_guard<std::mutex> lock(jobSystem.sleepMutex); }
+	jobSystem.wakeUp.notify_one();
+}
+
+//Own queue from the back, then the other queues from the front, starting with the next one
+static bool FindJob(Job &job) {
+	int queueCount = (int)jobSystem.queues.size();
+	for (int i = 0; i < queueCount; i++) {
+		int index = (queueIndex + i) % queueCount;
+		JobQueue &queue = *jobSystem.queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) continue;
+		if (i == 0) {
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		} else {
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		jobSystem.queued--;
+		return true;
+	}
+	return false;
+}
+
+//The counter is not touched after its lock is released, a waiter may destroy it right away
+static void FinishJob(JobCounter *counter) {
+	if (!counter) return;
+
+	std::vector<std::function<void()>> continuations;
+	{
+		std::lock_guard<std::mutex> lock(counter->mutex);
+		if (--counter->pending > 0) return;
+		continuations.swap(counter->continuations);
+	}
+	//Wakes a WaitForJobs() sleeping on the counter, under the lock so the wake up can't slip in
+	//between its check and its wait
+	{ std::lock_guard<std::mutex> lock(jobSystem.sleepMutex); }
+	jobSystem.wakeUp.notify_all();
+	for (std::function<void()> &continuation : continuations) continuation();
+}
+
+static void ExecuteJob(Job &job) {
+	job.function();
+	FinishJob(job.counter);
+}
+
+static void WorkerMain(int index) {
+	queueIndex = index;
+	while (true) {
+		Job job;
+		if (FindJob(job)) { ExecuteJob(job); continue; }
+
+		std::unique_lock<std::mutex> lock(jobSystem.sleepMutex);
+		jobSystem.wakeUp.wait(lock, [] { return jobSystem.stopping or jobSystem.queued > 0; });
+		if (jobSystem.stopping) return;
+	}
+}
+
+void StartJobSystem(int workerCount) {
+	if (!jobSystem.queues.empty()) return;
+
+	jobSystem.stopping = false;
+	for (int i = 0; i <= workerCount; i++) jobSystem.queues.push_back(std::make_unique<JobQueue>());
+	for (int i = 1; i <= workerCount; i++) jobSystem.workers.emplace_back(WorkerMain, i);
+}
+
+//Expects no jobs in flight
+void StopJobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(jobSystem.sleepMutex);
+		jobSystem.stopping = true;
+	}
+	jobSystem.wakeUp.notify_all();
+	for (std::thread &worker : jobSystem.workers) worker.join();
+	jobSystem.workers.clear();
+	jobSystem.queues.clear();
+}
+
+int GetJobWorkerCount() {
+	return (int)jobSystem.workers.size();
+}
+
+void RunJob(std::function<void()> job, JobCounter *counter) {
+	if (counter) counter->pending++;
+	if (jobSystem.workers.empty()) {
+		job();
+		FinishJob(counter);
+		return;
+	}
+	PushJob({std::move(job), counter});
+}
+
+void RunJobAfter(JobCounter &dependency, std::function<void()> job, JobCounter *counter) {
+	if (counter) counter->pending++;
+	auto submit = [job = std::move(job), counter]() mutable {
+		RunJob(std::move(job), counter);
+		FinishJob(counter); //The count taken above moves over to the RunJob() call
+	};
+	{
+		std::lock_guard<std::mutex> lock(dependency.mutex);
+		if (dependency.pending > 0) {
+			dependency.continuations.push_back(std::move(submit));
+			return;
+		}
+	}
+	submit();
+}
+
+void WaitForJobs(JobCounter &counter) {
+	int spins = 0;
+	while (counter.pending > 0) {
+		Job job;
+		if (FindJob(job)) {
+			ExecuteJob(job);
+			spins = 0;
+		} else if (++spins < WAIT_SPINS) {
+			std::this_thread::yield();
+		} else {
+			//Nothing left to steal, what the counter waits on is running on other threads
+			std::unique_lock<std::mutex> lock(jobSystem.sleepMutex);
+			jobSystem.wakeUp.wait(lock, [&counter] { return counter.pending == 0 or jobSystem.queued > 0; });
+		}
+	}
+	//The last FinishJob() may still hold the lock
+	std::lock_guard<std::mutex> lock(counter.mutex);
+}
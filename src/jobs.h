@@ -0,0 +1,56 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+//Work-stealing job system, the one pool of threads every parallel pass of the renderer runs on.
+//Every thread owns a deque: it pushes and pops its own jobs at the back (newest first, caches stay
+//warm), idle threads steal from the front of another thread's deque (oldest first, usually the
+//biggest piece of work). Waiting on a counter runs other jobs instead of blocking, so jobs can
+//submit jobs and wait for them. Only once there is nothing left to run does a waiter sleep.
+//
+//With zero worker threads every job runs inline the moment it is submitted, in submission order.
+//That is the deterministic single thread mode: same results, no scheduling, easy to debug.
+
+//Completion handle for a group of jobs, and the dependency other jobs can be chained after
+struct JobCounter {
+	std::atomic<int> pending = 0;
+	std::mutex mutex; //Guards continuations
+	std::vector<std::function<void()>> continuations; //Submitted when pending drops to zero
+};
+
+//workerCount threads besides the calling thread, which takes part whenever it waits
+void StartJobSystem(int workerCount);
+void StopJobSystem();
+int GetJobWorkerCount();
+
+//counter may be null (fire and forget). Jobs must not block on anything but WaitForJobs().
+void RunJob(std::function<void()> job, JobCounter *counter = nullptr);
+//Runs job once everything counted by dependency has finished, counter counts it from now on
+void RunJobAfter(JobCounter &dependency, std::function<void()> job, JobCounter *counter = nullptr);
+//Runs queued jobs until the counter drops to zero, sleeps after a short spin while there are none
+void WaitForJobs(JobCounter &counter);
+
+//body(first, last) over [begin, end) in chunks of grain items, returns when all chunks are done.
+//Chunks must be independent; their boundaries depend only on grain, never on the thread count.
+template<class Body>
+void ParallelFor(int begin, int end, int grain, const Body &body) {
+	if (begin >= end) return;
+	grain = std::max(grain, 1);
+	if (GetJobWorkerCount() == 0 or end - begin <= grain) {
+		for (int first = begin; first < end; first += grain) body(first, std::min(first + grain, end));
+		return;
+	}
+
+	//Pushed last chunk first, so this thread pops them in order while thieves take the far end
+	JobCounter counter;
+	int chunkCount = (end - begin + grain - 1) / grain;
+	for (int chunk = chunkCount - 1; chunk >= 0; chunk--) {
+		int first = begin + chunk * grain;
+		int last = std::min(first + grain, end);
+		RunJob([&body, first, last] { body(first, last); }, &counter);
+	}
+	WaitForJobs(counter);
+}
@@ -0,0 +1,138 @@
+#include "jobs_stress.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "jobs.h"
+
+//Nested ParallelFor(): outer chunks, each split again
+static const int STRESS_ITEMS = 4096;
+static const int OUTER_GRAIN = 256;
+static const int INNER_GRAIN = 16;
+//Jobs on one counter, all of which its continuation has to see finished
+static const int FAN_IN = 16;
+//RunJobAfter() links, each after the previous one
+static const int CHAIN_LENGTH = 8;
+//Past WaitForJobs()' spins, so the waiter sleeps and the job has to wake it
+static const std::chrono::microseconds LONG_JOB = std::chrono::microseconds(300);
+
+//Busy, not blocked: jobs may only block in WaitForJobs()
+static void SpinFor(std::chrono::microseconds duration) {
+	auto end = std::chrono::steady_clock::now() + duration;
+	while (std::chrono::steady_clock::now() < end) {}
+}
+
+//One frame's worth of the ways the renderer uses the job system, returns the number of failed checks
+static int RunStressRound(std::vector<int> &hits) {
+	std::fill(hits.begin(), hits.end(), 0);
+	std::atomic<int> errors = 0, fanInFinished = 0, chainStep = 0;
+	JobCounter produced, chain[CHAIN_LENGTH];
+
+	RunJob([&] {
+		ParallelFor(0, STRESS_ITEMS, OUTER_GRAIN, [&](int first, int last) {
+			ParallelFor(first, last, INNER_GRAIN, [&](int innerFirst, int innerLast) {
+				for (int i = innerFirst; i < innerLast; i++) hits[i]++;
+			});
+		});
+	}, &produced);
+	for (int i = 0; i < FAN_IN; i++) RunJob([&, i] { SpinFor(std::chrono::microseconds(i % 4)); fanInFinished++; }, &produced);
+
+	//Reads what the jobs before it wrote, without a lock of its own
+	RunJobAfter(produced, [&] {
+		if (fanInFinished != FAN_IN) errors++;
+		for (int i = 0; i < STRESS_ITEMS; i++) if (hits[i] != 1) errors++;
+		if (chainStep++ != 0) errors++;
+	}, &chain[0]);
+	for (int link = 1; link < CHAIN_LENGTH; link++) {
+		RunJobAfter(chain[link - 1], [&, link] { if (chainStep++ != link) errors++; }, &chain[link]);
+	}
+	WaitForJobs(chain[CHAIN_LENGTH - 1]);
+	if (chainStep != CHAIN_LENGTH) errors++;
+
+	//Already running on a worker when the wait starts, so the waiter finds nothing to steal and sleeps.
+	//Sleeps rather than spins, so even on one core the waiter runs out of spins first.
+	if (GetJobWorkerCount() > 0) {
+		JobCounter sleeper;
+		std::atomic<bool> started = false;
+		RunJob([&started] { started = true; std::this_thread::sleep_for(LONG_JOB); }, &sleeper);
+		while (!started) std::this_thread::yield();
+		WaitForJobs(sleeper);
+	}
+
+	//A dependency that already finished runs the job right away
+	JobCounter late;
+	bool ran = false;
+	RunJobAfter(produced, [&ran] { ran = true; }, &late);
+	WaitForJobs(late);
+	if (!ran) errors++;
+	return errors;
+}
+
+bool ParseJobsStressOptions(int argc, char* argv[], JobsStressOptions &options) {
+	options = {.rounds = 2000, .timeoutSeconds = 30};
+	bool stress = false;
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--jobs-stress") == 0) stress = true;
+		else if (strcmp(argv[i], "--rounds") == 0 and hasValue) options.rounds = std::max(atoi(argv[++i]), 1);
+		else if (strcmp(argv[i], "--timeout") == 0 and hasValue) options.timeoutSeconds = std::max(atoi(argv[++i]), 1);
+	}
+	return stress;
+}
+
+int RunJobsStress(const JobsStressOptions &options) {
+	//No workers (everything inline), one, a few, and one per extra core
+	std::vector<int> workerCounts = {0, 1, 3};
+	int allCores = (int)std::thread::hardware_concurrency() - 1;
+	if (allCores > workerCounts.back()) workerCounts.push_back(allCores);
+
+	std::cout << "Jobs stress: " << options.rounds << " rounds at " << workerCounts.size() << " worker counts" << std::endl;
+
+	//A missed wake up hangs the run instead of failing a check, so a hang is failed from here
+	std::atomic<int> progress = 0;
+	std::atomic<bool> finished = false;
+	std::thread watchdog([&] {
+		int lastProgress = -1;
+		auto lastChange = std::chrono::steady_clock::now();
+		while (!finished) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			auto now = std::chrono::steady_clock::now();
+			if (progress != lastProgress) {
+				lastProgress = progress;
+				lastChange = now;
+			} else if (now - lastChange > std::chrono::seconds(options.timeoutSeconds)) {
+				std::cout << "FAIL jobs stress: no round finished in " << options.timeoutSeconds << " s, hung" << std::endl;
+				std::_Exit(1);
+			}
+		}
+	});
+
+	int failures = 0;
+	std::vector<int> hits(STRESS_ITEMS);
+	for (int workers : workerCounts) {
+		StartJobSystem(workers);
+		auto start = std::chrono::steady_clock::now();
+		int errors = 0;
+		for (int round = 0; round < options.rounds; round++) {
+			errors += RunStressRound(hits);
+			progress++;
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		StopJobSystem();
+
+		std::cout << (errors ? "FAIL " : "PASS ") << workers << " workers (" << (int)ms << " ms";
+		if (errors) std::cout << ", " << errors << " failed checks";
+		std::cout << ")" << std::endl;
+		if (errors) failures++;
+	}
+
+	finished = true;
+	watchdog.join();
+	int runs = (int)workerCounts.size();
+	std::cout << "Jobs stress: " << runs - failures << "/" << runs << " passed" << std::endl;
+	return failures ? 1 : 0;
+}
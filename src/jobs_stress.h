@@ -0,0 +1,17 @@
+#pragma once
+
+//Job system stress run: nested ParallelFor() calls, RunJobAfter() chains and fan-ins, and waits on
+//jobs long enough for the waiter to go to sleep, repeated at several worker counts. Every round
+//checks exact results, so a lost, doubled or early job fails it, and a missed wake up that would
+//hang it is caught by a watchdog. On GCC or Clang, build with -fsanitize=thread to also have data
+//races reported. Started with --jobs-stress, see ParseJobsStressOptions().
+struct JobsStressOptions {
+	int rounds; //Per worker count
+	int timeoutSeconds; //Without any finished round, the run is failed as hung
+};
+
+//True if the command line asks for a stress run:
+//  --jobs-stress [--rounds N] [--timeout seconds]
+bool ParseJobsStressOptions(int argc, char* argv[], JobsStressOptions &options);
+//Returns the process exit code, 0 when every round checked out
+int RunJobsStress(const JobsStressOptions &options);
@@ -0,0 +1,230 @@
+#include "lighting.h"
+#include <algorithm>
+#include <cmath>
+
+//Define LIGHTING_SCALAR to build the plain float kernels, e.g. to check the goldens against them
+#if (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)) && !defined(LIGHTING_SCALAR)
+#include <immintrin.h>
+#define LIGHTING_SSE 1
+#endif
+
+//////////////////////////////////////////////////
+/// Lane types
+//////////////////////////////////////////////////
+//The lighting math is written once as a template over the lane type: float for scalar code,
+//SimdFloat for four lanes at a time.
+static inline float Max(float a, float b) { return a > b ? a : b; }
+static inline float Sqrt(float a) { return std::sqrt(a); }
+static inline float SelectPositive(float condition, float value) { return condition > 0 ? value : 0; }
+
+#ifdef LIGHTING_SSE
+struct SimdFloat {
+	__m128 v;
+	SimdFloat() = default;
+	SimdFloat(__m128 v) : v(v) {}
+	SimdFloat(float f) : v(_mm_set1_ps(f)) {}
+	static SimdFloat Load(const float *p) { return _mm_loadu_ps(p); }
+	void Store(float *p) const { _mm_storeu_ps(p, v); }
+};
+static inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm_add_ps(a.v, b.v); }
+static inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a.v, b.v); }
+static inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a.v, b.v); }
+static inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm_div_ps(a.v, b.v); }
+static inline SimdFloat Max(SimdFloat a, SimdFloat b) { return _mm_max_ps(a.v, b.v); }
+static inline SimdFloat Sqrt(SimdFloat a) { return _mm_sqrt_ps(a.v); }
+static inline SimdFloat SelectPositive(SimdFloat condition, SimdFloat value) {
+	return _mm_and_ps(_mm_cmpgt_ps(condition.v, _mm_setzero_ps()), value.v);
+}
+static inline float HorizontalSum(SimdFloat a) {
+	__m128 shuffled = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(a.v, shuffled);
+	shuffled = _mm_movehl_ps(shuffled, sums);
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+#endif
+
+template<class T>
+struct LaneVec3 {
+	T x, y, z;
+};
+
+template<class T>
+static inline T Dot(const LaneVec3<T> &a, const LaneVec3<T> &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+//Schlick's cheap stand-in for pow(t, n), no transcendental so it vectorizes
+template<class T>
+static inline T SpecularPower(T t, T shininess) { return t / (shininess - shininess * t + t); }
+
+//Lambert + Blinn-Phong for one light. toLight is unnormalized, falloff already applied to radiance.
+template<class T>
+static inline void AccumulateLight(
+	const LaneVec3<T> &normal, const LaneVec3<T> &toEye, LaneVec3<T> toLight, const LaneVec3<T> &radiance,
+	T specular, T shininess, LaneVec3<T> &diffuseOut, LaneVec3<T> &specularOut
+) {
+	T invLength = T(1.0f) / Sqrt(Dot(toLight, toLight) + T(1e-12f));
+	toLight = {toLight.x * invLength, toLight.y * invLength, toLight.z * invLength};
+	T lambert = Max(Dot(normal, toLight), T(0.0f));
+
+	LaneVec3<T> halfway = {toLight.x + toEye.x, toLight.y + toEye.y, toLight.z + toEye.z};
+	T invHalfwayLength = T(1.0f) / Sqrt(Dot(halfway, halfway) + T(1e-12f));
+	T cosHalfway = Max(Dot(normal, halfway) * invHalfwayLength, T(0.0f));
+	T highlight = SelectPositive(lambert, specular * SpecularPower(cosHalfway, shininess));
+
+	diffuseOut = {diffuseOut.x + radiance.x * lambert, diffuseOut.y + radiance.y * lambert, diffuseOut.z + radiance.z * lambert};
+	specularOut = {specularOut.x + radiance.x * highlight, specularOut.y + radiance.y * highlight, specularOut.z + radiance.z * highlight};
+}
+
+//Smooth (1 - d/r)^2 falloff, zero past the radius so no branch is needed
+template<class T>
+static inline T Falloff(const LaneVec3<T> &toLight, T invRadius) {
+	T f = Max(T(1.0f) - Sqrt(Dot(toLight, toLight)) * invRadius, T(0.0f));
+	return f * f;
+}
+
+//////////////////////////////////////////////////
+/// Setup
+//////////////////////////////////////////////////
+static void ResizePointLights(LightingEnvironment &env, int count) {
+	env.pointCount = count;
+	int padded = (count + LIGHT_BATCH - 1) / LIGHT_BATCH * LIGHT_BATCH;
+	//Padding lights sit far behind the camera with a unit radius, so their falloff is always zero
+	env.x.assign(padded, 0); env.y.assign(padded, 0); env.z.assign(padded, -1e6f);
+	env.r.assign(padded, 0); env.g.assign(padded, 0); env.b.assign(padded, 0);
+	env.radius.assign(padded, 1.0f);
+}
+
+void SetupLightingEnvironment(LightingEnvironment &env, const DirectionalLight &cameraSpaceSun, const std::vector<PointLight> &cameraSpaceLights, const Vec3f &ambient, float specular, float shininess) {
+	env.ambient = ambient;
+	env.sunDirection = Vec3f(cameraSpaceSun.direction).Normalized();
+	env.sunRadiance = Vec3f(cameraSpaceSun.color) * cameraSpaceSun.intensity;
+	env.specular = specular;
+	env.shininess = shininess;
+
+	ResizePointLights(env, (int)cameraSpaceLights.size());
+	for (int i = 0; i < env.pointCount; i++) {
+		const PointLight &light = cameraSpaceLights[i];
+		env.x[i] = light.position.x; env.y[i] = light.position.y; env.z[i] = light.position.z;
+		env.r[i] = light.color.x * light.intensity;
+		env.g[i] = light.color.y * light.intensity;
+		env.b[i] = light.color.z * light.intensity;
+		env.radius[i] = light.radius;
+	}
+}
+
+void SelectPointLights(const LightingEnvironment &env, const int *lights, int count, LightingEnvironment &subset) {
+	subset.ambient = env.ambient;
+	subset.sunDirection = env.sunDirection;
+	subset.sunRadiance = env.sunRadiance;
+	subset.specular = env.specular;
+	subset.shininess = env.shininess;
+	ResizePointLights(subset, count);
+	for (int i = 0; i < count; i++) {
+		int light = lights[i];
+		subset.x[i] = env.x[light]; subset.y[i] = env.y[light]; subset.z[i] = env.z[light];
+		subset.r[i] = env.r[light]; subset.g[i] = env.g[light]; subset.b[i] = env.b[light];
+		subset.radius[i] = env.radius[light];
+	}
+}
+
+//////////////////////////////////////////////////
+/// Kernels
+//////////////////////////////////////////////////
+LightSample ShadePoint(const LightingEnvironment &env, const Vec3f &position, const Vec3f &normal, float sunVisibility) {
+	LaneVec3<float> n = {normal.x, normal.y, normal.z};
+	float invEyeDistance = 1.0f / std::sqrt(position.x * position.x + position.y * position.y + position.z * position.z + 1e-12f);
+	LaneVec3<float> toEye = {-position.x * invEyeDistance, -position.y * invEyeDistance, -position.z * invEyeDistance};
+
+	LaneVec3<float> diffuse = {env.ambient.x, env.ambient.y, env.ambient.z};
+	LaneVec3<float> specular = {0, 0, 0};
+	LaneVec3<float> sunRadiance = {env.sunRadiance.x * sunVisibility, env.sunRadiance.y * sunVisibility, env.sunRadiance.z * sunVisibility};
+	AccumulateLight<float>(n, toEye, {env.sunDirection.x, env.sunDirection.y, env.sunDirection.z}, sunRadiance, env.specular, env.shininess, diffuse, specular);
+
+	int i = 0;
+#ifdef LIGHTING_SSE
+	//Four lights per iteration
+	LaneVec3<SimdFloat> nLanes = {n.x, n.y, n.z};
+	LaneVec3<SimdFloat> eyeLanes = {toEye.x, toEye.y, toEye.z};
+	LaneVec3<SimdFloat> diffuseLanes = {0.0f, 0.0f, 0.0f};
+	LaneVec3<SimdFloat> specularLanes = {0.0f, 0.0f, 0.0f};
+	for (; i + LIGHT_BATCH <= (int)env.x.size(); i += LIGHT_BATCH) {
+		LaneVec3<SimdFloat> toLight = {
+			SimdFloat::Load(&env.x[i]) - position.x,
+			SimdFloat::Load(&env.y[i]) - position.y,
+			SimdFloat::Load(&env.z[i]) - position.z
+		};
+		SimdFloat falloff = Falloff(toLight, SimdFloat(1.0f) / SimdFloat::Load(&env.radius[i]));
+		LaneVec3<SimdFloat> radiance = {
+			SimdFloat::Load(&env.r[i]) * falloff,
+			SimdFloat::Load(&env.g[i]) * falloff,
+			SimdFloat::Load(&env.b[i]) * falloff
+		};
+		AccumulateLight<SimdFloat>(nLanes, eyeLanes, toLight, radiance, env.specular, env.shininess, diffuseLanes, specularLanes);
+	}
+	diffuse = {diffuse.x + HorizontalSum(diffuseLanes.x), diffuse.y + HorizontalSum(diffuseLanes.y), diffuse.z + HorizontalSum(diffuseLanes.z)};
+	specular = {specular.x + HorizontalSum(specularLanes.x), specular.y + HorizontalSum(specularLanes.y), specular.z + HorizontalSum(specularLanes.z)};
+#endif
+	for (; i < env.pointCount; i++) {
+		LaneVec3<float> toLight = {env.x[i] - position.x, env.y[i] - position.y, env.z[i] - position.z};
+		float falloff = Falloff(toLight, 1.0f / env.radius[i]);
+		LaneVec3<float> radiance = {env.r[i] * falloff, env.g[i] * falloff, env.b[i] * falloff};
+		AccumulateLight<float>(n, toEye, toLight, radiance, env.specular, env.shininess, diffuse, specular);
+	}
+
+	return {Vec3f(diffuse.x, diffuse.y, diffuse.z), Vec3f(specular.x, specular.y, specular.z)};
+}
+
+//One lane per surface point, every light is broadcast across the lanes
+template<class T>
+static inline void ShadeLanes(const LightingEnvironment &env, const LaneVec3<T> &position, const LaneVec3<T> &normal, T sunVisibility, LaneVec3<T> &diffuse, LaneVec3<T> &specular) {
+	T invEyeDistance = T(1.0f) / Sqrt(Dot(position, position) + T(1e-12f));
+	LaneVec3<T> toEye = {T(0.0f) - position.x * invEyeDistance, T(0.0f) - position.y * invEyeDistance, T(0.0f) - position.z * invEyeDistance};
+
+	diffuse = {T(env.ambient.x), T(env.ambient.y), T(env.ambient.z)};
+	specular = {T(0.0f), T(0.0f), T(0.0f)};
+	LaneVec3<T> sunDirection = {T(env.sunDirection.x), T(env.sunDirection.y), T(env.sunDirection.z)};
+	LaneVec3<T> sunRadiance = {T(env.sunRadiance.x) * sunVisibility, T(env.sunRadiance.y) * sunVisibility, T(env.sunRadiance.z) * sunVisibility};
+	AccumulateLight<T>(normal, toEye, sunDirection, sunRadiance, T(env.specular), T(env.shininess), diffuse, specular);
+
+	for (int i = 0; i < env.pointCount; i++) {
+		LaneVec3<T> toLight = {T(env.x[i]) - position.x, T(env.y[i]) - position.y, T(env.z[i]) - position.z};
+		T falloff = Falloff(toLight, T(1.0f / env.radius[i]));
+		LaneVec3<T> radiance = {T(env.r[i]) * falloff, T(env.g[i]) * falloff, T(env.b[i]) * falloff};
+		AccumulateLight<T>(normal, toEye, toLight, radiance, T(env.specular), T(env.shininess), diffuse, specular);
+	}
+}
+
+void ShadePoints(
+	const LightingEnvironment &env, int count,
+	const float *px, const float *py, const float *pz,
+	const float *nx, const float *ny, const float *nz,
+	float *diffuseR, float *diffuseG, float *diffuseB,
+	float *specularR, float *specularG, float *specularB,
+	const float *sunVisibility
+) {
+	int i = 0;
+#ifdef LIGHTING_SSE
+	for (; i + LIGHT_BATCH <= count; i += LIGHT_BATCH) {
+		LaneVec3<SimdFloat> position = {SimdFloat::Load(px + i), SimdFloat::Load(py + i), SimdFloat::Load(pz + i)};
+		LaneVec3<SimdFloat> normal = {SimdFloat::Load(nx + i), SimdFloat::Load(ny + i), SimdFloat::Load(nz + i)};
+		LaneVec3<SimdFloat> diffuse, specular;
+		SimdFloat visibility = sunVisibility ? SimdFloat::Load(sunVisibility + i) : SimdFloat(1.0f);
+		ShadeLanes(env, position, normal, visibility, diffuse, specular);
+		diffuse.x.Store(diffuseR + i); diffuse.y.Store(diffuseG + i); diffuse.z.Store(diffuseB + i);
+		specular.x.Store(specularR + i); specular.y.Store(specularG + i); specular.z.Store(specularB + i);
+	}
+#endif
+	for (; i < count; i++) {
+		LaneVec3<float> diffuse, specular;
+		ShadeLanes<float>(env, {px[i], py[i], pz[i]}, {nx[i], ny[i], nz[i]}, sunVisibility ? sunVisibility[i] : 1.0f, diffuse, specular);
+		diffuseR[i] = diffuse.x; diffuseG[i] = diffuse.y; diffuseB[i] = diffuse.z;
+		specularR[i] = specular.x; specularG[i] = specular.y; specularB[i] = specular.z;
+	}
+}
+
+bool LightingUsesSimd() {
+#ifdef LIGHTING_SSE
+	return true;
+#else
+	return false;
+#endif
+}
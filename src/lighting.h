@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include "linear_algebra.h"
+
+//Lambert + Blinn-Phong for every shading path, one directional light plus point lights.
+//Everything is in camera space (the eye sits at the origin).
+//
+//Two SIMD kernels share the same math: ShadePoint() evaluates one surface point against four
+//lights at a time (per pixel lighting), ShadePoints() evaluates four surface points at a time
+//against every light (per vertex lighting over a whole frame's triangles).
+
+struct DirectionalLight {
+	Vec3f direction; //Towards the light
+	Vec3f color;
+	float intensity;
+};
+
+struct PointLight {
+	Vec3f position; //World space in renderer.lights, camera space in a frame's lights
+	Vec3f color;
+	float intensity;
+	float radius; //No contribution past this distance
+};
+
+const int LIGHT_BATCH = 4;
+
+struct LightingEnvironment {
+	Vec3f ambient;
+	Vec3f sunDirection;
+	Vec3f sunRadiance; //Color * intensity
+	float specular;
+	float shininess;
+	//Point lights as structure of arrays, padded to a multiple of LIGHT_BATCH with black,
+	//unit radius lights far behind the camera, whose falloff is always zero
+	int pointCount;
+	std::vector<float> x, y, z;
+	std::vector<float> r, g, b; //Color * intensity
+	std::vector<float> radius;
+};
+
+//Light arriving at a surface point, split so the albedo only scales the diffuse part
+struct LightSample {
+	Vec3f diffuse; //Includes ambient
+	Vec3f specular;
+};
+
+//RGBA8 albedo as the kernels' 0..1 RGB
+inline Vec3f UnpackAlbedo(uint32_t color) {
+	return Vec3f(color & 0xFF, (color >> 8) & 0xFF, (color >> 16) & 0xFF) / 255.0f;
+}
+
+void SetupLightingEnvironment(LightingEnvironment &env, const DirectionalLight &cameraSpaceSun, const std::vector<PointLight> &cameraSpaceLights, const Vec3f &ambient, float specular, float shininess);
+
+//Copy of env with only the listed point lights (indices below env.pointCount), for a region the
+//others don't reach. subset keeps its capacity between calls.
+void SelectPointLights(const LightingEnvironment &env, const int *lights, int count, LightingEnvironment &subset);
+
+//normal must be unit length, sunVisibility scales the sun only (shadowing)
+LightSample ShadePoint(const LightingEnvironment &env, const Vec3f &position, const Vec3f &normal, float sunVisibility = 1.0f);
+
+//Structure of arrays in, structure of arrays out. Normals must be unit length, sunVisibility may be null (fully lit).
+void ShadePoints(
+	const LightingEnvironment &env, int count,
+	const float *px, const float *py, const float *pz,
+	const float *nx, const float *ny, const float *nz,
+	float *diffuseR, float *diffuseG, float *diffuseB,
+	float *specularR, float *specularG, float *specularB,
+	const float *sunVisibility = nullptr
+);
+
+//False when the kernels were built without SSE (or with LIGHTING_SCALAR)
+bool LightingUsesSimd();
@@ -32,10 +32,24 @@
  */
 //////////////////////////////////////////////////
 #include "renderer.h"
+#include "bench.h"
+#include "frame_bench.h"
+#include "golden.h"
+#include "jobs_stress.h"
 
 bool isRunning = false;
 
 int main(int arc, char* argv[]) {
+	//Headless runs, no window
+	GoldenOptions goldenOptions;
+	if (ParseGoldenOptions(arc, argv, goldenOptions)) return RunGoldenTests(goldenOptions);
+	BenchOptions benchOptions;
+	if (ParseBenchOptions(arc, argv, benchOptions)) return RunBenchmarks(benchOptions);
+	FrameBenchOptions frameBenchOptions;
+	if (ParseFrameBenchOptions(arc, argv, frameBenchOptions)) return RunFrameBenchmark(frameBenchOptions);
+	JobsStressOptions jobsStressOptions;
+	if (ParseJobsStressOptions(arc, argv, jobsStressOptions)) return RunJobsStress(jobsStressOptions);
+
 	isRunning = InitWindow();
 
 	Setup();
@@ -1,25 +1,42 @@
 #include <cstdint>
+#include <cstring>
+#include <unordered_map>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <stdio.h>
 #include <string>
 #include "model.h"
 #include "linear_algebra.h"
+#include "sort.h"
 
-Model model;
+Model model = {
+	.mesh = INVALID_HANDLE,
+	.texture = INVALID_HANDLE,
+};
 
-void LoadObjFile(Mesh &mesh, const char* filename){
+//OBJ indices start at 1, negative ones count back from the last element read. -1 if out of range.
+static int ResolveObjIndex(int index, size_t count) {
+	int resolved = index > 0 ? index - 1 : (int)count + index;
+	return resolved >= 0 and resolved < (int)count ? resolved : -1;
+}
+
+bool LoadObjFile(Mesh &mesh, const char* filename){
 	std::string fullPath = std::string(ASSETS_PATH) + filename;
 	std::ifstream file(fullPath);
 	if(file.fail()) {
 		std::cout << "Couldn't open obj file: " << filename << std::endl;
-		return;
+		return false;
 	}
 
 	std::vector<Vec3f> vertices;
 	std::vector<TexCoord> texCoords;
+	std::vector<Vec3f> normals;
+	bool missingNormals = false;
+	int skippedFaces = 0;
 
 	char lineBuff[1024];
 	while (file.getline(lineBuff, sizeof(lineBuff))){
@@ -37,56 +54,267 @@ void LoadObjFile(Mesh &mesh, const char* filename){
 			texCoords.push_back(t);
 		}
 
-		//Face line
+		//Vertex normal line
+		if (strncmp(lineBuff, "vn ", 3) == 0) {
+			Vec3f n;
+			sscanf_s(lineBuff, "vn %f %f %f", &n.x, &n.y, &n.z);
+			normals.push_back(n.Normalized());
+		}
+
+		//Face line: v/vt/vn, v/vt, v//vn or v. Missing UVs are zero, missing normals are generated after loading.
 		if (strncmp(lineBuff, "f ", 2) == 0) {
-			int vertexIndices[3];
-			int textureIndices[3];
-			int _; //Normals are unused (for now(?))
+			int vertexIndices[3] = {};
+			int textureIndices[3] = {};
+			int normalIndices[3] = {};
+			bool hasUVs, hasNormals;
+
+			if (sscanf_s(lineBuff, "f %d/%d/%d %d/%d/%d %d/%d/%d",
+				&vertexIndices[0], &textureIndices[0], &normalIndices[0],
+				&vertexIndices[1], &textureIndices[1], &normalIndices[1],
+				&vertexIndices[2], &textureIndices[2], &normalIndices[2]) == 9) {
+				hasUVs = hasNormals = true;
+			} else if (sscanf_s(lineBuff, "f %d/%d %d/%d %d/%d",
+				&vertexIndices[0], &textureIndices[0],
+				&vertexIndices[1], &textureIndices[1],
+				&vertexIndices[2], &textureIndices[2]) == 6) {
+				hasUVs = true;
+				hasNormals = false;
+			} else if (sscanf_s(lineBuff, "f %d//%d %d//%d %d//%d",
+				&vertexIndices[0], &normalIndices[0],
+				&vertexIndices[1], &normalIndices[1],
+				&vertexIndices[2], &normalIndices[2]) == 6) {
+				hasUVs = false;
+				hasNormals = true;
+			} else if (sscanf_s(lineBuff, "f %d %d %d", &vertexIndices[0], &vertexIndices[1], &vertexIndices[2]) == 3) {
+				hasUVs = hasNormals = false;
+			} else {
+				skippedFaces++;
+				continue;
+			}
 
-			sscanf_s(
-                lineBuff, "f %d/%d/%d %d/%d/%d %d/%d/%d",
-				&vertexIndices[0], &textureIndices[0], &_,
-				&vertexIndices[1], &textureIndices[1], &_,
-				&vertexIndices[2], &textureIndices[2], &_
-			);
+			//Every index must point at an element read so far, else the face is dropped
+			bool valid = true;
+			for (int i = 0; i < 3; i++) {
+				vertexIndices[i] = ResolveObjIndex(vertexIndices[i], vertices.size());
+				if (hasUVs) textureIndices[i] = ResolveObjIndex(textureIndices[i], texCoords.size());
+				if (hasNormals) normalIndices[i] = ResolveObjIndex(normalIndices[i], normals.size());
+				valid = valid and vertexIndices[i] >= 0 and (!hasUVs or textureIndices[i] >= 0) and (!hasNormals or normalIndices[i] >= 0);
+			}
+			if (!valid) {
+				skippedFaces++;
+				continue;
+			}
+			if (!hasNormals) missingNormals = true;
 
 			Face f = {
-				.a = vertices[vertexIndices[0] - 1],
-				.b = vertices[vertexIndices[1] - 1],
-				.c = vertices[vertexIndices[2] - 1],
-				.aUV = texCoords[textureIndices[0] - 1],
-				.bUV = texCoords[textureIndices[1] - 1],
-				.cUV = texCoords[textureIndices[2] - 1]
+				.a = vertices[vertexIndices[0]],
+				.b = vertices[vertexIndices[1]],
+				.c = vertices[vertexIndices[2]],
+				.aUV = {},
+				.bUV = {},
+				.cUV = {},
+				.aNormal = {},
+				.bNormal = {},
+				.cNormal = {}
 			};
+			if (hasUVs) {
+				f.aUV = texCoords[textureIndices[0]];
+				f.bUV = texCoords[textureIndices[1]];
+				f.cUV = texCoords[textureIndices[2]];
+			}
+			if (hasNormals) {
+				f.aNormal = normals[normalIndices[0]];
+				f.bNormal = normals[normalIndices[1]];
+				f.cNormal = normals[normalIndices[2]];
+			}
 			mesh.faces.push_back(f);
 		}
 	}
+	if (skippedFaces) std::cout << "Skipped " << skippedFaces << " malformed faces in obj file: " << filename << std::endl;
+	BuildMeshClusters(mesh);
+	BuildMeshEdges(mesh);
+	//Faces that came with normals keep them
+	if (missingNormals) GenerateSmoothNormals(mesh, true);
+	return true;
 }
 
 void UnloadObjFile(Mesh &mesh) {
 	mesh.faces.clear();
+	mesh.clusters.clear();
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	mesh.edges.clear();
+}
+
+//Reorders the faces along a Morton curve through their centroids, then cuts them into clusters of
+//MESH_CLUSTER_SIZE consecutive faces. Must run before BuildMeshEdges() since it changes face indices.
+void BuildMeshClusters(Mesh &mesh) {
+	mesh.clusters.clear();
+	if (mesh.faces.empty()) return;
+
+	Vec3f boundsMin = Vec3f(1e30f);
+	Vec3f boundsMax = Vec3f(-1e30f);
+	for (const Face &face : mesh.faces) {
+		for (Vec3f p : {face.a, face.b, face.c}) {
+			boundsMin = {std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z)};
+			boundsMax = {std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z)};
+		}
+	}
+	Vec3f extent = boundsMax - boundsMin;
+	float scale = 1023.0f / std::max({extent.x, extent.y, extent.z, 1e-6f});
+
+	//10 bits per axis, interleaved
+	auto spreadBits = [](uint32_t v) {
+		v = (v | (v << 16)) & 0x030000FF;
+		v = (v | (v << 8)) & 0x0300F00F;
+		v = (v | (v << 4)) & 0x030C30C3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	};
+	std::vector<uint32_t> keys(mesh.faces.size());
+	std::vector<uint32_t> order(mesh.faces.size());
+	for (size_t i = 0; i < mesh.faces.size(); i++) {
+		const Face &face = mesh.faces[i];
+		Vec3f centroid = (Vec3f(face.a) + face.b + face.c) / 3.0f;
+		Vec3f q = (centroid - boundsMin) * scale;
+		keys[i] = spreadBits((uint32_t)q.x) | (spreadBits((uint32_t)q.y) << 1) | (spreadBits((uint32_t)q.z) << 2);
+		order[i] = (uint32_t)i;
+	}
+	RadixSort(keys, order);
+
+	std::vector<Face> sortedFaces(mesh.faces.size());
+	for (size_t i = 0; i < order.size(); i++) sortedFaces[i] = mesh.faces[order[i]];
+	mesh.faces.swap(sortedFaces);
+
+	for (int first = 0; first < (int)mesh.faces.size(); first += MESH_CLUSTER_SIZE) {
+		MeshCluster cluster = {first, std::min(MESH_CLUSTER_SIZE, (int)mesh.faces.size() - first), {}, 0};
+		Vec3f clusterMin = Vec3f(1e30f);
+		Vec3f clusterMax = Vec3f(-1e30f);
+		for (int f = first; f < first + cluster.faceCount; f++) {
+			const Face &face = mesh.faces[f];
+			for (Vec3f p : {face.a, face.b, face.c}) {
+				clusterMin = {std::min(clusterMin.x, p.x), std::min(clusterMin.y, p.y), std::min(clusterMin.z, p.z)};
+				clusterMax = {std::max(clusterMax.x, p.x), std::max(clusterMax.y, p.y), std::max(clusterMax.z, p.z)};
+			}
+		}
+		cluster.center = (clusterMin + clusterMax) * 0.5f;
+		for (int f = first; f < first + cluster.faceCount; f++) {
+			const Face &face = mesh.faces[f];
+			for (Vec3f p : {face.a, face.b, face.c}) cluster.radius = std::max(cluster.radius, (p - cluster.center).Norm());
+		}
+		mesh.clusters.push_back(cluster);
+	}
+}
+
+//Faces store positions rather than indices, so vertices are welded back together by their exact position.
+//Fills mesh.vertices, mesh.indices (three per face) and mesh.edges.
+//Seams (same position, different UV) end up as one vertex, which is what the wireframe wants.
+void BuildMeshEdges(Mesh &mesh) {
+	struct PositionKey {
+		uint32_t bits[3];
+		bool operator==(const PositionKey &other) const { return memcmp(bits, other.bits, sizeof(bits)) == 0; }
+	};
+	struct PositionHash {
+		size_t operator()(const PositionKey &key) const {
+			return ((size_t)key.bits[0] * 73856093u) ^ ((size_t)key.bits[1] * 19349663u) ^ ((size_t)key.bits[2] * 83492791u);
+		}
+	};
+
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	mesh.edges.clear();
+
+	std::unordered_map<PositionKey, int, PositionHash> vertexLookup;
+	std::unordered_map<uint64_t, int> edgeLookup;
+	vertexLookup.reserve(mesh.faces.size() * 3 / 2);
+	edgeLookup.reserve(mesh.faces.size() * 3 / 2);
+
+	for (int faceIndex = 0; faceIndex < (int)mesh.faces.size(); faceIndex++) {
+		const Face &face = mesh.faces[faceIndex];
+		const Vec3f positions[3] = {face.a, face.b, face.c};
+		int indices[3];
+
+		for (int i = 0; i < 3; i++) {
+			PositionKey key;
+			memcpy(key.bits, &positions[i], sizeof(key.bits));
+			auto [it, inserted] = vertexLookup.try_emplace(key, (int)mesh.vertices.size());
+			if (inserted) mesh.vertices.push_back(positions[i]);
+			indices[i] = it->second;
+			mesh.indices.push_back(indices[i]);
+		}
+
+		for (int i = 0; i < 3; i++) {
+			int a = std::min(indices[i], indices[(i + 1) % 3]);
+			int b = std::max(indices[i], indices[(i + 1) % 3]);
+			if (a == b) continue; //Degenerate face
+
+			uint64_t key = ((uint64_t)a << 32) | (uint32_t)b;
+			auto [it, inserted] = edgeLookup.try_emplace(key, (int)mesh.edges.size());
+			if (inserted) mesh.edges.push_back({{a, b}, {faceIndex, -1}});
+			else if (mesh.edges[it->second].faces[1] < 0) mesh.edges[it->second].faces[1] = faceIndex;
+		}
+	}
 }
 
-void LoadPngTexture(Model &model, const char* filename) {
-	stbi_set_flip_vertically_on_load(1);
+bool LoadPngTexture(Texture &texture, const char* filename) {
+	//Per thread flag, textures may be decoded on the asset loader threads
+	stbi_set_flip_vertically_on_load_thread(1);
 
 	std::string fullPath = std::string(ASSETS_PATH) + filename;
 	int w,h,n;
 	unsigned char* data = stbi_load(fullPath.c_str(), &w, &h, &n, STBI_rgb_alpha);
 	if (!data) {
 		std::cout << "Couldn't load png file: " << filename << ", " << stbi_failure_reason() << std::endl;
+		return false;
 	}
 
-	model.textureWidth = w;
-	model.textureHeight = h;
-	model.meshTexture = (uint32_t*)data;
+	texture.width = w;
+	texture.height = h;
+	texture.format = TEXTURE_RGBA8;
+	texture.pixels = (uint32_t*)data;
+	texture.blocks = nullptr;
+	return true;
 }
 
-void UnloadPngTexture(Model &model) {
-	if (model.meshTexture) {
-		stbi_image_free((void*) model.meshTexture);
-		model.meshTexture = nullptr;
-		model.textureWidth = 0;
-		model.textureHeight = 0;
+void UnloadPngTexture(Texture &texture) {
+	if (texture.pixels) {
+		stbi_image_free((void*) texture.pixels);
+		texture.pixels = nullptr;
+	}
+	FreeTextureBlocks(texture);
+	texture.width = 0;
+	texture.height = 0;
+}
+
+//Angle weighted average of the face normals around every welded vertex. Needs BuildMeshEdges() first.
+//onlyMissing writes just the faces whose three normals are zero, the others still shape the average.
+void GenerateSmoothNormals(Mesh &mesh, bool onlyMissing) {
+	std::vector<Vec3f> vertexNormals(mesh.vertices.size(), Vec3f(0));
+
+	for (size_t faceIndex = 0; faceIndex < mesh.faces.size(); faceIndex++) {
+		Face &face = mesh.faces[faceIndex];
+		Vec3f corners[3] = {face.a, face.b, face.c};
+		Vec3f faceNormal = Vec3Cross(corners[1] - corners[0], corners[2] - corners[0]);
+		if (faceNormal.Norm() == 0) continue;
+		faceNormal.Normalize();
+
+		for (int i = 0; i < 3; i++) {
+			Vec3f toNext = (corners[(i + 1) % 3] - corners[i]).Normalized();
+			Vec3f toPrev = (corners[(i + 2) % 3] - corners[i]).Normalized();
+			float angle = std::acos(std::clamp(Vec3Dot(toNext, toPrev), -1.0f, 1.0f));
+			Vec3f &sum = vertexNormals[mesh.indices[faceIndex * 3 + i]];
+			sum = sum + faceNormal * angle;
+		}
+	}
+
+	for (size_t faceIndex = 0; faceIndex < mesh.faces.size(); faceIndex++) {
+		Face &face = mesh.faces[faceIndex];
+		Vec3f *faceNormals[3] = {&face.aNormal, &face.bNormal, &face.cNormal};
+		bool missing = face.aNormal.Norm() == 0 and face.bNormal.Norm() == 0 and face.cNormal.Norm() == 0;
+		if (onlyMissing and !missing) continue;
+		for (int i = 0; i < 3; i++) {
+			Vec3f n = vertexNormals[mesh.indices[faceIndex * 3 + i]];
+			*faceNormals[i] = n.Norm() > 0 ? n.Normalized() : Vec3f(0, 1, 0);
+		}
 	}
 }
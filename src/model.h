@@ -1,5 +1,7 @@
 #pragma once
 #include "linear_algebra.h"
+#include "texture.h"
+#include <cstdint>
 #include <vector>
 
 //UV coords of point in a texture
@@ -11,28 +13,66 @@ struct TexCoord {
 struct Face {
 	Vec3f a,b,c; //Model coords for the point of the triangle
 	TexCoord aUV, bUV, cUV; //UV indices for the point of that face
+	Vec3f aNormal, bNormal, cNormal; //Model space vertex normals
 };
 
 //Raster space triangle
 struct Triangle {
 	Vec4f points[3];
 	TexCoord texCoords[3];
+	Vec3f normal; //Camera space face normal
+	Vec3f normals[3]; //Camera space vertex normals, not renormalized after clipping
+	Vec3f diffuse[3]; //Per vertex lighting, only filled for Gouraud shading
+	Vec3f specular[3];
+	uint32_t instance; //Index into renderer.instances
+};
+
+//Raster space line segment
+struct Line {
+	Vec4f points[2];
+};
+
+//Unique mesh edge with its (up to two) adjacent faces, -1 where there is none
+struct MeshEdge {
+	int vertices[2];
+	int faces[2];
+};
+
+//Run of spatially close faces, the unit of front-to-back sorting
+const int MESH_CLUSTER_SIZE = 64;
+struct MeshCluster {
+	int firstFace;
+	int faceCount;
+	Vec3f center; //Model space bounding sphere
+	float radius;
 };
 
 struct Mesh {
 	std::vector<Face> faces;
+	std::vector<MeshCluster> clusters;
+	//Deduplicated positions, the welded vertex of every face corner and the unique edges,
+	//built once at load (wireframe pass, normal generation)
+	std::vector<Vec3f> vertices;
+	std::vector<int> indices;
+	std::vector<MeshEdge> edges;
 };
 
+//Handles into the asset manager (see assets.h)
+typedef int MeshHandle;
+typedef int TextureHandle;
+const int INVALID_HANDLE = -1;
+
 struct Model {
-	Mesh mesh;
-	int textureWidth;
-	int textureHeight;
-	uint32_t *meshTexture;
+	MeshHandle mesh;
+	TextureHandle texture;
 };
 extern Model model;
 
-void LoadObjFile(Mesh &mesh, const char* filename);
+bool LoadObjFile(Mesh &mesh, const char* filename);
 void UnloadObjFile(Mesh &mesh);
+void BuildMeshClusters(Mesh &mesh);
+void BuildMeshEdges(Mesh &mesh);
+void GenerateSmoothNormals(Mesh &mesh, bool onlyMissing = false);
 
-void LoadPngTexture(Model &model, const char* filename);
-void UnloadPngTexture(Model &model);
+bool LoadPngTexture(Texture &texture, const char* filename);
+void UnloadPngTexture(Texture &texture);
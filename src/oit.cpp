@@ -0,0 +1,114 @@
+#include "oit.h"
+#include <algorithm>
+#include <vector>
+#include "jobs.h"
+
+OitBuffer CreateOitBuffer(int width, int height) {
+	int tilesWide = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesHigh = (height + TILE_SIZE - 1) / TILE_SIZE;
+	size_t pixelCount = (size_t)width * height;
+	uint32_t capacity = (uint32_t)std::min(pixelCount * OIT_FRAGMENTS_PER_PIXEL, (size_t)OIT_END - 1);
+	OitBuffer buffer = {
+		.width = width,
+		.height = height,
+		.heads = new uint32_t[pixelCount],
+		.fragments = new OitFragment[capacity],
+		.capacity = capacity,
+		.used = 0,
+		.dropped = 0,
+		.tilesWide = tilesWide,
+		.tilesHigh = tilesHigh,
+		.tileStates = new uint8_t[tilesWide * tilesHigh],
+	};
+	ClearOitBuffer(buffer);
+	return buffer;
+}
+
+void DestroyOitBuffer(OitBuffer &buffer) {
+	delete[] buffer.heads;
+	delete[] buffer.fragments;
+	delete[] buffer.tileStates;
+	buffer.heads = nullptr;
+	buffer.fragments = nullptr;
+	buffer.tileStates = nullptr;
+	buffer.capacity = 0;
+}
+
+//The arena is reset by rewinding, the heads lazily per tile
+void ClearOitBuffer(OitBuffer &buffer) {
+	buffer.used = 0;
+	buffer.dropped = 0;
+	std::fill_n(buffer.tileStates, buffer.tilesWide * buffer.tilesHigh, (uint8_t)TILE_CLEARED);
+}
+
+void MaterializeOitRect(OitBuffer &buffer, int xMin, int yMin, int xMax, int yMax) {
+	if (xMin >= xMax or yMin >= yMax) return;
+	for (int ty = yMin / TILE_SIZE; ty <= (yMax - 1) / TILE_SIZE; ty++) {
+		for (int tx = xMin / TILE_SIZE; tx <= (xMax - 1) / TILE_SIZE; tx++) {
+			uint8_t &state = buffer.tileStates[ty * buffer.tilesWide + tx];
+			if (state == TILE_DIRTY) continue;
+
+			int x0 = tx * TILE_SIZE; int x1 = std::min(x0 + TILE_SIZE, buffer.width);
+			int y0 = ty * TILE_SIZE; int y1 = std::min(y0 + TILE_SIZE, buffer.height);
+			for (int y = y0; y < y1; y++) std::fill(buffer.heads + y * buffer.width + x0, buffer.heads + y * buffer.width + x1, OIT_END);
+			state = TILE_DIRTY;
+		}
+	}
+}
+
+static void ResolveOitTile(const OitBuffer &buffer, ColorBuffer &colorBuffer, int tile) {
+	int x0 = (tile % buffer.tilesWide) * TILE_SIZE; int x1 = std::min(x0 + TILE_SIZE, buffer.width);
+	int y0 = (tile / buffer.tilesWide) * TILE_SIZE; int y1 = std::min(y0 + TILE_SIZE, buffer.height);
+	MaterializeColorRect(colorBuffer, x0, y0, x1, y1);
+
+	OitFragment layers[OIT_MAX_LAYERS];
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			int index = y * buffer.width + x;
+			uint32_t node = buffer.heads[index];
+			if (node == OIT_END) continue;
+
+			//Gather, replacing the farthest layer once the pixel is over the limit
+			int count = 0;
+			for (; node != OIT_END; node = buffer.fragments[node].next) {
+				const OitFragment &fragment = buffer.fragments[node];
+				if (count < OIT_MAX_LAYERS) {
+					layers[count++] = fragment;
+					continue;
+				}
+				int farthest = 0;
+				for (int i = 1; i < count; i++) if (layers[i].reciprocalW < layers[farthest].reciprocalW) farthest = i;
+				if (fragment.reciprocalW > layers[farthest].reciprocalW) layers[farthest] = fragment;
+			}
+
+			//Back to front (ascending 1/w), short lists so insertion sort
+			for (int i = 1; i < count; i++) {
+				OitFragment key = layers[i];
+				int j = i - 1;
+				for (; j >= 0 and layers[j].reciprocalW > key.reciprocalW; j--) layers[j + 1] = layers[j];
+				layers[j + 1] = key;
+			}
+
+			Float4 c = LoadColor(colorBuffer, index);
+			for (int i = 0; i < count; i++) {
+				uint32_t src = layers[i].color;
+				float a = (src >> 24) / 255.0f;
+				c.r += ((src & 0xFF) / 255.0f - c.r) * a;
+				c.g += (((src >> 8) & 0xFF) / 255.0f - c.g) * a;
+				c.b += (((src >> 16) & 0xFF) / 255.0f - c.b) * a;
+			}
+			StoreColorHDR(colorBuffer, index, c.r, c.g, c.b, 1.0f);
+		}
+	}
+}
+
+void ResolveOitBuffer(const OitBuffer &buffer, ColorBuffer &colorBuffer) {
+	if (buffer.used == 0) return;
+
+	//Only tiles that received fragments have work
+	ParallelFor(0, buffer.tilesWide * buffer.tilesHigh, 1, [&](int first, int last) {
+		for (int tile = first; tile < last; tile++) {
+			if (buffer.tileStates[tile] == TILE_DIRTY) ResolveOitTile(buffer, colorBuffer, tile);
+		}
+	});
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "framebuffer.h"
+
+//Order independent transparency: while drawing, transparent fragments are appended to per pixel
+//linked lists living in one pre-allocated arena. A resolve pass then sorts every pixel's list by
+//depth and blends it back to front over the opaque result, so triangles never need sorting.
+const uint32_t OIT_END = UINT32_MAX;
+const int OIT_MAX_LAYERS = 16;           //Blended per pixel, deeper lists keep their nearest layers
+const int OIT_FRAGMENTS_PER_PIXEL = 2;   //Average arena budget
+
+struct OitFragment {
+	uint32_t color; //RGBA8, straight alpha
+	float reciprocalW;
+	uint32_t next;  //Older fragment of the same pixel or OIT_END
+};
+
+struct OitBuffer {
+	int width;
+	int height;
+	uint32_t *heads; //Newest fragment per pixel
+	OitFragment *fragments;
+	uint32_t capacity;
+	uint32_t used; //Fragments appended, counts the dropped ones too so it can pass capacity
+	uint32_t dropped; //Fragments that didn't fit in the arena this frame
+	int tilesWide;
+	int tilesHigh;
+	uint8_t *tileStates; //Heads of TILE_CLEARED tiles are stale, they are reset on first write
+};
+
+OitBuffer CreateOitBuffer(int width, int height);
+void DestroyOitBuffer(OitBuffer &buffer);
+void ClearOitBuffer(OitBuffer &buffer);
+void MaterializeOitRect(OitBuffer &buffer, int xMin, int yMin, int xMax, int yMax);
+
+//Blends every pixel's fragments over the color buffer. Tiles are independent and resolved in parallel.
+void ResolveOitBuffer(const OitBuffer &buffer, ColorBuffer &colorBuffer);
+
+//Safe from several raster bands at once: the arena slot is taken atomically, and a pixel's list is
+//only ever touched by the band owning that pixel, so every list keeps its submission order
+inline void AppendOitFragment(OitBuffer &buffer, int index, uint32_t color, float reciprocalW) {
+	uint32_t slot = std::atomic_ref<uint32_t>(buffer.used).fetch_add(1, std::memory_order_relaxed);
+	if (slot >= buffer.capacity) {
+		std::atomic_ref<uint32_t>(buffer.dropped).fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	buffer.fragments[slot] = {color, reciprocalW, buffer.heads[index]};
+	buffer.heads[index] = slot;
+}
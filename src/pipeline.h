@@ -0,0 +1,555 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "display.h"
+#include "framebuffer.h"
+#include "jobs.h"
+#include "linear_algebra.h"
+#include "model.h"
+#include "profiler.h"
+#include "raster.h"
+#include "renderer.h"
+
+//Programmable raster pipeline. A shader is a plain struct; the rasterizer is a template instantiated
+//per shader type and depth format, so the shader calls inline into the inner loop and anything the
+//shader doesn't declare (varyings, depth testing) is compiled out instead of branched over.
+//
+//Triangles are set up once per batch into compact TriangleRecords (raster.h) and, per shader, the
+//planes of its varyings. Binning and every pass over the batch stream those, the full Triangle is
+//only read again by the vertex stage.
+//
+//struct ExampleShader {
+//	static constexpr int VARYINGS = 2;       //Floats interpolated perspective correct, at most MAX_VARYINGS
+//	static constexpr bool DEPTH_TEST = true; //Test and write the depth buffer
+//	void Vertex(const Triangle &tri, int vertex, Varyings<VARYINGS> &out) const; //Once per triangle corner
+//	uint32_t Pixel(const Varyings<VARYINGS> &in) const;                         //Once per covered pixel
+//};
+//
+//Pixel() returns RGBA8, or a Float4 for unclamped (lit) color that HDR targets store as is.
+//
+//A shader may also write its fragments itself (blending, OIT lists, visibility IDs, the G-buffer)
+//instead of storing them to the color buffer. Those are drawn one sample per pixel:
+//	void MaterializeTarget(int xMin, int yMin, int xMax, int yMax) const; //Before a triangle's pixels are written
+//	void Output(int index, float reciprocalW, uint32_t triangle, Fragment fragment) const; //Once per covered pixel
+//Output() gets whatever Pixel() returned, so such a Pixel() may return any fragment type.
+const int MAX_VARYINGS = 8;
+
+enum DepthMode {
+	DEPTH_TEST_WRITE, //Closest so far wins and writes its depth
+	DEPTH_TEST_EQUAL, //After a depth only prepass: only the final surface passes, nothing is written
+	DEPTH_TEST_READ   //Transparent geometry: tested against the opaque depth, nothing is written
+};
+
+//Per frame counters for the overdraw readout, reset by the caller
+struct RasterStats {
+	uint64_t pixelsShaded;      //Pixel shader invocations
+	uint64_t pixelsRejected;    //Covered pixels that failed the depth test before shading
+	uint64_t depthOnlySamples;  //Covered samples tested by depth only passes
+	uint64_t pixelsCovered;     //Pixels with geometry at the end of the frame, filled in by the renderer
+};
+extern RasterStats rasterStats;
+
+//Pieces of a band's work for the profiler. Texture sampling and shading run inside the pixel loops and
+//count as rasterization, a clock read per pixel would cost more than the sample it times.
+enum RasterPiece {RASTER_SETUP, RASTER_PIXELS, RASTER_PIECE_COUNT};
+inline const char *const RASTER_PIECE_NAMES[RASTER_PIECE_COUNT] = {"setup", "rasterization"};
+using RasterLaps = ProfileLaps<RASTER_PIECE_COUNT>;
+
+//The rasterizers' unit of parallel work: a band of TILE_SIZE pixel rows. A band owns its pixels and
+//tiles outright and draws the triangles touching it in submission order, so every pixel sees the
+//same sequence of writes whatever the thread count, and the image is bit for bit the same.
+struct RasterBands {
+	int count;
+	std::vector<std::vector<uint32_t>> triangles; //Per band, indices in submission order
+};
+
+//Pixel bounds of a record's bounding box, clamped to a width x height target
+inline bool GetRecordBounds(const TriangleRecord &record, int width, int height, int &xMin, int &yMin, int &xMax, int &yMax) {
+	const int32_t *vx = record.x;
+	const int32_t *vy = record.y;
+	xMin = std::max(std::min({vx[0], vx[1], vx[2]}) >> SUBPIXEL_BITS, 0);
+	yMin = std::max(std::min({vy[0], vy[1], vy[2]}) >> SUBPIXEL_BITS, 0);
+	xMax = std::min((std::max({vx[0], vx[1], vx[2]}) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, width);
+	yMax = std::min((std::max({vy[0], vy[1], vy[2]}) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, height);
+	return xMin < xMax and yMin < yMax;
+}
+
+//Bins keep their capacity between calls. Degenerate records bin nowhere.
+inline const RasterBands &BinTrianglesToBands(const TriangleRecord *records, size_t count, int width, int height) {
+	PROFILE_SCOPE("binning");
+	thread_local RasterBands bands;
+	bands.count = (height + TILE_SIZE - 1) / TILE_SIZE;
+	if ((int)bands.triangles.size() < bands.count) bands.triangles.resize(bands.count);
+	for (int band = 0; band < bands.count; band++) bands.triangles[band].clear();
+
+	for (size_t i = 0; i < count; i++) {
+		int xMin, yMin, xMax, yMax;
+		if (!GetRecordBounds(records[i], width, height, xMin, yMin, xMax, yMax)) continue;
+		for (int band = yMin / TILE_SIZE; band <= (yMax - 1) / TILE_SIZE; band++) bands.triangles[band].push_back((uint32_t)i);
+	}
+	return bands;
+}
+
+//Band counters are summed in band order once the pass is done
+inline void AddRasterStats(const std::vector<RasterStats> &bandStats) {
+	for (const RasterStats &stats : bandStats) {
+		rasterStats.pixelsShaded += stats.pixelsShaded;
+		rasterStats.pixelsRejected += stats.pixelsRejected;
+		rasterStats.depthOnlySamples += stats.depthOnlySamples;
+	}
+}
+
+template<int N>
+struct Varyings {
+	float v[N > 0 ? N : 1];
+};
+
+template<class Shader>
+constexpr bool SHADER_HAS_OUTPUT = requires(const Shader &shader, const Varyings<Shader::VARYINGS> &in) {
+	shader.Output(0, 0.0f, 0u, shader.Pixel(in));
+};
+
+//Planes of a triangle's varyings divided by w, the per shader half of its setup
+template<int N>
+struct VaryingPlanes {
+	AttributePlane v[N > 0 ? N : 1];
+
+	//Perspective correct: the planes are divided by the interpolated 1/w
+	void Interpolate(float x, float y, float reciprocalW, Varyings<N> &out) const {
+		float w = 1.0f / reciprocalW;
+		for (int k = 0; k < N; k++) out.v[k] = v[k].At(x, y) * w;
+	}
+};
+
+//Once per batch, every pass over the batch then streams the records
+inline void SetupTriangleRecords(const Triangle *tris, size_t count, TriangleRecord *records) {
+	PROFILE_SCOPE("triangle setup");
+	ParallelFor(0, (int)count, 256, [&](int first, int last) {
+		for (int i = first; i < last; i++) SetupTriangleRecord(tris[i], records[i]);
+	});
+}
+
+//Vertex stage, once per triangle and shader. Returns one entry per record, null when the shader has
+//no varyings. Entries of degenerate records are left unset, nothing reads them. The storage is
+//reused by the next batch drawn with the same shader type.
+template<class Shader>
+const VaryingPlanes<Shader::VARYINGS> *SetupVaryings(const Triangle *tris, const TriangleRecord *records, size_t count, const Shader &shader) {
+	constexpr int N = Shader::VARYINGS;
+	if constexpr (N == 0) {
+		return nullptr;
+	} else {
+		PROFILE_SCOPE("vertex stage");
+		thread_local std::vector<VaryingPlanes<N>> storage;
+		if (storage.size() < count) storage.resize(count);
+		VaryingPlanes<N> *planes = storage.data(); //Not storage in the body, the workers have their own
+
+		ParallelFor(0, (int)count, 256, [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				if (!RecordHasArea(records[i])) continue;
+				RecordCorners corners = GetRecordCorners(records[i]);
+				Varyings<N> out[3];
+				float invW[3];
+				for (int vertex = 0; vertex < 3; vertex++) {
+					shader.Vertex(tris[i], vertex, out[vertex]);
+					invW[vertex] = 1.0f / tris[i].points[vertex].w;
+				}
+				for (int k = 0; k < N; k++) {
+					float values[3] = {out[0].v[k] * invW[0], out[1].v[k] * invW[1], out[2].v[k] * invW[2]};
+					planes[i].v[k] = GetAttributePlane(corners, values);
+				}
+			}
+		});
+		return planes;
+	}
+}
+
+//Per band setup of one record, shared by every rasterizer below: passes over the same records get
+//bit identical coverage and depth, which a depth equal pass after a prepass relies on. The edge
+//functions are exact 64 bit integers (the top-left rule is a -1 bias), 1/w comes from its plane.
+struct RecordRaster {
+	int xMin, yMin, xMax, yMax;
+	int64_t deltaW0Col, deltaW1Col, deltaW2Col; //Per pixel
+	int64_t deltaW0Row, deltaW1Row, deltaW2Row;
+	int64_t w0Row, w1Row, w2Row; //At the center of (xMin, yMin)
+	AttributePlane reciprocalW;
+
+	//Returns false if the record doesn't touch rows [rowBegin, rowEnd) of a width wide target
+	bool Init(const TriangleRecord &record, int width, int rowBegin, int rowEnd) {
+		if (!GetRecordBounds(record, width, rowEnd, xMin, yMin, xMax, yMax)) return false;
+		yMin = std::max(yMin, rowBegin);
+		if (yMin >= yMax) return false;
+
+		//Edge 0: v1 -> v2, edge 1: v2 -> v0, edge 2: v0 -> v1
+		const int32_t *vx = record.x;
+		const int32_t *vy = record.y;
+		deltaW0Col = (int64_t)(vy[1] - vy[2]) * SUBPIXEL_ONE;
+		deltaW1Col = (int64_t)(vy[2] - vy[0]) * SUBPIXEL_ONE;
+		deltaW2Col = (int64_t)(vy[0] - vy[1]) * SUBPIXEL_ONE;
+		deltaW0Row = (int64_t)(vx[2] - vx[1]) * SUBPIXEL_ONE;
+		deltaW1Row = (int64_t)(vx[0] - vx[2]) * SUBPIXEL_ONE;
+		deltaW2Row = (int64_t)(vx[1] - vx[0]) * SUBPIXEL_ONE;
+
+		auto isTopLeft = [](int32_t ax, int32_t ay, int32_t bx, int32_t by) {
+			return (by == ay and bx > ax) or by < ay;
+		};
+		int32_t px = xMin * SUBPIXEL_ONE + SUBPIXEL_ONE / 2;
+		int32_t py = yMin * SUBPIXEL_ONE + SUBPIXEL_ONE / 2;
+		w0Row = EdgeFunction(vx[1], vy[1], vx[2], vy[2], px, py) - (isTopLeft(vx[1], vy[1], vx[2], vy[2]) ? 0 : 1);
+		w1Row = EdgeFunction(vx[2], vy[2], vx[0], vy[0], px, py) - (isTopLeft(vx[2], vy[2], vx[0], vy[0]) ? 0 : 1);
+		w2Row = EdgeFunction(vx[0], vy[0], vx[1], vy[1], px, py) - (isTopLeft(vx[0], vy[0], vx[1], vy[1]) ? 0 : 1);
+		reciprocalW = record.reciprocalW;
+		return true;
+	}
+
+	//1/w at the center of the row's first pixel, stepped by reciprocalW.a along the row
+	float RowReciprocalW(int y) const {
+		return reciprocalW.At(xMin + 0.5f, y + 0.5f);
+	}
+
+	//Edge function and 1/w offsets of the sample positions from the pixel center. The positions lie
+	//on the 1/16 pixel grid, so the edge offsets are exact in 28.4.
+	void SampleOffsets(int sampleCount, int64_t offset0[], int64_t offset1[], int64_t offset2[], float offsetInvW[]) const {
+		const SampleOffset *positions = GetSamplePositions(sampleCount);
+		for (int s = 0; s < sampleCount; s++) {
+			int64_t sx = std::lround(positions[s].x * SUBPIXEL_ONE);
+			int64_t sy = std::lround(positions[s].y * SUBPIXEL_ONE);
+			offset0[s] = (deltaW0Col * sx + deltaW0Row * sy) / SUBPIXEL_ONE;
+			offset1[s] = (deltaW1Col * sx + deltaW1Row * sy) / SUBPIXEL_ONE;
+			offset2[s] = (deltaW2Col * sx + deltaW2Row * sy) / SUBPIXEL_ONE;
+			offsetInvW[s] = reciprocalW.a * positions[s].x + reciprocalW.b * positions[s].y;
+		}
+	}
+};
+
+template<DepthFormat DF, DepthMode DM>
+inline bool DepthTestForMode(DepthBuffer &buffer, int index, float reciprocalW) {
+	if constexpr (DM == DEPTH_TEST_EQUAL) return DepthEqual<DF>(buffer, index, reciprocalW);
+	else if constexpr (DM == DEPTH_TEST_READ) return DepthTest<DF>(buffer, index, reciprocalW);
+	else return DepthTestAndWrite<DF>(buffer, index, reciprocalW);
+}
+
+//One sample per pixel, limited to rows [rowBegin, rowEnd). planes is null when the shader has no varyings.
+template<class Shader, DepthFormat DF, DepthMode DM>
+void RasterizeWithShader(const TriangleRecord *records, const VaryingPlanes<Shader::VARYINGS> *planes, uint32_t triangle, const Shader &shader, int rowBegin, int rowEnd, RasterStats &stats, RasterLaps &laps) {
+	constexpr int N = Shader::VARYINGS;
+	static_assert(N <= MAX_VARYINGS, "Too many varyings");
+
+	RecordRaster raster;
+	if (!raster.Init(records[triangle], renderer.windowWidth, rowBegin, rowEnd)) {
+		laps.Lap(RASTER_SETUP);
+		return;
+	}
+	if constexpr (SHADER_HAS_OUTPUT<Shader>) shader.MaterializeTarget(raster.xMin, raster.yMin, raster.xMax, raster.yMax);
+	else MaterializeColorRect(display.colorBuffer, raster.xMin, raster.yMin, raster.xMax, raster.yMax);
+	if constexpr (Shader::DEPTH_TEST) MaterializeDepthRect(display.depthBuffer, raster.xMin, raster.yMin, raster.xMax, raster.yMax);
+	laps.Lap(RASTER_SETUP);
+
+	const int samples = display.depthBuffer.samples;
+	uint64_t shaded = 0;
+	uint64_t rejected = 0;
+	int64_t w0Row = raster.w0Row;
+	int64_t w1Row = raster.w1Row;
+	int64_t w2Row = raster.w2Row;
+
+	for (int y = raster.yMin; y < raster.yMax; y++) {
+		int64_t w0 = w0Row;
+		int64_t w1 = w1Row;
+		int64_t w2 = w2Row;
+		float reciprocalW = raster.RowReciprocalW(y);
+		int index = renderer.windowWidth * y + raster.xMin;
+
+		for (int x = raster.xMin; x < raster.xMax; x++, index++) {
+			if ((w0 | w1 | w2) >= 0) {
+				bool visible = true;
+				if constexpr (Shader::DEPTH_TEST) visible = DepthTestForMode<DF, DM>(display.depthBuffer, index * samples, reciprocalW);
+				if (visible) {
+					Varyings<N> in;
+					if constexpr (N > 0) planes[triangle].Interpolate(x + 0.5f, y + 0.5f, reciprocalW, in);
+					if constexpr (SHADER_HAS_OUTPUT<Shader>) shader.Output(index, reciprocalW, triangle, shader.Pixel(in));
+					else StoreColor(display.colorBuffer, index, shader.Pixel(in));
+					shaded++;
+				} else {
+					rejected++;
+				}
+			}
+
+			w0 += raster.deltaW0Col;
+			w1 += raster.deltaW1Col;
+			w2 += raster.deltaW2Col;
+			reciprocalW += raster.reciprocalW.a;
+		}
+
+		w0Row += raster.deltaW0Row;
+		w1Row += raster.deltaW1Row;
+		w2Row += raster.deltaW2Row;
+	}
+	stats.pixelsShaded += shaded;
+	stats.pixelsRejected += rejected;
+	laps.Lap(RASTER_PIXELS);
+}
+
+//MSAA variant: the edge functions and depth are evaluated at every sample position, the pixel
+//shader runs once per pixel at the centroid of the covered samples.
+template<class Shader, DepthFormat DF, DepthMode DM>
+void RasterizeWithShaderMultisampled(const TriangleRecord *records, const VaryingPlanes<Shader::VARYINGS> *planes, uint32_t triangle, const Shader &shader, int rowBegin, int rowEnd, RasterStats &stats, RasterLaps &laps) {
+	constexpr int N = Shader::VARYINGS;
+	static_assert(N <= MAX_VARYINGS, "Too many varyings");
+
+	RecordRaster raster;
+	if (!raster.Init(records[triangle], renderer.windowWidth, rowBegin, rowEnd)) {
+		laps.Lap(RASTER_SETUP);
+		return;
+	}
+	MaterializeColorRect(display.colorBuffer, raster.xMin, raster.yMin, raster.xMax, raster.yMax);
+	if constexpr (Shader::DEPTH_TEST) MaterializeDepthRect(display.depthBuffer, raster.xMin, raster.yMin, raster.xMax, raster.yMax);
+
+	const int sampleCount = display.multisample.sampleCount;
+	const SampleOffset *positions = GetSamplePositions(sampleCount);
+	int64_t offset0[MAX_SAMPLES], offset1[MAX_SAMPLES], offset2[MAX_SAMPLES];
+	float offsetInvW[MAX_SAMPLES];
+	raster.SampleOffsets(sampleCount, offset0, offset1, offset2, offsetInvW);
+	laps.Lap(RASTER_SETUP);
+
+	uint64_t shaded = 0;
+	uint64_t rejected = 0;
+	int64_t w0Row = raster.w0Row;
+	int64_t w1Row = raster.w1Row;
+	int64_t w2Row = raster.w2Row;
+
+	for (int y = raster.yMin; y < raster.yMax; y++) {
+		int64_t w0 = w0Row;
+		int64_t w1 = w1Row;
+		int64_t w2 = w2Row;
+		float reciprocalW = raster.RowReciprocalW(y);
+		int index = renderer.windowWidth * y + raster.xMin;
+
+		for (int x = raster.xMin; x < raster.xMax; x++, index++) {
+			uint32_t coverage = 0;
+			for (int s = 0; s < sampleCount; s++) {
+				if (((w0 + offset0[s]) | (w1 + offset1[s]) | (w2 + offset2[s])) >= 0) coverage |= 1u << s;
+			}
+
+			if (coverage) {
+				uint32_t writeMask = coverage;
+				if constexpr (Shader::DEPTH_TEST) {
+					writeMask = 0;
+					for (int s = 0; s < sampleCount; s++) {
+						if (!(coverage & (1u << s))) continue;
+						if (DepthTestForMode<DF, DM>(display.depthBuffer, index * sampleCount + s, reciprocalW + offsetInvW[s])) writeMask |= 1u << s;
+					}
+				}
+				if (writeMask) {
+					Varyings<N> in;
+					if constexpr (N > 0) {
+						float centroidX = 0, centroidY = 0;
+						int covered = 0;
+						for (int s = 0; s < sampleCount; s++) {
+							if (!(coverage & (1u << s))) continue;
+							centroidX += positions[s].x; centroidY += positions[s].y;
+							covered++;
+						}
+						float cx = x + 0.5f + centroidX / covered;
+						float cy = y + 0.5f + centroidY / covered;
+						planes[triangle].Interpolate(cx, cy, raster.reciprocalW.At(cx, cy), in);
+					}
+					StoreSamples(display.multisample, display.colorBuffer, index, writeMask, shader.Pixel(in));
+					shaded++;
+				} else {
+					rejected++;
+				}
+			}
+
+			w0 += raster.deltaW0Col;
+			w1 += raster.deltaW1Col;
+			w2 += raster.deltaW2Col;
+			reciprocalW += raster.reciprocalW.a;
+		}
+
+		w0Row += raster.deltaW0Row;
+		w1Row += raster.deltaW1Row;
+		w2Row += raster.deltaW2Row;
+	}
+	stats.pixelsShaded += shaded;
+	stats.pixelsRejected += rejected;
+	laps.Lap(RASTER_PIXELS);
+}
+
+//Bands run in parallel on the job system
+template<class Shader, DepthFormat DF, DepthMode DM>
+void DrawTrianglesWithShader(const Triangle *tris, const TriangleRecord *records, size_t count, const Shader &shader) {
+	const VaryingPlanes<Shader::VARYINGS> *planes = SetupVaryings(tris, records, count, shader);
+	const RasterBands &bands = BinTrianglesToBands(records, count, renderer.windowWidth, renderer.windowHeight);
+	std::vector<RasterStats> bandStats(bands.count, RasterStats{});
+	bool multisampled = !SHADER_HAS_OUTPUT<Shader> and display.multisample.sampleCount > 1;
+
+	ParallelFor(0, bands.count, 1, [&](int first, int last) {
+		for (int band = first; band < last; band++) {
+			ProfileScope bandScope("raster band");
+			RasterLaps laps;
+			laps.Start();
+			int rowBegin = band * TILE_SIZE;
+			int rowEnd = std::min(rowBegin + TILE_SIZE, renderer.windowHeight);
+			if (multisampled) {
+				if constexpr (!SHADER_HAS_OUTPUT<Shader>) for (uint32_t i : bands.triangles[band]) RasterizeWithShaderMultisampled<Shader, DF, DM>(records, planes, i, shader, rowBegin, rowEnd, bandStats[band], laps);
+			} else {
+				for (uint32_t i : bands.triangles[band]) RasterizeWithShader<Shader, DF, DM>(records, planes, i, shader, rowBegin, rowEnd, bandStats[band], laps);
+			}
+			laps.Record(bandScope.start, RASTER_PIECE_NAMES);
+		}
+	});
+	AddRasterStats(bandStats);
+}
+
+template<class Shader, DepthFormat DF>
+void DrawTrianglesWithShader(const Triangle *tris, const TriangleRecord *records, size_t count, const Shader &shader, DepthMode mode) {
+	if (mode == DEPTH_TEST_EQUAL and Shader::DEPTH_TEST) DrawTrianglesWithShader<Shader, DF, DEPTH_TEST_EQUAL>(tris, records, count, shader);
+	else if (mode == DEPTH_TEST_READ and Shader::DEPTH_TEST) DrawTrianglesWithShader<Shader, DF, DEPTH_TEST_READ>(tris, records, count, shader);
+	else DrawTrianglesWithShader<Shader, DF, DEPTH_TEST_WRITE>(tris, records, count, shader);
+}
+
+//The only runtime dispatch (depth format, depth mode, MSAA) happens once per batch, not per pixel.
+//records must come from SetupTriangleRecords() over tris.
+template<class Shader>
+void DrawTrianglesWithShader(const Triangle *tris, const TriangleRecord *records, size_t count, const Shader &shader, DepthMode mode = DEPTH_TEST_WRITE) {
+	switch (display.depthBuffer.format) {
+	case DEPTH_F32: DrawTrianglesWithShader<Shader, DEPTH_F32>(tris, records, count, shader, mode); break;
+	case DEPTH_UNORM16: DrawTrianglesWithShader<Shader, DEPTH_UNORM16>(tris, records, count, shader, mode); break;
+	case DEPTH_UNORM24_S8: DrawTrianglesWithShader<Shader, DEPTH_UNORM24_S8>(tris, records, count, shader, mode); break;
+	}
+}
+
+//Batches drawn by a single pass set up their own records
+template<class Shader>
+void DrawTrianglesWithShader(const Triangle *tris, size_t count, const Shader &shader, DepthMode mode = DEPTH_TEST_WRITE) {
+	thread_local std::vector<TriangleRecord> records;
+	if (records.size() < count) records.resize(count);
+	SetupTriangleRecords(tris, count, records.data());
+	DrawTrianglesWithShader(tris, records.data(), count, shader, mode);
+}
+
+template<class Shader>
+void DrawTrianglesWithShader(const std::vector<Triangle> &tris, const Shader &shader, DepthMode mode = DEPTH_TEST_WRITE) {
+	DrawTrianglesWithShader(tris.data(), tris.size(), shader, mode);
+}
+
+//Shading pass of the visibility path, with the shader the forward path would draw with: every
+//visible pixel looks its triangle up, evaluates that triangle's varying planes at the pixel center
+//and runs Pixel() once. Tiles are independent and shade in parallel.
+template<class Shader>
+void ShadeVisibilityBuffer(const Triangle *tris, const TriangleRecord *records, size_t count, const Shader &shader) {
+	constexpr int N = Shader::VARYINGS;
+	const VaryingPlanes<N> *planes = SetupVaryings(tris, records, count, shader);
+	const VisibilityBuffer &buffer = display.visibility;
+
+	ParallelFor(0, buffer.tilesWide * buffer.tilesHigh, 1, [&](int first, int last) {
+		for (int tile = first; tile < last; tile++) {
+			if (buffer.tileStates[tile] != TILE_DIRTY) continue;
+			int x0 = (tile % buffer.tilesWide) * TILE_SIZE; int x1 = std::min(x0 + TILE_SIZE, buffer.width);
+			int y0 = (tile / buffer.tilesWide) * TILE_SIZE; int y1 = std::min(y0 + TILE_SIZE, buffer.height);
+			MaterializeColorRect(display.colorBuffer, x0, y0, x1, y1);
+
+			for (int y = y0; y < y1; y++) {
+				for (int x = x0; x < x1; x++) {
+					int index = y * buffer.width + x;
+					uint32_t id = buffer.ids[index];
+					if (id == VISIBILITY_EMPTY) continue;
+					Varyings<N> in;
+					if constexpr (N > 0) {
+						uint32_t triangle = VisibilityTriangle(id);
+						float px = x + 0.5f; float py = y + 0.5f;
+						planes[triangle].Interpolate(px, py, records[triangle].reciprocalW.At(px, py), in);
+					}
+					StoreColor(display.colorBuffer, index, shader.Pixel(in));
+				}
+			}
+		}
+	});
+}
+
+//Depth only: nothing but the edge functions and 1/w in the inner loop, no vertex stage at all.
+//Used for shadow maps and depth prepasses; the target can be any depth buffer, multisampled or not.
+template<DepthFormat DF>
+void RasterizeDepthOnly(DepthBuffer &target, const TriangleRecord &record, int rowBegin, int rowEnd, RasterStats &stats, RasterLaps &laps) {
+	RecordRaster raster;
+	if (!raster.Init(record, target.width, rowBegin, rowEnd)) {
+		laps.Lap(RASTER_SETUP);
+		return;
+	}
+	MaterializeDepthRect(target, raster.xMin, raster.yMin, raster.xMax, raster.yMax);
+
+	const int samples = target.samples;
+	int64_t offset0[MAX_SAMPLES], offset1[MAX_SAMPLES], offset2[MAX_SAMPLES];
+	float offsetInvW[MAX_SAMPLES];
+	raster.SampleOffsets(samples, offset0, offset1, offset2, offsetInvW);
+	laps.Lap(RASTER_SETUP);
+	uint64_t tested = 0;
+	int64_t w0Row = raster.w0Row;
+	int64_t w1Row = raster.w1Row;
+	int64_t w2Row = raster.w2Row;
+
+	for (int y = raster.yMin; y < raster.yMax; y++) {
+		int64_t w0 = w0Row;
+		int64_t w1 = w1Row;
+		int64_t w2 = w2Row;
+		float reciprocalW = raster.RowReciprocalW(y);
+		int index = target.width * y + raster.xMin;
+
+		for (int x = raster.xMin; x < raster.xMax; x++, index++) {
+			for (int s = 0; s < samples; s++) {
+				if (((w0 + offset0[s]) | (w1 + offset1[s]) | (w2 + offset2[s])) >= 0) {
+					//Same arithmetic as the shaded rasterizers, so a later pass can match these depths exactly
+					DepthTestAndWrite<DF>(target, index * samples + s, samples > 1 ? reciprocalW + offsetInvW[s] : reciprocalW);
+					tested++;
+				}
+			}
+
+			w0 += raster.deltaW0Col;
+			w1 += raster.deltaW1Col;
+			w2 += raster.deltaW2Col;
+			reciprocalW += raster.reciprocalW.a;
+		}
+
+		w0Row += raster.deltaW0Row;
+		w1Row += raster.deltaW1Row;
+		w2Row += raster.deltaW2Row;
+	}
+	stats.depthOnlySamples += tested;
+	laps.Lap(RASTER_PIXELS);
+}
+
+//Banded like DrawTrianglesWithShader(), which a depth equal pass relies on to reproduce these depths
+template<DepthFormat DF>
+void DrawTrianglesDepthOnly(DepthBuffer &target, const TriangleRecord *records, size_t count) {
+	const RasterBands &bands = BinTrianglesToBands(records, count, target.width, target.height);
+	std::vector<RasterStats> bandStats(bands.count, RasterStats{});
+
+	ParallelFor(0, bands.count, 1, [&](int first, int last) {
+		for (int band = first; band < last; band++) {
+			ProfileScope bandScope("depth band");
+			RasterLaps laps;
+			laps.Start();
+			int rowBegin = band * TILE_SIZE;
+			int rowEnd = std::min(rowBegin + TILE_SIZE, target.height);
+			for (uint32_t i : bands.triangles[band]) RasterizeDepthOnly<DF>(target, records[i], rowBegin, rowEnd, bandStats[band], laps);
+			laps.Record(bandScope.start, RASTER_PIECE_NAMES);
+		}
+	});
+	AddRasterStats(bandStats);
+}
+
+inline void DrawTrianglesDepthOnly(DepthBuffer &target, const TriangleRecord *records, size_t count) {
+	switch (target.format) {
+	case DEPTH_F32: DrawTrianglesDepthOnly<DEPTH_F32>(target, records, count); break;
+	case DEPTH_UNORM16: DrawTrianglesDepthOnly<DEPTH_UNORM16>(target, records, count); break;
+	case DEPTH_UNORM24_S8: DrawTrianglesDepthOnly<DEPTH_UNORM24_S8>(target, records, count); break;
+	}
+}
+
+inline void DrawTrianglesDepthOnly(DepthBuffer &target, const std::vector<Triangle> &tris) {
+	thread_local std::vector<TriangleRecord> records;
+	if (records.size() < tris.size()) records.resize(tris.size());
+	SetupTriangleRecords(tris.data(), tris.size(), records.data());
+	DrawTrianglesDepthOnly(target, records.data(), tris.size());
+}
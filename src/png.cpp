@@ -0,0 +1,85 @@
+#include "png.h"
+#include <algorithm>
+#include <fstream>
+#include <stb_image.h>
+
+static uint32_t Crc32(uint32_t crc, const uint8_t *data, size_t size) {
+	static uint32_t table[256];
+	static bool tableReady = false;
+	if (!tableReady) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		tableReady = true;
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void PutBigEndian(std::vector<uint8_t> &out, uint32_t value) {
+	out.push_back(value >> 24); out.push_back(value >> 16); out.push_back(value >> 8); out.push_back(value);
+}
+
+//Length, type, data, CRC over type and data
+static void PutChunk(std::vector<uint8_t> &out, const char *type, const std::vector<uint8_t> &data) {
+	PutBigEndian(out, (uint32_t)data.size());
+	size_t typeStart = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	PutBigEndian(out, Crc32(0, out.data() + typeStart, out.size() - typeStart));
+}
+
+bool WritePng(const char *path, const uint8_t *pixels, int width, int height) {
+	//Filter type 0 (none) in front of every row
+	size_t rowBytes = (size_t)width * 4;
+	std::vector<uint8_t> raw;
+	raw.reserve((rowBytes + 1) * height);
+	for (int y = 0; y < height; y++) {
+		raw.push_back(0);
+		raw.insert(raw.end(), pixels + y * rowBytes, pixels + (y + 1) * rowBytes);
+	}
+
+	//zlib stream: header, stored blocks of at most 65535 bytes, Adler-32 of the raw data
+	std::vector<uint8_t> zlib = {0x78, 0x01};
+	size_t offset = 0;
+	do {
+		size_t size = std::min(raw.size() - offset, (size_t)65535);
+		bool last = offset + size == raw.size();
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back(size & 0xFF); zlib.push_back(size >> 8);
+		zlib.push_back(~size & 0xFF); zlib.push_back((~size >> 8) & 0xFF);
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+		offset += size;
+	} while (offset < raw.size());
+	uint32_t a = 1, b = 0;
+	for (uint8_t byte : raw) { a = (a + byte) % 65521; b = (b + a) % 65521; }
+	PutBigEndian(zlib, (b << 16) | a);
+
+	std::vector<uint8_t> header;
+	PutBigEndian(header, width);
+	PutBigEndian(header, height);
+	header.insert(header.end(), {8, 6, 0, 0, 0}); //8 bit, RGBA, deflate, adaptive filtering, no interlace
+
+	std::vector<uint8_t> file = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	PutChunk(file, "IHDR", header);
+	PutChunk(file, "IDAT", zlib);
+	PutChunk(file, "IEND", {});
+
+	std::ofstream out(path, std::ios::binary);
+	out.write((const char*)file.data(), file.size());
+	return (bool)out;
+}
+
+bool ReadPng(const char *path, std::vector<uint8_t> &pixels, int &width, int &height) {
+	//The flag is per thread and texture loading turns it on
+	stbi_set_flip_vertically_on_load_thread(0);
+	int channels;
+	uint8_t *data = stbi_load(path, &width, &height, &channels, STBI_rgb_alpha);
+	if (!data) return false;
+	pixels.assign(data, data + (size_t)width * height * 4);
+	stbi_image_free(data);
+	return true;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+//Minimal PNG output for the headless modes: 8 bit RGBA, deflate with stored (uncompressed) blocks.
+//Big files, but no compression code and byte for byte stable. Pixels are rows top to bottom, RGBA order.
+bool WritePng(const char *path, const uint8_t *pixels, int width, int height);
+//Any PNG stb_image can decode, converted to RGBA, rows top to bottom
+bool ReadPng(const char *path, std::vector<uint8_t> &pixels, int &width, int &height);
@@ -0,0 +1,83 @@
+#include "procedural_assets.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <numbers>
+#include <vector>
+#include "linear_algebra.h"
+#include "png.h"
+
+//Faces over a (columns + 1) x (rows + 1) vertex grid whose vertex i is OBJ index i + 1 for position,
+//texture coordinate and normal alike. Clockwise seen from where the normals point.
+static void WriteGridFaces(std::ofstream &file, int rows, int columns) {
+	char line[128];
+	for (int r = 0; r < rows; r++) {
+		for (int c = 0; c < columns; c++) {
+			int i0 = r * (columns + 1) + c + 1, i1 = i0 + 1, i2 = i0 + columns + 1, i3 = i2 + 1;
+			snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\n", i0, i0, i0, i2, i2, i2, i1, i1, i1);
+			file << line;
+			snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\n", i1, i1, i1, i2, i2, i2, i3, i3, i3);
+			file << line;
+		}
+	}
+}
+
+static void WriteVertex(std::ofstream &file, const Vec3f &position, float u, float v, const Vec3f &normal) {
+	char line[160];
+	snprintf(line, sizeof(line), "v %f %f %f\nvt %f %f\nvn %f %f %f\n", position.x, position.y, position.z, u, v, normal.x, normal.y, normal.z);
+	file << line;
+}
+
+bool WriteSphereObj(const std::string &path, int rings, int segments) {
+	std::ofstream file(path);
+	for (int r = 0; r <= rings; r++) {
+		float theta = std::numbers::pi_v<float> * r / rings;
+		for (int s = 0; s <= segments; s++) {
+			float phi = 2.0f * std::numbers::pi_v<float> * s / segments;
+			Vec3f point = {std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)};
+			WriteVertex(file, point, (float)s / segments, (float)r / rings, point);
+		}
+	}
+	WriteGridFaces(file, rings, segments);
+	return (bool)file;
+}
+
+//Centerline of the knot, winding twice around the y axis and three times through the hole
+static Vec3f TorusKnotPoint(float t) {
+	const float majorRadius = 0.85f, minorRadius = 0.35f;
+	float radius = majorRadius + minorRadius * std::cos(3 * t);
+	return {radius * std::cos(2 * t), minorRadius * std::sin(3 * t), radius * std::sin(2 * t)};
+}
+
+bool WriteTorusKnotObj(const std::string &path, int segments, int sides) {
+	const float tubeRadius = 0.17f;
+	std::ofstream file(path);
+	for (int s = 0; s <= segments; s++) {
+		float t = 2.0f * std::numbers::pi_v<float> * s / segments;
+		//Frame around the centerline: the tangent, and the direction out from the y axis made
+		//perpendicular to it
+		Vec3f center = TorusKnotPoint(t);
+		Vec3f tangent = (TorusKnotPoint(t + 0.001f) - center).Normalized();
+		Vec3f outward = Vec3Cross(Vec3Cross(tangent, {center.x, 0, center.z}), tangent).Normalized();
+		Vec3f across = Vec3Cross(tangent, outward);
+		for (int side = 0; side <= sides; side++) {
+			float angle = 2.0f * std::numbers::pi_v<float> * side / sides;
+			Vec3f normal = outward * std::cos(angle) + across * std::sin(angle);
+			WriteVertex(file, center + normal * tubeRadius, (float)s / segments, (float)side / sides, normal);
+		}
+	}
+	WriteGridFaces(file, segments, sides);
+	return (bool)file;
+}
+
+bool WriteCheckerPng(const std::string &path, int size) {
+	std::vector<uint8_t> pixels((size_t)size * size * 4);
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			uint8_t *p = &pixels[((size_t)y * size + x) * 4];
+			uint8_t shade = ((x / 32) + (y / 32)) % 2 ? 230 : 40;
+			p[0] = shade; p[1] = (uint8_t)x; p[2] = (uint8_t)y; p[3] = 255;
+		}
+	}
+	return WritePng(path.c_str(), pixels.data(), size, size);
+}
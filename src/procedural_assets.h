@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+
+//Meshes and textures generated from code and written out as files, so the headless modes can load
+//them through the real loaders without any asset from outside the repo. Same output on every run.
+
+//UV sphere of radius 1 with positions, texture coordinates and normals, rings * segments * 2 faces
+bool WriteSphereObj(const std::string &path, int rings, int segments);
+//(2, 3) torus knot tube, about 2.7 across and 1 high, segments * sides * 2 faces. It overlaps and
+//shadows itself from every side.
+bool WriteTorusKnotObj(const std::string &path, int segments, int sides);
+//Red checkerboard of 32 texel squares, green and blue follow x and y (wrapping every 256 texels), opaque
+bool WriteCheckerPng(const std::string &path, int size);
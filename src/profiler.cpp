@@ -0,0 +1,197 @@
+#include "profiler.h"
+#ifndef PROFILER_DISABLED
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+bool profilerEnabled = false;
+
+//Weight of the newest frame in the smoothed stats
+static const double SMOOTHING = 0.1;
+
+struct ProfileEvent {
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+};
+
+//One per thread that ever recorded. Never freed, so a buffer outlives a job system restart.
+struct ThreadEvents {
+	int thread;
+	std::vector<ProfileEvent> events; //Of the current frame, keeps its capacity
+};
+static std::mutex threadsMutex; //Guards threads
+static std::vector<std::unique_ptr<ThreadEvents>> threads;
+
+static std::vector<ProfileStat> stats;
+static std::vector<ProfileCounter> counters;
+static std::vector<double> frameMs, frameCalls; //Per stats entry, this frame's sums
+static uint64_t lastFrameEnd = 0; //0 while the profiler is off
+
+struct CounterSample {
+	const char *name;
+	uint64_t time;
+	double value;
+};
+
+struct Capture {
+	bool running;
+	bool wasEnabled; //profilerEnabled before the capture turned it on, restored when it ends
+	int framesLeft;
+	std::string path;
+	int mainThread;
+	std::vector<std::pair<int, ProfileEvent>> events; //Thread index, event
+	std::vector<CounterSample> counterSamples;
+};
+static Capture capture = {};
+
+uint64_t ProfileNow() {
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() | 1;
+}
+
+static ThreadEvents &GetThreadEvents() {
+	thread_local ThreadEvents *events = nullptr;
+	if (!events) {
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		threads.push_back(std::make_unique<ThreadEvents>());
+		events = threads.back().get();
+		events->thread = (int)threads.size() - 1;
+	}
+	return *events;
+}
+
+void RecordProfileEvent(const char *name, uint64_t start, uint64_t end) {
+	GetThreadEvents().events.push_back({name, start, end});
+}
+
+//Names are compared by content, the same literal can have a different address in every translation unit
+template<class T>
+static size_t FindOrAdd(std::vector<T> &entries, const char *name) {
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].name == name or strcmp(entries[i].name, name) == 0) return i;
+	}
+	T entry = {};
+	entry.name = name;
+	entries.push_back(entry);
+	return entries.size() - 1;
+}
+
+void SetProfileCounter(const char *name, double value) {
+	if (!profilerEnabled) return;
+	counters[FindOrAdd(counters, name)].value = value;
+}
+
+//Called with threadsMutex held. Timestamps in microseconds from the earliest event, every name is
+//a string literal of ours (no escaping).
+static void WriteCapture() {
+	uint64_t origin = UINT64_MAX;
+	for (const auto &[thread, event] : capture.events) origin = std::min(origin, event.start);
+	for (const CounterSample &sample : capture.counterSamples) origin = std::min(origin, sample.time);
+	origin = std::min(origin, lastFrameEnd);
+
+	std::ofstream file(capture.path);
+	if (!file) {
+		std::cout << "Profiler: couldn't write " << capture.path << std::endl;
+		return;
+	}
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	for (size_t t = 0; t < threads.size(); t++) {
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t << ",\"args\":{\"name\":\"";
+		if ((int)t == capture.mainThread) file << "main";
+		else file << "worker " << t;
+		file << "\"}},\n";
+	}
+	for (const auto &[thread, event] : capture.events) {
+		file << "{\"name\":\"" << event.name << "\",\"cat\":\"renderer\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+			<< ",\"ts\":" << (event.start - origin) / 1000.0 << ",\"dur\":" << (event.end - event.start) / 1000.0 << "},\n";
+	}
+	for (const CounterSample &sample : capture.counterSamples) {
+		file << "{\"name\":\"" << sample.name << "\",\"ph\":\"C\",\"pid\":1,\"tid\":" << capture.mainThread
+			<< ",\"ts\":" << (sample.time - origin) / 1000.0 << ",\"args\":{\"value\":" << sample.value << "}},\n";
+	}
+	//Every entry above ends in a comma, this one closes the list
+	file << "{\"name\":\"capture end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":" << capture.mainThread
+		<< ",\"ts\":" << (lastFrameEnd - origin) / 1000.0 << "}\n]}\n";
+	std::cout << "Profiler: wrote " << capture.events.size() << " events to " << capture.path << std::endl;
+}
+
+void EndProfileFrame() {
+	if (!profilerEnabled) {
+		//Drops whatever was recorded before it was switched off
+		if (lastFrameEnd) {
+			std::lock_guard<std::mutex> lock(threadsMutex);
+			for (auto &thread : threads) thread->events.clear();
+			lastFrameEnd = 0;
+		}
+		return;
+	}
+
+	uint64_t now = ProfileNow();
+	ThreadEvents &mainEvents = GetThreadEvents();
+	if (lastFrameEnd) mainEvents.events.push_back({"frame", lastFrameEnd, now});
+	lastFrameEnd = now;
+
+	//No jobs are running, the buffers are all ours
+	std::lock_guard<std::mutex> lock(threadsMutex);
+	frameMs.assign(stats.size(), 0);
+	frameCalls.assign(stats.size(), 0);
+	for (auto &thread : threads) {
+		for (const ProfileEvent &event : thread->events) {
+			size_t i = FindOrAdd(stats, event.name);
+			if (i >= frameMs.size()) {
+				frameMs.resize(i + 1, 0);
+				frameCalls.resize(i + 1, 0);
+			}
+			frameMs[i] += (event.end - event.start) / 1e6;
+			frameCalls[i]++;
+			if (capture.running) capture.events.push_back({thread->thread, event});
+		}
+		thread->events.clear();
+	}
+	for (size_t i = 0; i < stats.size(); i++) {
+		stats[i].ms += (frameMs[i] - stats[i].ms) * SMOOTHING;
+		stats[i].calls += (frameCalls[i] - stats[i].calls) * SMOOTHING;
+	}
+
+	if (capture.running) {
+		capture.mainThread = mainEvents.thread;
+		for (const ProfileCounter &counter : counters) capture.counterSamples.push_back({counter.name, now, counter.value});
+		if (--capture.framesLeft == 0) {
+			capture.running = false;
+			profilerEnabled = capture.wasEnabled;
+			WriteCapture();
+			capture.events = {};
+			capture.counterSamples = {};
+		}
+	}
+}
+
+bool StartProfileCapture(int frames, const std::string &path) {
+	if (capture.running or frames <= 0) return false;
+	capture.wasEnabled = profilerEnabled;
+	profilerEnabled = true;
+	capture.running = true;
+	capture.framesLeft = frames;
+	capture.path = path;
+	return true;
+}
+
+bool IsProfileCaptureRunning() {
+	return capture.running;
+}
+
+const std::vector<ProfileStat> &GetProfileStats() {
+	return stats;
+}
+
+const std::vector<ProfileCounter> &GetProfileCounters() {
+	return counters;
+}
+#endif
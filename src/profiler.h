@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Frame profiler. Scopes record begin/end timestamps into a buffer per thread (no locks, no sharing),
+//counters hold one value per frame. EndProfileFrame() folds the frame into smoothed per scope
+//totals for the UI and, while a capture runs, keeps the raw events to write out as a Chrome
+//trace_event JSON file (chrome://tracing or ui.perfetto.dev).
+//
+//Switched off, a scope costs a branch on profilerEnabled. Define PROFILER_DISABLED to compile every
+//scope, lap and counter out entirely, profilerEnabled is then a constant false.
+
+//Per frame, smoothed over the last frames
+struct ProfileStat {
+	const char *name;
+	double ms; //Summed over every thread, so parallel scopes can add up to more than the frame
+	double calls;
+};
+
+struct ProfileCounter {
+	const char *name;
+	double value; //Of the last frame
+};
+
+#ifdef PROFILER_DISABLED
+constexpr bool profilerEnabled = false;
+inline uint64_t ProfileNow() { return 0; }
+inline void RecordProfileEvent(const char*, uint64_t, uint64_t) {}
+inline void SetProfileCounter(const char*, double) {}
+inline void EndProfileFrame() {}
+inline bool StartProfileCapture(int, const std::string&) { return false; }
+inline bool IsProfileCaptureRunning() { return false; }
+inline const std::vector<ProfileStat> &GetProfileStats() { static const std::vector<ProfileStat> none; return none; }
+inline const std::vector<ProfileCounter> &GetProfileCounters() { static const std::vector<ProfileCounter> none; return none; }
+#else
+extern bool profilerEnabled;
+//Nanoseconds on the steady clock, never 0
+uint64_t ProfileNow();
+//Thread safe, every thread appends to its own buffer. Only call it while profilerEnabled.
+void RecordProfileEvent(const char *name, uint64_t start, uint64_t end);
+//Main thread only. name must outlive the profiler (a string literal).
+void SetProfileCounter(const char *name, double value);
+//Main thread, once per frame with no jobs running
+void EndProfileFrame();
+//Turns the profiler on for the next frames and writes them to path once they are done, then puts
+//profilerEnabled back the way it was. False if a capture is already running.
+bool StartProfileCapture(int frames, const std::string &path);
+bool IsProfileCaptureRunning();
+//In the order the names first showed up
+const std::vector<ProfileStat> &GetProfileStats();
+const std::vector<ProfileCounter> &GetProfileCounters();
+#endif
+
+//Times its own lifetime
+struct ProfileScope {
+	const char *name;
+	uint64_t start;
+	explicit ProfileScope(const char *name) : name(name), start(profilerEnabled ? ProfileNow() : 0) {}
+	~ProfileScope() { if (start) RecordProfileEvent(name, start, ProfileNow()); }
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope &operator=(const ProfileScope&) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+//For work split into pieces far too short for a scope each (per face, per triangle): one clock read
+//per piece, summed per piece over the whole loop. Record() then writes the sums as back to back
+//events from start, so the trace shows how the loop's time divides rather than when each piece ran.
+template<int N>
+struct ProfileLaps {
+	uint64_t total[N] = {};
+	uint64_t last = 0;
+
+	void Start() { last = profilerEnabled ? ProfileNow() : 0; }
+	//Adds the time since the previous lap to piece
+	void Lap(int piece) {
+		if (!last) return;
+		uint64_t now = ProfileNow();
+		total[piece] += now - last;
+		last = now;
+	}
+	void Record(uint64_t start, const char *const (&names)[N]) const {
+		if (!start or !last) return;
+		for (int i = 0; i < N; i++) {
+			RecordProfileEvent(names[i], start, start + total[i]);
+			start += total[i];
+		}
+	}
+};
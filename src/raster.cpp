@@ -0,0 +1,40 @@
+#include "raster.h"
+#include <cmath>
+
+RecordCorners GetRecordCorners(const TriangleRecord &record) {
+	RecordCorners corners;
+	for (int i = 0; i < 3; i++) {
+		corners.x[i] = (float)record.x[i] / SUBPIXEL_ONE;
+		corners.y[i] = (float)record.y[i] / SUBPIXEL_ONE;
+	}
+	const float *x = corners.x, *y = corners.y;
+	corners.area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	return corners;
+}
+
+AttributePlane GetAttributePlane(const RecordCorners &corners, const float f[3]) {
+	//Solve f = a * x + b * y + c through the three corners
+	const float *x = corners.x, *y = corners.y;
+	float a = ((f[1] - f[0]) * (y[2] - y[0]) - (f[2] - f[0]) * (y[1] - y[0])) / corners.area;
+	float b = ((f[2] - f[0]) * (x[1] - x[0]) - (f[1] - f[0]) * (x[2] - x[0])) / corners.area;
+	return {a, b, f[0] - a * x[0] - b * y[0]};
+}
+
+bool SetupTriangleRecord(const Triangle &tri, TriangleRecord &record) {
+	float invW[3];
+	for (int i = 0; i < 3; i++) {
+		record.x[i] = (int32_t)std::lround(tri.points[i].x * SUBPIXEL_ONE);
+		record.y[i] = (int32_t)std::lround(tri.points[i].y * SUBPIXEL_ONE);
+		invW[i] = 1.0f / tri.points[i].w;
+	}
+
+	if (!RecordHasArea(record)) {
+		record = {};
+		return false;
+	}
+
+	//Planes are built from the snapped positions so they agree with the edge functions
+	RecordCorners corners = GetRecordCorners(record);
+	record.reciprocalW = GetAttributePlane(corners, invW);
+	return true;
+}
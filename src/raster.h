@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include "model.h"
+
+//Compact post-setup triangle records. Setup runs once per triangle and leaves only what coverage and
+//depth need: fixed point screen positions for exact integer edge functions, and the plane of 1/w.
+//A fifth of the size of a Triangle. A shader's varyings get planes of their own (see pipeline.h).
+const int SUBPIXEL_BITS = 4;
+const int SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+
+//Value at raster position (x, y) is a * x + b * y + c
+struct AttributePlane {
+	float a, b, c;
+	float At(float x, float y) const { return a * x + b * y + c; }
+};
+
+struct TriangleRecord {
+	int32_t x[3], y[3]; //Raster space, 28.4 fixed point
+	AttributePlane reciprocalW;
+};
+
+//Returns false for triangles with no area in front (degenerate or clockwise on screen). Those
+//records are still filled, collapsed to a point that covers nothing, so record indices can stay
+//aligned with triangle indices.
+bool SetupTriangleRecord(const Triangle &tri, TriangleRecord &record);
+
+//Integer edge function of the edge a -> b at p, same orientation as Vec2Cross(b - a, p - a)
+inline int64_t EdgeFunction(int32_t ax, int32_t ay, int32_t bx, int32_t by, int32_t px, int32_t py) {
+	return (int64_t)(bx - ax) * (py - ay) - (int64_t)(by - ay) * (px - ax);
+}
+
+inline bool RecordHasArea(const TriangleRecord &record) {
+	return EdgeFunction(record.x[0], record.y[0], record.x[1], record.y[1], record.x[2], record.y[2]) > 0;
+}
+
+//A record's snapped corners in raster space, for building more planes over it
+struct RecordCorners {
+	float x[3], y[3];
+	float area; //Twice the triangle's, must not be 0
+};
+RecordCorners GetRecordCorners(const TriangleRecord &record);
+
+//Plane through the corners taking the given values
+AttributePlane GetAttributePlane(const RecordCorners &corners, const float values[3]);
@@ -2,11 +2,14 @@
 #include <imgui/imgui_impl_sdl2.h>
 #include <imgui/imgui_impl_sdlrenderer2.h>
 #include <SDL.h>
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <immintrin.h>
 #include <iostream>
 #include <cmath>
 #include <numbers>
+#include <thread>
 #include "renderer.h"
 #include "SDL_pixels.h"
 #include "SDL_render.h"
@@ -14,8 +17,14 @@
 #include "display.h"
 #include "linear_algebra.h"
 #include "model.h"
+#include "assets.h"
 #include "camera.h"
+#include "camera_path.h"
 #include "clipping.h"
+#include "jobs.h"
+#include "profiler.h"
+#include "shaders.h"
+#include "sort.h"
 
 static const int FPS = 144;
 Renderer renderer = {
@@ -27,16 +36,79 @@ Renderer renderer = {
 	.sdlRenderer = nullptr,
 	.windowWidth = 1920,
 	.windowHeight = 1080,
+	.colorFormat = PIXEL_RGBA8,
+	.depthFormat = DEPTH_F32,
+	.sampleCount = 1,
 	.sdlColorBufferTexture = nullptr,
-	.trisToRender = {},
+	.headless = false,
+	.frames = {},
+	.drawnFrame = 0,
+	.framesInFlight = 1,
+	.workerThreads = -1,
+	.visibleFaces = {},
 	.renderWireframe = false,
+	.antialiasedWireframe = true,
 	.renderMode = RenderMode::TEXTURED,
 	.projectionMat = {},
 	.backfaceCulling = true,
 	.rotation = {},
 	.showcase = false,
+	.showcaseTime = 0,
+	.shadingPath = SHADING_FORWARD,
+	.lights = {},
+	.lightCount = 8,
+	.lighting = LIGHTING_NONE,
+	.sun = {.direction = {-0.4f, 1.0f, -0.6f}, .color = {1.0f, 0.95f, 0.85f}, .intensity = 0.9f},
+	.shadows = false,
+	.depthPrepass = false,
+	.instances = {},
+	.instanceCount = 1,
+	.sortFrontToBack = true,
+	.transparency = TRANSPARENCY_OFF,
+	.opacity = 0.5f,
+	.stageMs = {},
 };
 
+const char *FRAME_STAGE_NAMES[STAGE_COUNT] = {"clear", "shadows", "raster", "resolve", "overlays"};
+
+static const int MAX_LIGHTS = 64;
+static const int MAX_INSTANCES = 1 << VISIBILITY_INSTANCE_BITS;
+
+//Copies of the model in columns of three, receding away from the camera. Instance 0 is the original model.
+static void CreateInstances(Vec3f first, float spacing) {
+	renderer.instances.clear();
+	const float columns[3] = {0.0f, -1.0f, 1.0f};
+	for (int i = 0; i < MAX_INSTANCES; i++) {
+		renderer.instances.push_back({.position = {first.x + columns[i % 3] * spacing, first.y, first.z + (i / 3) * spacing}});
+	}
+}
+
+//Lights spread evenly over a sphere around the model (Fibonacci sphere), colors walk around the hue wheel
+static void CreateLights(Vec3f center, float distance) {
+	const float GOLDEN_ANGLE = std::numbers::pi_v<float> * (3.0f - std::sqrt(5.0f));
+	renderer.lights.clear();
+	for (int i = 0; i < MAX_LIGHTS; i++) {
+		float y = 1.0f - 2.0f * (i + 0.5f) / MAX_LIGHTS;
+		float ringRadius = std::sqrt(1.0f - y * y);
+		float angle = GOLDEN_ANGLE * i;
+		Vec3f offset = {std::cos(angle) * ringRadius, y, std::sin(angle) * ringRadius};
+
+		float hue = std::fmod(i * 0.381966f, 1.0f) * 6.0f;
+		Vec3f color = {
+			std::clamp(std::abs(hue - 3.0f) - 1.0f, 0.0f, 1.0f),
+			std::clamp(2.0f - std::abs(hue - 2.0f), 0.0f, 1.0f),
+			std::clamp(2.0f - std::abs(hue - 4.0f), 0.0f, 1.0f)
+		};
+
+		renderer.lights.push_back({
+			.position = center + offset * distance,
+			.color = color,
+			.intensity = 1.5f,
+			.radius = distance * 1.5f,
+		});
+	}
+}
+
 bool InitWindow() {
 	if(SDL_Init(SDL_INIT_EVERYTHING) != 0) {
 		std::cout << "Error initializing SDL." << std::endl;
@@ -73,19 +145,23 @@ bool InitWindow() {
 }
 
 void Setup() {
-	display.colorBuffer = new uint32_t[renderer.windowWidth * renderer.windowHeight];
-	renderer.sdlColorBufferTexture = SDL_CreateTexture(
+	display.colorBuffer = CreateColorBuffer(renderer.colorFormat, renderer.windowWidth, renderer.windowHeight);
+	if (!renderer.headless) display.presentBuffer = CreateColorBuffer(renderer.colorFormat, renderer.windowWidth, renderer.windowHeight);
+	if (!renderer.headless) renderer.sdlColorBufferTexture = SDL_CreateTexture(
 		renderer.sdlRenderer,
-		SDL_PIXELFORMAT_RGBA32,
+		GetSdlPixelFormat(renderer.colorFormat),
 		SDL_TEXTUREACCESS_STREAMING,
 		renderer.windowWidth,
 		renderer.windowHeight
 	);
-	display.zBuffer = new float[renderer.windowWidth * renderer.windowHeight];
 
 	float verticalFov = M_PI/3.0;
 	float horizontalFov = atan(tan(verticalFov / 2) * ((float)renderer.windowWidth / renderer.windowHeight)) * 2.0;
 	float zNear = 0.1; float zFar = 100;
+
+	//Clipping against -w <= z keeps w >= ~zNear/2, so 1/w never exceeds 2/zNear
+	display.depthBuffer = CreateDepthBuffer(renderer.depthFormat, renderer.windowWidth, renderer.windowHeight, renderer.sampleCount, zNear * 0.5f);
+	display.multisample = CreateMultisampleBuffer(renderer.sampleCount, renderer.windowWidth, renderer.windowHeight);
 	clipping.frustum = InitFrustumPlanes(verticalFov, horizontalFov, zNear, zFar);
 	renderer.projectionMat = GetPerspectiveMat(
 		verticalFov, 
@@ -94,11 +170,28 @@ void Setup() {
 		zNear, zFar
 	);
 
+	display.gbuffer = CreateGBuffer(renderer.windowWidth, renderer.windowHeight);
+	display.visibility = CreateVisibilityBuffer(renderer.windowWidth, renderer.windowHeight);
+	display.shadowMap = CreateShadowMap(2048);
+	display.oit = CreateOitBuffer(renderer.windowWidth, renderer.windowHeight);
+	CreateLights({0, 0, 5}, 2.0f);
+	CreateInstances({0, 0, 5}, 2.5f);
+
 	ClearColorBuffer(0xFF000000); //Clear with black
 	ClearZBuffer();
 
-	LoadObjFile(model.mesh, "crab.obj");
-	LoadPngTexture(model, "crab.png");
+	//One worker per core besides the main thread, unless set up front
+	if (renderer.workerThreads < 0) renderer.workerThreads = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+	StartJobSystem(renderer.workerThreads);
+
+	//Assets stream in on background threads, placeholders are drawn until they are ready.
+	//Headless runs load them on first use instead, so every frame sees the real data.
+	if (!renderer.headless) StartAssetLoaders(2);
+	model.mesh = AcquireMesh("crab.obj");
+	model.texture = AcquireTexture("crab.png");
+	PrefetchMesh(model.mesh);
+	PrefetchTexture(model.texture);
+	if (renderer.headless) return;
 
 	//Setting up ImGui
 	IMGUI_CHECKVERSION();
@@ -110,6 +203,18 @@ void Setup() {
 	ImGui_ImplSDLRenderer2_Init(renderer.sdlRenderer);
 }
 
+//Setup() for the command line modes: RGBA8 color, geometry built inline, no worker threads until
+//the caller starts some
+void SetupHeadless(int width, int height) {
+	renderer.headless = true;
+	renderer.windowWidth = width;
+	renderer.windowHeight = height;
+	renderer.colorFormat = PIXEL_RGBA8;
+	renderer.framesInFlight = 1;
+	renderer.workerThreads = 0;
+	Setup();
+}
+
 void ProcessInput(bool &isRunning){
 	SDL_Event sdlEvent;
 	while(SDL_PollEvent(&sdlEvent)) {
@@ -141,7 +246,11 @@ void ProcessInput(bool &isRunning){
 	}
 }
 
-void RunImGui(SDL_Renderer *renderer, Vec3f &rotation, bool &showcase, RenderMode &renderMode, bool &wireframe, bool &backface) {
+//Frames a trace capture records, written next to the executable
+static const int TRACE_FRAMES = 120;
+static const char *TRACE_PATH = "trace.json";
+
+void RunImGui(Vec3f &rotation, bool &showcase, RenderMode &renderMode, bool &wireframe, bool &antialiased, bool &backface, int &sampleCount, ShadingPath &shadingPath, LightingMode &lighting, bool &shadows, bool &depthPrepass, int &lightCount, int &instanceCount, bool &sortFrontToBack, TransparencyMode &transparency, float &opacity, int &framesInFlight, int &workerThreads, const FrameArena<Triangle> &triangleArena) {
 	ImGui_ImplSDLRenderer2_NewFrame();
 	ImGui_ImplSDL2_NewFrame();
 	ImGui::NewFrame();
@@ -157,7 +266,71 @@ void RunImGui(SDL_Renderer *renderer, Vec3f &rotation, bool &showcase, RenderMod
 		}
 		ImGui::Checkbox("Wireframe", &wireframe);
 		ImGui::SameLine();
+		ImGui::BeginDisabled(!wireframe);
+		ImGui::Checkbox("Anti-aliased", &antialiased);
+		ImGui::EndDisabled();
+		ImGui::SameLine();
 		ImGui::Checkbox("Backface culling", &backface);
+
+		const char* msaaLabels[] = {"Off", "2x", "4x", "8x"};
+		int msaa = sampleCount == 8 ? 3 : sampleCount / 2;
+		if(ImGui::Combo("MSAA", &msaa, msaaLabels, IM_ARRAYSIZE(msaaLabels))) {
+			sampleCount = msaa == 0 ? 1 : 1 << msaa;
+		}
+		const char* shadingLabels[] = {"Forward", "Deferred lighting", "Visibility buffer"};
+		int path = (int)shadingPath;
+		if(ImGui::Combo("Shading", &path, shadingLabels, IM_ARRAYSIZE(shadingLabels))) {
+			shadingPath = (ShadingPath)path;
+		}
+		//Every path lights with the same kernels, the deferred one always per pixel
+		const char* lightingLabels[] = {"Unlit", "Gouraud", "Phong"};
+		int lightingMode = (int)lighting;
+		if(ImGui::Combo("Lighting", &lightingMode, lightingLabels, IM_ARRAYSIZE(lightingLabels))) {
+			lighting = (LightingMode)lightingMode;
+		}
+		ImGui::BeginDisabled(lighting == LIGHTING_NONE);
+		ImGui::Checkbox("Shadows", &shadows);
+		ImGui::EndDisabled();
+		ImGui::SameLine();
+		ImGui::BeginDisabled(shadingPath != SHADING_FORWARD);
+		ImGui::Checkbox("Depth prepass", &depthPrepass);
+		ImGui::EndDisabled();
+		if (shadingPath == SHADING_FORWARD) {
+			//Pixel shader invocations per pixel that ended up covered, 1.0 means no wasted shading
+			double overdraw = rasterStats.pixelsCovered ? (double)rasterStats.pixelsShaded / rasterStats.pixelsCovered : 0.0;
+			ImGui::Text("Overdraw: %.2fx (%llu shaded / %llu covered)", overdraw, (unsigned long long)rasterStats.pixelsShaded, (unsigned long long)rasterStats.pixelsCovered);
+			ImGui::Text("Depth only samples: %llu", (unsigned long long)rasterStats.depthOnlySamples);
+			ImGui::Text("Early depth rejected: %llu pixels", (unsigned long long)rasterStats.pixelsRejected);
+		}
+		ImGui::BeginDisabled(shadingPath != SHADING_FORWARD);
+		const char* transparencyLabels[] = {"Opaque", "Alpha blend (unsorted)", "Order independent"};
+		int transparencyMode = (int)transparency;
+		if(ImGui::Combo("Transparency", &transparencyMode, transparencyLabels, IM_ARRAYSIZE(transparencyLabels))) {
+			transparency = (TransparencyMode)transparencyMode;
+		}
+		ImGui::BeginDisabled(transparency == TRANSPARENCY_OFF);
+		ImGui::SliderFloat("Opacity", &opacity, 0.0f, 1.0f);
+		ImGui::EndDisabled();
+		ImGui::EndDisabled();
+		if (shadingPath == SHADING_FORWARD and transparency == TRANSPARENCY_OIT) {
+			ImGui::Text("OIT fragments: %u / %u, dropped %u", std::min(display.oit.used, display.oit.capacity), display.oit.capacity, display.oit.dropped);
+		}
+		ImGui::SliderInt("Instances", &instanceCount, 1, MAX_INSTANCES);
+		ImGui::Checkbox("Front-to-back sort", &sortFrontToBack);
+		ImGui::Text("Triangle arena: %zu peak, %u mid-frame growths", triangleArena.highWater, triangleArena.midFrameGrowths);
+		ImGui::SliderInt("Frames in flight", &framesInFlight, 1, MAX_FRAMES_IN_FLIGHT);
+		//0 runs every job inline on the main thread, in submission order
+		ImGui::SliderInt("Worker threads", &workerThreads, 0, (int)std::thread::hardware_concurrency());
+		ImGui::BeginDisabled(lighting == LIGHTING_NONE);
+		ImGui::SliderInt("Lights", &lightCount, 0, MAX_LIGHTS);
+		ImGui::EndDisabled();
+		if (shadingPath == SHADING_VISIBILITY) {
+			//Picking straight from the IDs of the frame that was just drawn
+			ImVec2 mouse = ImGui::GetIO().MousePos;
+			uint32_t id = PickVisibilityId(display.visibility, (int)mouse.x, (int)mouse.y);
+			if (id == VISIBILITY_EMPTY) ImGui::Text("Hovered: nothing");
+			else ImGui::Text("Hovered: instance %u, triangle %u", VisibilityInstance(id), VisibilityTriangle(id));
+		}
 		ImGui::NewLine();
 		ImGui::Separator();
 		ImGui::NewLine();
@@ -172,19 +345,240 @@ void RunImGui(SDL_Renderer *renderer, Vec3f &rotation, bool &showcase, RenderMod
 		ImGui::SliderAngle("Y (yaw)",   &rotation.y, 0.0f, 360.0f);
 		ImGui::SliderAngle("Z (roll)",  &rotation.z, 0.0f, 360.0f);
 		ImGui::EndDisabled();
+
+#ifndef PROFILER_DISABLED
+		ImGui::NewLine();
+		if (ImGui::CollapsingHeader("Profiler")) {
+			ImGui::BeginDisabled(IsProfileCaptureRunning());
+			ImGui::Checkbox("Enabled", &profilerEnabled);
+			ImGui::SameLine();
+			if (ImGui::Button("Capture trace")) StartProfileCapture(TRACE_FRAMES, TRACE_PATH);
+			ImGui::EndDisabled();
+			if (IsProfileCaptureRunning()) ImGui::Text("Capturing %d frames to %s", TRACE_FRAMES, TRACE_PATH);
+
+			if (profilerEnabled and ImGui::BeginTable("Scopes", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp)) {
+				ImGui::TableSetupColumn("Scope");
+				ImGui::TableSetupColumn("ms / frame");
+				ImGui::TableSetupColumn("calls");
+				ImGui::TableHeadersRow();
+				for (const ProfileStat &stat : GetProfileStats()) {
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn(); ImGui::TextUnformatted(stat.name);
+					ImGui::TableNextColumn(); ImGui::Text("%.3f", stat.ms);
+					ImGui::TableNextColumn(); ImGui::Text("%.0f", stat.calls);
+				}
+				ImGui::EndTable();
+			}
+			if (profilerEnabled) for (const ProfileCounter &counter : GetProfileCounters()) {
+				ImGui::Text("%s: %.6g", counter.name, counter.value);
+			}
+		}
+#endif
 	}
 	ImGui::End();
 
+	//Only finalizes the draw lists, Render() draws them over the frame
 	ImGui::Render();
-	ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData(), renderer);
 }
 
-void Update() {
-	//Limiting the FPS
-	int timeToWait = renderer.MIN_MS_PER_FRAME - (SDL_GetTicks64() - renderer.msPassedUntilLastFrame);
-	if (timeToWait > 0 && timeToWait <= renderer.MIN_MS_PER_FRAME) {
-		SDL_Delay(timeToWait);
+//Pieces of ProcessFace() for the profiler, viewport mapping counts as transform
+enum FacePiece {FACE_TRANSFORM, FACE_CULLING, FACE_CLIPPING, FACE_PIECE_COUNT};
+static const char *const FACE_PIECE_NAMES[FACE_PIECE_COUNT] = {"transform", "culling", "clipping"};
+
+static bool InsideFrustum(const Vec4f &p) {
+	return std::abs(p.x) <= p.w and std::abs(p.y) <= p.w and std::abs(p.z) <= p.w;
+}
+
+//Transforms, culls, clips and screen maps one face of one instance into tris
+static void ProcessFace(const Face &face, const Mat4f &modelViewMat, const Mat4f &normalMat, uint32_t instance, uint8_t &visible, FrameArena<Triangle> &tris, GeometryStats &stats, ProfileLaps<FACE_PIECE_COUNT> &laps) {
+	stats.facesIn++;
+	Vec3f faceVertices[3] = {face.a,face.b,face.c};
+	Vec3f faceNormal = {};
+	Vec3f cameraSpaceVertices[3];
+
+	for (int i = 0; i < 3; i++) {
+		//Model space -> Camera space
+		cameraSpaceVertices[i] = Vec4MultMat4(Vec4f(faceVertices[i]), modelViewMat);
+
+		faceNormal = Vec3Cross(
+			{cameraSpaceVertices[1] - cameraSpaceVertices[0]},
+			{cameraSpaceVertices[2] - cameraSpaceVertices[0]}
+		);
+	}
+	laps.Lap(FACE_TRANSFORM);
+
+	if(renderer.backfaceCulling) {
+		//The reason for using 0,0,0 is the fact that we are now in camera space making the origin the position of the camera
+		Vec3f origin = {0,0,0};
+		Vec3f cameraRay = origin - cameraSpaceVertices[0];
+		float dot = Vec3Dot(faceNormal, cameraRay);
+		if (dot < 0) {
+			stats.facesCulled++;
+			laps.Lap(FACE_CULLING);
+			return;
+		}
+	}
+	laps.Lap(FACE_CULLING);
+	visible = 1;
+	Vec3f unitNormal = faceNormal.Normalized();
+
+	Vec3f vertexNormals[3] = {face.aNormal, face.bNormal, face.cNormal};
+	Vec3f cameraSpaceNormals[3];
+	for (int i = 0; i < 3; i++) {
+		Vec3f n = vertexNormals[i];
+		cameraSpaceNormals[i] = Vec4MultMat4({n.x, n.y, n.z, 0}, normalMat);
+	}
+
+	//Projection
+	Triangle projectedTri = {
+		.points = {
+			Vec4MultMat4(cameraSpaceVertices[0], renderer.projectionMat),
+			Vec4MultMat4(cameraSpaceVertices[1], renderer.projectionMat),
+			Vec4MultMat4(cameraSpaceVertices[2], renderer.projectionMat)
+		},
+		.texCoords = {
+			{face.aUV.u, face.aUV.v},
+			{face.bUV.u, face.bUV.v},
+			{face.cUV.u, face.cUV.v}
+		},
+		.normal = {},
+		.normals = {cameraSpaceNormals[0], cameraSpaceNormals[1], cameraSpaceNormals[2]},
+		.diffuse = {},
+		.specular = {},
+		.instance = 0
+	};
+	laps.Lap(FACE_TRANSFORM);
+	if (!InsideFrustum(projectedTri.points[0]) or !InsideFrustum(projectedTri.points[1]) or !InsideFrustum(projectedTri.points[2])) stats.facesClipped++;
+	Polygon poly = CreatePolygonFromTriangle(projectedTri);
+
+	//Frustum clipping
+	ClipPolygonAxisSide(X_AXIS, 1.0, poly);
+	ClipPolygonAxisSide(X_AXIS, -1.0, poly);
+	ClipPolygonAxisSide(Y_AXIS, 1.0, poly);
+	ClipPolygonAxisSide(Y_AXIS, -1.0, poly);
+	ClipPolygonAxisSide(Z_AXIS, 1.0, poly);
+	ClipPolygonAxisSide(Z_AXIS, -1.0, poly);
+
+	Triangle clippedTris[MAX_NUM_POLY_TRIS];
+	int clippedTrisCount = 0;
+	CreateTrisFromPolygon(poly, clippedTris, clippedTrisCount);
+	laps.Lap(FACE_CLIPPING);
+
+	for (int t = 0; t < clippedTrisCount; t++) {
+		const Triangle &baseTri = clippedTris[t];
+		Triangle triToRender;
+
+		for (int i = 0; i < 3; i++) {
+			Vec4f screenPoint = GetScreenCoords(
+				baseTri.points[i],
+				renderer.projectionMat,
+				renderer.windowWidth,
+				renderer.windowHeight,
+				false
+			);
+
+			triToRender.points[i] = screenPoint;
+		}
+
+		triToRender.texCoords[0] = baseTri.texCoords[0];
+		triToRender.texCoords[1] = baseTri.texCoords[1];
+		triToRender.texCoords[2] = baseTri.texCoords[2];
+		triToRender.normal = unitNormal;
+		triToRender.normals[0] = baseTri.normals[0];
+		triToRender.normals[1] = baseTri.normals[1];
+		triToRender.normals[2] = baseTri.normals[2];
+		triToRender.instance = instance;
+
+		tris.Push(triToRender);
 	}
+	stats.trianglesEmitted += clippedTrisCount;
+	laps.Lap(FACE_TRANSFORM);
+}
+
+//Identity order, or ascending view depth when sorting. The depths are only read when sorting.
+static void OrderByDepth(const std::vector<float> &depths, bool sort, std::vector<uint32_t> &order) {
+	static std::vector<uint32_t> keys;
+	order.resize(depths.size());
+	for (size_t i = 0; i < depths.size(); i++) order[i] = (uint32_t)i;
+	if (!sort) return;
+	keys.resize(depths.size());
+	for (size_t i = 0; i < depths.size(); i++) keys[i] = FloatToSortKey(depths[i]);
+	RadixSort(keys, order);
+}
+
+//Consecutive faces of one instance in draw order, orderedFirst is where they start in that order
+struct FaceRun {
+	uint32_t instance;
+	int firstFace;
+	int faceCount;
+	int orderedFirst;
+};
+static std::vector<FaceRun> faceRuns;
+
+//Faces in draw order per chunk. Fixed size chunks, so the split only depends on the face count.
+static const int FACE_CHUNK = 1024;
+static std::vector<FrameArena<Triangle>> faceChunkTris;
+static std::vector<GeometryStats> faceChunkStats;
+
+//Runs ProcessFace() over the first orderedFaces faces of faceRuns. Each chunk writes its own arena
+//(visibleFaces entries are per face, so those never collide), then the chunks are copied into tris
+//one after another: the triangles come out in the same order as a serial loop, for any thread count.
+static void ProcessFacesInParallel(const Mesh &mesh, const std::vector<Mat4f> &modelViewMats, const Mat4f &normalMat, int orderedFaces, FrameArena<Triangle> &tris, GeometryStats &stats) {
+	int chunkCount = (orderedFaces + FACE_CHUNK - 1) / FACE_CHUNK;
+	if ((int)faceChunkTris.size() < chunkCount) faceChunkTris.resize(chunkCount);
+	faceChunkStats.assign(chunkCount, GeometryStats{});
+
+	ParallelFor(0, orderedFaces, FACE_CHUNK, [&](int first, int last) {
+		ProfileScope chunkScope("faces");
+		FrameArena<Triangle> &chunkTris = faceChunkTris[first / FACE_CHUNK];
+		GeometryStats &chunkStats = faceChunkStats[first / FACE_CHUNK];
+		chunkTris.Reset();
+		ProfileLaps<FACE_PIECE_COUNT> laps;
+		laps.Start();
+
+		//Last run starting at or before first
+		auto run = std::upper_bound(faceRuns.begin(), faceRuns.end(), first,
+			[](int face, const FaceRun &r) { return face < r.orderedFirst; }) - 1;
+		for (int i = first; i < last; run++) {
+			int end = std::min(last, run->orderedFirst + run->faceCount);
+			const Mat4f &modelViewMat = modelViewMats[run->instance];
+			uint8_t *visibleFaces = renderer.visibleFaces.data() + mesh.faces.size() * run->instance;
+			for (; i < end; i++) {
+				int f = run->firstFace + (i - run->orderedFirst);
+				ProcessFace(mesh.faces[f], modelViewMat, normalMat, run->instance, visibleFaces[f], chunkTris, chunkStats, laps);
+			}
+		}
+		laps.Record(chunkScope.start, FACE_PIECE_NAMES);
+	});
+
+	//Ordered merge, the offsets come from the serial prefix sum
+	PROFILE_SCOPE("merge");
+	static std::vector<size_t> offsets;
+	offsets.resize(chunkCount);
+	size_t total = 0;
+	for (int c = 0; c < chunkCount; c++) {
+		offsets[c] = total;
+		total += faceChunkTris[c].size();
+		stats.facesIn += faceChunkStats[c].facesIn;
+		stats.facesCulled += faceChunkStats[c].facesCulled;
+		stats.facesClipped += faceChunkStats[c].facesClipped;
+		stats.trianglesEmitted += faceChunkStats[c].trianglesEmitted;
+	}
+	Triangle *merged = tris.Allocate(total);
+	ParallelFor(0, chunkCount, 1, [&](int first, int last) {
+		for (int c = first; c < last; c++) std::copy(faceChunkTris[c].begin(), faceChunkTris[c].end(), merged + offsets[c]);
+	});
+}
+
+//The geometry work below reads the settings and the mesh and writes only frame and visibleFaces
+//(neither of which Render() touches), so it can run as jobs while the main thread draws the previous frame.
+
+//Camera, lights and per instance transforms, everything the other parts read. Cheap, no mesh work.
+static void SetupFrameGeometry(FrameGeometry &frame) {
+	frame.stats = {};
+	frame.trisToRender.Reset();
+	frame.triangleRecords.Reset();
+	frame.linesToRender.clear();
 
 	//Setting up the worldToCameraMatrix
 	Mat4f yawMat = GetRotationMat(0, camera.yawAngle, 0);
@@ -195,162 +589,484 @@ void Update() {
 		{0,1,0}
 	);
 
-	if (renderer.showcase) {
-		// renderer.rotation = (renderer.rotation + (1 * renderer.deltaTime));
-		constexpr float TAU = 2.0f * std::numbers::pi_v<float>;
-		renderer.rotation.x = std::fmod(renderer.rotation.x + 1.0f * renderer.deltaTime, TAU);
-		renderer.rotation.y = std::fmod(renderer.rotation.y + 1.0f * renderer.deltaTime, TAU);
-		renderer.rotation.z = std::fmod(renderer.rotation.x + 1.0f * renderer.deltaTime, TAU);
-	}
-
 	//Setting up the tranformation matrices
 	Mat4f scaleMat = GetScaleMat(1, 1, 1);
 	Mat4f rotMat = GetRotationMat(renderer.rotation.x,renderer.rotation.y,renderer.rotation.z);
-	Mat4f translationMat = GetTranslationMat(0, 0, 5);
-	//Scale -> Rotate -> Translate
-	Mat4f modelMat = (scaleMat * rotMat) * translationMat;
+	//The translation comes from each instance, see below
 
-	//Transformation and projection of the model vertices
-	for (Face &face : model.mesh.faces){
-		Vec3f faceVertices[3] = {face.a,face.b,face.c};
-		Vec3f faceNormal = {};
-		Vec3f cameraSpaceVertices[3];
+	//Lights are shaded in camera space
+	frame.cameraSpaceLights.clear();
+	for (int i = 0; i < std::min(renderer.lightCount, (int)renderer.lights.size()); i++) {
+		PointLight light = renderer.lights[i];
+		light.position = Vec4MultMat4(Vec4f(light.position), worldToCameraMatrix);
+		frame.cameraSpaceLights.push_back(light);
+	}
+	DirectionalLight cameraSpaceSun = renderer.sun;
+	Vec3f sunDirection = renderer.sun.direction;
+	cameraSpaceSun.direction = Vec4MultMat4({sunDirection.x, sunDirection.y, sunDirection.z, 0}, worldToCameraMatrix);
+	SetupLightingEnvironment(frame.lightingEnvironment, cameraSpaceSun, frame.cameraSpaceLights, {0.08f, 0.08f, 0.1f}, 0.4f, 24.0f);
 
-		for (int i = 0; i < 3; i++) {
-			Vec3f v = faceVertices[i];
-			v = Vec4MultMat4(Vec4f(v), modelMat);
+	frame.sunDirection = cameraSpaceSun.direction;
+
+	//Normals only need the rotation (the scale is uniform)
+	frame.normalMat = rotMat * worldToCameraMatrix;
 
-			//World space -> Camera space
-			v = Vec4MultMat4(Vec4f(v), worldToCameraMatrix);
+	//Per instance transforms, all instances share the rotation
+	int instanceCount = std::min(renderer.instanceCount, (int)renderer.instances.size());
+	frame.modelViewMats.resize(instanceCount);
+	for (int i = 0; i < instanceCount; i++) {
+		Vec3f position = renderer.instances[i].position;
+		//Scale -> Rotate -> Translate -> World space to Camera space
+		frame.modelViewMats[i] = ((scaleMat * rotMat) * GetTranslationMat(position.x, position.y, position.z)) * worldToCameraMatrix;
+	}
+}
 
-			cameraSpaceVertices[i] = v;
+//ProcessFace() over every face of every instance, in draw order
+static void BuildFrameTriangles(FrameGeometry &frame, const Mesh *mesh) {
+	if (!mesh) return;
+	const std::vector<Mat4f> &modelViewMats = frame.modelViewMats;
+	int instanceCount = (int)modelViewMats.size();
 
-			faceNormal = Vec3Cross(
-				{cameraSpaceVertices[1] - cameraSpaceVertices[0]},
-				{cameraSpaceVertices[2] - cameraSpaceVertices[0]}
-			);
+	//Draw order: instances front to back by their origin, then within each instance its clusters
+	//front to back by the nearest point of their bounding sphere, so early depth rejection hits more often
+	size_t faceCount = mesh->faces.size();
+	renderer.visibleFaces.assign(faceCount * instanceCount, 0);
+
+	static std::vector<float> depths;
+	static std::vector<uint32_t> instanceOrder, clusterOrder;
+	depths.resize(instanceCount);
+	for (int i = 0; i < instanceCount; i++) depths[i] = Vec4MultMat4({0, 0, 0, 1}, modelViewMats[i]).z;
+	OrderByDepth(depths, renderer.sortFrontToBack, instanceOrder);
+
+	faceRuns.clear();
+	int orderedFaces = 0;
+	for (uint32_t instance : instanceOrder) {
+		const Mat4f &modelViewMat = modelViewMats[instance];
+		depths.resize(mesh->clusters.size());
+		for (size_t c = 0; c < mesh->clusters.size(); c++) {
+			const MeshCluster &cluster = mesh->clusters[c];
+			depths[c] = Vec4MultMat4(Vec4f(cluster.center), modelViewMat).z - cluster.radius;
 		}
+		OrderByDepth(depths, renderer.sortFrontToBack, clusterOrder);
 
-		if(renderer.backfaceCulling) {
-			//The reason for using 0,0,0 is the fact that we are now in camera space making the origin the position of the camera
-			Vec3f origin = {0,0,0};
-			Vec3f cameraRay = origin - cameraSpaceVertices[0];
-			float dot = Vec3Dot(faceNormal, cameraRay);
-			if (dot < 0) continue;
+		for (uint32_t c : clusterOrder) {
+			const MeshCluster &cluster = mesh->clusters[c];
+			faceRuns.push_back({instance, cluster.firstFace, cluster.faceCount, orderedFaces});
+			orderedFaces += cluster.faceCount;
 		}
+	}
 
-		//Projection
-		Triangle projectedTri = {
-			.points = {
-				Vec4MultMat4(cameraSpaceVertices[0], renderer.projectionMat),
-				Vec4MultMat4(cameraSpaceVertices[1], renderer.projectionMat),
-				Vec4MultMat4(cameraSpaceVertices[2], renderer.projectionMat)
-			},
-			.texCoords = {
-				{face.aUV.u, face.aUV.v},
-				{face.bUV.u, face.bUV.v},
-				{face.cUV.u, face.cUV.v}
-			}
-		};
-		Polygon poly = CreatePolygonFromTriangle(projectedTri);
-
-		//Frustum clipping
-		ClipPolygonAxisSide(X_AXIS, 1.0, poly);
-		ClipPolygonAxisSide(X_AXIS, -1.0, poly);
-		ClipPolygonAxisSide(Y_AXIS, 1.0, poly);
-		ClipPolygonAxisSide(Y_AXIS, -1.0, poly);
-		ClipPolygonAxisSide(Z_AXIS, 1.0, poly);
-		ClipPolygonAxisSide(Z_AXIS, -1.0, poly);
-
-		Triangle clippedTris[MAX_NUM_POLY_TRIS];
-		int clippedTrisCount = 0;
-		CreateTrisFromPolygon(poly, clippedTris, clippedTrisCount);
-
-		for (int t = 0; t < clippedTrisCount; t++) {
-			const Triangle &baseTri = clippedTris[t];
-			Triangle triToRender;
-
-			for (int i = 0; i < 3; i++) {
-				Vec4f screenPoint = GetScreenCoords(
-					baseTri.points[i],
-					renderer.projectionMat,
-					renderer.windowWidth,
-					renderer.windowHeight,
-					false
-				);
-
-				triToRender.points[i] = screenPoint;
-			}
+	ProcessFacesInParallel(*mesh, modelViewMats, frame.normalMat, orderedFaces, frame.trisToRender, frame.stats);
+}
+
+//Shadow casters are the whole mesh, not just what survived culling and clipping, so they don't
+//need BuildFrameTriangles() and can be built alongside it
+static void BuildFrameShadowCasters(FrameGeometry &frame, const Mesh *mesh) {
+	//Every path lights opaque geometry, the forward one has no lighting for transparent geometry
+	bool lit = renderer.lighting != LIGHTING_NONE and renderer.renderMode != RenderMode::NO_TEXTURE;
+	bool opaque = renderer.shadingPath != SHADING_FORWARD or renderer.transparency == TRANSPARENCY_OFF;
+	if (mesh and renderer.shadows and lit and opaque) {
+		PROFILE_SCOPE("shadow casters");
+		BuildShadowCasters(display.shadowMap.size, *mesh, frame.modelViewMats, frame.sunDirection, frame.shadowView, frame.shadowCasters);
+	} else {
+		frame.shadowCasters.clear();
+		frame.shadowView.active = false;
+	}
+}
+
+//Wireframe edges, each shared edge once. An edge is drawn if any face next to it survived culling,
+//so this goes after BuildFrameTriangles().
+static void BuildFrameEdges(FrameGeometry &frame, const Mesh *mesh) {
+	if (mesh and renderer.renderWireframe) for (int instance = 0; instance < (int)frame.modelViewMats.size(); instance++) {
+		PROFILE_SCOPE("wireframe edges");
+		const Mat4f &modelViewMat = frame.modelViewMats[instance];
+		const uint8_t *visibleFaces = renderer.visibleFaces.data() + mesh->faces.size() * instance;
+		for (const MeshEdge &edge : mesh->edges) {
+			bool visible = visibleFaces[edge.faces[0]] or
+				(edge.faces[1] >= 0 and visibleFaces[edge.faces[1]]);
+			if (!visible) continue;
 
-			triToRender.texCoords[0] = baseTri.texCoords[0];
-			triToRender.texCoords[1] = baseTri.texCoords[1];
-			triToRender.texCoords[2] = baseTri.texCoords[2];
+			Vec4f a = Vec4MultMat4(Vec4MultMat4(Vec4f(mesh->vertices[edge.vertices[0]]), modelViewMat), renderer.projectionMat);
+			Vec4f b = Vec4MultMat4(Vec4MultMat4(Vec4f(mesh->vertices[edge.vertices[1]]), modelViewMat), renderer.projectionMat);
 
-			renderer.trisToRender.push_back(triToRender);
+			if (!ClipLineAxisSide(X_AXIS, 1.0, a, b)) continue;
+			if (!ClipLineAxisSide(X_AXIS, -1.0, a, b)) continue;
+			if (!ClipLineAxisSide(Y_AXIS, 1.0, a, b)) continue;
+			if (!ClipLineAxisSide(Y_AXIS, -1.0, a, b)) continue;
+			if (!ClipLineAxisSide(Z_AXIS, 1.0, a, b)) continue;
+			if (!ClipLineAxisSide(Z_AXIS, -1.0, a, b)) continue;
+
+			frame.linesToRender.push_back({{
+				GetScreenCoords(a, renderer.projectionMat, renderer.windowWidth, renderer.windowHeight, false),
+				GetScreenCoords(b, renderer.projectionMat, renderer.windowWidth, renderer.windowHeight, false)
+			}});
 		}
-		
-		// Triangle triToRender;
-		// for (int i = 0; i < 3; i++) {
-		// 	Vec3f v = cameraSpaceVertices[i];
-		// 	//Camera space -> Raster space
-		// 	Vec4f projectedVertex = GetScreenCoords(
-		// 		v, 
-		// 		renderer.projectionMat, 
-		// 		renderer.windowWidth, 
-		// 		renderer.windowHeight
-		// 	);
-		//
-		// 	triToRender.points[i] = projectedVertex;
-		// }
-		// Triangle triToRender;
-		// triToRender.texCoords[0] = {face.aUV.u, face.aUV.v};
-		// triToRender.texCoords[1] = {face.bUV.u, face.bUV.v};
-		// triToRender.texCoords[2] = {face.cUV.u, face.cUV.v};
-		//
-		// renderer.trisToRender.push_back(triToRender);
+	}
+}
+
+//All of a frame's geometry work, one part after the other on the calling thread
+static void BuildFrameGeometry(FrameGeometry &frame, const Mesh *mesh) {
+	PROFILE_SCOPE("geometry");
+	auto buildStart = std::chrono::steady_clock::now();
+	SetupFrameGeometry(frame);
+	BuildFrameTriangles(frame, mesh);
+	BuildFrameShadowCasters(frame, mesh);
+	BuildFrameEdges(frame, mesh);
+	frame.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+}
+
+//Counts the in flight geometry jobs, Render() waits on it before handing the frame slots over. The
+//edges are chained after trianglesJob, so waiting on geometryJob covers the triangles as well.
+static JobCounter geometryJob;
+static JobCounter trianglesJob;
+
+//BuildFrameGeometry() split into jobs, geometryJob counts them. The shadow casters run alongside the
+//triangles, the edges wait for the culling results.
+static void StartFrameGeometryJobs(FrameGeometry &frame, const Mesh *mesh) {
+	SetupFrameGeometry(frame);
+	frame.buildMs = 0;
+	RunJob([&frame, mesh] { PROFILE_SCOPE("geometry"); BuildFrameTriangles(frame, mesh); }, &trianglesJob);
+	RunJob([&frame, mesh] { BuildFrameShadowCasters(frame, mesh); }, &geometryJob);
+	RunJobAfter(trianglesJob, [&frame, mesh] { BuildFrameEdges(frame, mesh); }, &geometryJob);
+}
+
+//Everything that touches SDL, ImGui, the asset slots or the settings runs here on the main thread, then
+//the geometry is built into the frame slot Render() is not drawing. With two frames in flight that is
+//a few jobs and Render() draws the previous frame's geometry meanwhile, so the image lags the input by
+//one frame. Render() waits for the jobs before returning.
+void Update() {
+	//Limiting the FPS
+	int timeToWait = renderer.MIN_MS_PER_FRAME - (SDL_GetTicks64() - renderer.msPassedUntilLastFrame);
+	if (timeToWait > 0 && timeToWait <= renderer.MIN_MS_PER_FRAME) {
+		PROFILE_SCOPE("fps limit");
+		SDL_Delay(timeToWait);
 	}
 
 	//Time passed between last and this frame. (Converted from ms to seconds)
 	renderer.deltaTime = (SDL_GetTicks64() - renderer.msPassedUntilLastFrame) / 1000.0f;
 	renderer.msPassedUntilLastFrame = SDL_GetTicks64();
+
+	{
+		PROFILE_SCOPE("imgui");
+		RunImGui(
+			renderer.rotation,
+			renderer.showcase,
+			renderer.renderMode,
+			renderer.renderWireframe,
+			renderer.antialiasedWireframe,
+			renderer.backfaceCulling,
+			renderer.sampleCount,
+			renderer.shadingPath,
+			renderer.lighting,
+			renderer.shadows,
+			renderer.depthPrepass,
+			renderer.lightCount,
+			renderer.instanceCount,
+			renderer.sortFrontToBack,
+			renderer.transparency,
+			renderer.opacity,
+			renderer.framesInFlight,
+			renderer.workerThreads,
+			renderer.frames[renderer.drawnFrame].trisToRender
+		);
+	}
+	if (renderer.sampleCount != display.multisample.sampleCount) SetSampleCount(renderer.sampleCount);
+	//Nothing is in flight between frames
+	if (renderer.workerThreads != GetJobWorkerCount()) {
+		StopJobSystem();
+		StartJobSystem(renderer.workerThreads);
+	}
+
+	if (renderer.showcase) {
+		renderer.showcaseTime += renderer.deltaTime;
+		renderer.rotation = SampleCameraPath(*FindCameraPath("turntable"), renderer.showcaseTime).rotation;
+	}
+
+	PublishLoadedAssets();
+	const Mesh *mesh = GetMesh(model.mesh);
+
+	int buildFrame = renderer.drawnFrame ^ 1;
+	FrameGeometry &frame = renderer.frames[buildFrame];
+	if (renderer.framesInFlight > 1) {
+		StartFrameGeometryJobs(frame, mesh);
+	} else {
+		BuildFrameGeometry(frame, mesh);
+		renderer.drawnFrame = buildFrame;
+	}
 }
 
-void Render() {
-	DrawGrid(10);
+//Gouraud lighting for every corner of the frame's triangles in one batch, so ShadePoints() can
+//run four corners at a time out of flat arrays instead of one corner per call
+static void LightTrianglesPerVertex(FrameArena<Triangle> &tris, const LightingEnvironment &env, const ShadowMap &shadowMap) {
+	int count = (int)tris.size() * 3;
+	static std::vector<float> attributes;
+	attributes.resize((size_t)count * 13);
+	float *px = attributes.data();  float *py = px + count;  float *pz = py + count;
+	float *nx = pz + count;         float *ny = nx + count;  float *nz = ny + count;
+	float *dr = nz + count;         float *dg = dr + count;  float *db = dg + count;
+	float *sr = db + count;         float *sg = sr + count;  float *sb = sg + count;
+	float *visibility = sb + count;
 
-	for (Triangle &tri : renderer.trisToRender) {
-		switch (renderer.renderMode) {
-		case RenderMode::NO_TEXTURE: break;
-		case RenderMode::FILLED: DrawFilledTriangle(tri, 0xFFFFFFFF); break;
-		case RenderMode::TEXTURED: DrawTexturedTriangle(tri, model.meshTexture);
+	//Vertices are independent, chunks hold whole triangles and a multiple of the SIMD width
+	ParallelFor(0, count, 3072, [&](int first, int last) {
+		for (int i = first; i < last; i++) {
+			const Triangle &tri = tris[i / 3];
+			Vec3f position = GetViewCoords(tri.points[i % 3], renderer.projectionMat, renderer.windowWidth, renderer.windowHeight);
+			Vec3f normal = tri.normals[i % 3];
+			normal = normal.Normalized();
+			px[i] = position.x; py[i] = position.y; pz[i] = position.z;
+			nx[i] = normal.x; ny[i] = normal.y; nz[i] = normal.z;
+			visibility[i] = SampleShadow(shadowMap, position);
 		}
 
-		if (renderer.renderWireframe) { DrawTriangle(tri, 0xFF00FF00); }
+		ShadePoints(env, last - first, px + first, py + first, pz + first, nx + first, ny + first, nz + first,
+			dr + first, dg + first, db + first, sr + first, sg + first, sb + first, visibility + first);
+
+		for (int i = first; i < last; i++) {
+			Triangle &tri = tris[i / 3];
+			tri.diffuse[i % 3] = {dr[i], dg[i], db[i]};
+			tri.specular[i % 3] = {sr[i], sg[i], sb[i]};
+		}
+	});
+}
+
+//Adds the time since the previous lap to a stage of renderer.stageMs, and to the profiler while it is on
+struct StageTimer {
+	std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+	uint64_t lastEvent = profilerEnabled ? ProfileNow() : 0;
+	void Lap(FrameStage stage) {
+		auto now = std::chrono::steady_clock::now();
+		renderer.stageMs[stage] += std::chrono::duration<double, std::milli>(now - last).count();
+		last = now;
+		if (lastEvent) {
+			uint64_t eventNow = ProfileNow();
+			RecordProfileEvent(FRAME_STAGE_NAMES[stage], lastEvent, eventNow);
+			lastEvent = eventNow;
+		}
 	}
+};
 
-	renderer.trisToRender.clear();
+//Counters of the frame just drawn. Pixel counts come from the forward rasterizers only.
+static void SetFrameCounters(const FrameGeometry &frame) {
+	if (!profilerEnabled) return;
+	SetProfileCounter("triangles in", frame.stats.facesIn);
+	SetProfileCounter("triangles culled", frame.stats.facesCulled);
+	SetProfileCounter("triangles clipped", frame.stats.facesClipped);
+	SetProfileCounter("triangles emitted", frame.stats.trianglesEmitted);
+	SetProfileCounter("pixels tested", (double)(rasterStats.pixelsShaded + rasterStats.pixelsRejected));
+	SetProfileCounter("pixels passed", (double)rasterStats.pixelsShaded);
+	SetProfileCounter("overdraw", rasterStats.pixelsCovered ? (double)rasterStats.pixelsShaded / rasterStats.pixelsCovered : 0.0);
+}
 
-	RenderColorBuffer();
+//Returns the shadow map the lit shading samples, null without shadows
+static const ShadowMap *RenderFrameShadowMap(const FrameGeometry &frame, StageTimer &timer) {
+	display.shadowMap.view = frame.shadowView;
+	timer.Lap(STAGE_RASTER);
+	if (display.shadowMap.view.active) RenderShadowMap(display.shadowMap, frame.shadowCasters);
+	timer.Lap(STAGE_SHADOWS);
+	return display.shadowMap.view.active ? &display.shadowMap : nullptr;
+}
 
-	RunImGui(
-		renderer.sdlRenderer,
-		renderer.rotation,
-		renderer.showcase,
-		renderer.renderMode,
-		renderer.renderWireframe,
-		renderer.backfaceCulling
-	);
+//Shadow map and, for Gouraud, the per vertex lighting of a lit frame
+static const ShadowMap *PrepareLighting(FrameGeometry &frame, StageTimer &timer) {
+	const ShadowMap *shadows = RenderFrameShadowMap(frame, timer);
+	if (renderer.lighting == LIGHTING_GOURAUD) {
+		PROFILE_SCOPE("vertex lighting");
+		LightTrianglesPerVertex(frame.trisToRender, frame.lightingEnvironment, display.shadowMap);
+	}
+	return shadows;
+}
 
-	SDL_RenderPresent(renderer.sdlRenderer);
+//Calls draw with the opaque shader the settings pick, one pipeline instantiation per mode. The
+//forward and visibility paths shade with the same one, so they light and texture alike.
+template<class Draw>
+static void WithOpaqueShader(const Texture *texture, const LightingEnvironment *environment, const ShadowMap *shadows, const Draw &draw) {
+	if (renderer.renderMode == RenderMode::NO_TEXTURE) return;
+	bool textured = renderer.renderMode == RenderMode::TEXTURED and texture;
+	if (renderer.lighting == LIGHTING_GOURAUD) {
+		if (textured) draw(GouraudShader<true>{texture});
+		else draw(GouraudShader<false>{nullptr});
+	} else if (renderer.lighting == LIGHTING_PHONG) {
+		if (textured) draw(PhongShader<true>{texture, environment, shadows});
+		else draw(PhongShader<false>{nullptr, environment, shadows});
+	} else {
+		if (textured) draw(TextureShader{texture});
+		else draw(FlatColorShader{0xFFFFFFFF});
+	}
+}
+
+//Rasterizes frame into the color buffer, ready to present
+static void DrawFrame(FrameGeometry &frame, const Texture *texture) {
+	for (double &ms : renderer.stageMs) ms = 0;
+	StageTimer timer;
 	ClearColorBuffer(0xFF000000); //Clear with black
 	ClearZBuffer();
+	ClearGBuffer(display.gbuffer);
+	ClearVisibilityBuffer(display.visibility);
+	ClearOitBuffer(display.oit);
+
+	rasterStats = {};
+	DrawGrid(10);
+	timer.Lap(STAGE_CLEAR);
+
+	//Frames with more triangles than the visibility IDs can tell apart are shaded forward instead
+	ShadingPath shadingPath = renderer.shadingPath;
+	if (shadingPath == SHADING_VISIBILITY and !FitsVisibilityIds(frame.trisToRender.size())) shadingPath = SHADING_FORWARD;
+
+	//Setup once into compact records, every pass below streams those instead of full triangles
+	const Triangle *tris = frame.trisToRender.data();
+	size_t triCount = frame.trisToRender.size();
+	TriangleRecord *records = frame.triangleRecords.Allocate(triCount);
+	if (renderer.renderMode != RenderMode::NO_TEXTURE) SetupTriangleRecords(tris, triCount, records);
+
+	bool lit = renderer.lighting != LIGHTING_NONE and renderer.renderMode != RenderMode::NO_TEXTURE;
+	if (shadingPath == SHADING_VISIBILITY) {
+		if (renderer.renderMode != RenderMode::NO_TEXTURE) {
+			//IDs first, banded like the forward passes, then every visible pixel is shaded once
+			DrawTrianglesWithShader(tris, records, triCount, VisibilityShader{tris});
+			const ShadowMap *shadows = lit ? PrepareLighting(frame, timer) : nullptr;
+			PROFILE_SCOPE("shade");
+			WithOpaqueShader(texture, &frame.lightingEnvironment, shadows, [&](const auto &shader) {
+				ShadeVisibilityBuffer(tris, records, triCount, shader);
+			});
+		}
+	}
+	else if (shadingPath == SHADING_DEFERRED) {
+		//Geometry pass, then one lighting pass over the visible pixels
+		if (renderer.renderMode != RenderMode::NO_TEXTURE) {
+			const Texture *albedoTexture = renderer.renderMode == RenderMode::TEXTURED ? texture : nullptr;
+			if (albedoTexture) DrawTrianglesWithShader(tris, records, triCount, GBufferShader<true>{albedoTexture, 0xFFFFFFFF});
+			else DrawTrianglesWithShader(tris, records, triCount, GBufferShader<false>{nullptr, 0xFFFFFFFF});
+			const ShadowMap *shadows = lit ? RenderFrameShadowMap(frame, timer) : nullptr;
+			PROFILE_SCOPE("shade");
+			ShadeGBuffer(
+				display.gbuffer,
+				display.colorBuffer,
+				lit ? &frame.lightingEnvironment : nullptr,
+				shadows,
+				renderer.projectionMat.data[0][0],
+				renderer.projectionMat.data[1][1]
+			);
+		}
+	}
+	else if (renderer.transparency == TRANSPARENCY_OFF) {
+		bool textured = renderer.renderMode == RenderMode::TEXTURED and texture;
+
+		//Depth prepass: resolve visibility first so the shading pass runs once per covered pixel
+		DepthMode depthMode = DEPTH_TEST_WRITE;
+		if (renderer.depthPrepass and (lit or textured)) {
+			DrawTrianglesDepthOnly(display.depthBuffer, records, triCount);
+			depthMode = DEPTH_TEST_EQUAL;
+		}
+
+		const ShadowMap *shadows = lit ? PrepareLighting(frame, timer) : nullptr;
+		WithOpaqueShader(texture, &frame.lightingEnvironment, shadows, [&](const auto &shader) {
+			DrawTrianglesWithShader(tris, records, triCount, shader, depthMode);
+		});
+		rasterStats.pixelsCovered = CountCoveredPixels();
+	}
+
+	timer.Lap(STAGE_RASTER);
+	ResolveSamples();
+	timer.Lap(STAGE_RESOLVE);
+
+	//Transparent geometry goes over the resolved opaque image
+	if (shadingPath == SHADING_FORWARD and renderer.transparency != TRANSPARENCY_OFF and renderer.renderMode != RenderMode::NO_TEXTURE) {
+		const Texture *albedoTexture = renderer.renderMode == RenderMode::TEXTURED ? texture : nullptr;
+		OitBuffer *oit = renderer.transparency == TRANSPARENCY_OIT ? &display.oit : nullptr;
+		if (albedoTexture) DrawTrianglesWithShader(tris, records, triCount, TransparentShader<true>{albedoTexture, 0xFFFFFFFF, renderer.opacity, oit}, DEPTH_TEST_READ);
+		else DrawTrianglesWithShader(tris, records, triCount, TransparentShader<false>{nullptr, 0xFFFFFFFF, renderer.opacity, oit}, DEPTH_TEST_READ);
+		if (oit) ResolveOitBuffer(*oit, display.colorBuffer);
+	}
+	if (renderer.renderWireframe) DrawLines(frame.linesToRender, 0xFF00FF00, renderer.antialiasedWireframe);
+	timer.Lap(STAGE_OVERLAYS);
+	SetFrameCounters(frame);
+}
+
+//Draws the newest finished geometry. The buffers are cleared here rather than after presenting, so
+//the UI built in Update() can still pick from the visibility buffer of the frame just drawn.
+//With two frames in flight the color buffers are double buffered too: the previous frame's image is
+//resolved for presenting while this one is drawn, and goes on screen at the end of this call. That
+//is one more frame of latency, on top of the geometry's.
+void Render() {
+	JobCounter resolveJob;
+	bool overlapPresent = renderer.framesInFlight > 1;
+	if (overlapPresent) {
+		std::swap(display.colorBuffer, display.presentBuffer);
+		ResolveColorBufferAsync(display.presentBuffer, resolveJob);
+	}
+
+	DrawFrame(renderer.frames[renderer.drawnFrame], GetTexture(model.texture));
+
+	{
+		PROFILE_SCOPE("present");
+		if (overlapPresent) CopyResolvedColorBuffer(resolveJob);
+		else RenderColorBuffer();
+		{
+			PROFILE_SCOPE("imgui draw");
+			ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData(), renderer.sdlRenderer);
+		}
+		SDL_RenderPresent(renderer.sdlRenderer);
+	}
+	EndAssetFrame();
+
+	if (renderer.framesInFlight > 1) {
+		PROFILE_SCOPE("geometry wait");
+		WaitForJobs(geometryJob);
+		renderer.drawnFrame ^= 1;
+	}
+	EndProfileFrame();
+}
+
+//Builds and draws one frame on the calling thread (its parallel passes still use the job system).
+//Nothing is presented, the image is left in display.colorBuffer.
+void RenderHeadless(const Mesh *mesh, const Texture *texture) {
+	FrameGeometry &frame = renderer.frames[renderer.drawnFrame];
+	BuildFrameGeometry(frame, mesh);
+	DrawFrame(frame, texture);
+	EndAssetFrame();
+	EndProfileFrame();
+}
+
+//RenderHeadless() over a sequence of frames, overlapped the way Update() and Render() run two frames
+//in flight: frame i + 1's geometry is built by jobs while frame i is drawn. setup(i) changes the
+//settings for frame i before its geometry is built, drawn(i) finds frame i's image in
+//display.colorBuffer.
+void RenderHeadlessInFlight(const Mesh *mesh, const Texture *texture, int frameCount, const std::function<void(int)> &setup, const std::function<void(int)> &drawn) {
+	if (frameCount <= 0) return;
+	setup(0);
+	BuildFrameGeometry(renderer.frames[renderer.drawnFrame], mesh);
+	for (int i = 0; i < frameCount; i++) {
+		bool buildNext = i + 1 < frameCount;
+		if (buildNext) {
+			setup(i + 1);
+			StartFrameGeometryJobs(renderer.frames[renderer.drawnFrame ^ 1], mesh);
+		}
+		DrawFrame(renderer.frames[renderer.drawnFrame], texture);
+		EndAssetFrame();
+		drawn(i);
+		if (buildNext) {
+			WaitForJobs(geometryJob);
+			renderer.drawnFrame ^= 1;
+		}
+		EndProfileFrame();
+	}
 }
 
 void CleanUp() {
-	UnloadObjFile(model.mesh);
-	UnloadPngTexture(model);
-	delete[] display.colorBuffer;
-	delete[] display.zBuffer;
+	StopJobSystem();
+	StopAssetLoaders();
+	ReleaseMesh(model.mesh);
+	ReleaseTexture(model.texture);
+	DestroyColorBuffer(display.colorBuffer);
+	DestroyColorBuffer(display.presentBuffer);
+	DestroyDepthBuffer(display.depthBuffer);
+	DestroyMultisampleBuffer(display.multisample);
+	DestroyGBuffer(display.gbuffer);
+	DestroyVisibilityBuffer(display.visibility);
+	DestroyShadowMap(display.shadowMap);
+	DestroyOitBuffer(display.oit);
+	if (renderer.headless) return;
 	SDL_DestroyTexture(renderer.sdlColorBufferTexture);
 	SDL_DestroyRenderer(renderer.sdlRenderer);
 	SDL_DestroyWindow(renderer.sdlWindow);
@@ -1,8 +1,16 @@
 #pragma once
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include <SDL.h>
+#include "arena.h"
+#include "deferred.h"
+#include "framebuffer.h"
+#include "lighting.h"
 #include "linear_algebra.h"
 #include "model.h"
+#include "raster.h"
+#include "shadow.h"
 
 enum RenderMode {
 	TEXTURED,
@@ -10,6 +18,67 @@ enum RenderMode {
 	NO_TEXTURE
 };
 
+//How the triangles are turned into pixels
+enum ShadingPath {
+	SHADING_FORWARD,    //Shade while rasterizing
+	SHADING_DEFERRED,   //G-buffer + tiled lighting
+	SHADING_VISIBILITY  //Triangle IDs + one shading pass over the visible pixels
+};
+
+enum LightingMode {
+	LIGHTING_NONE,
+	LIGHTING_GOURAUD, //Per vertex
+	LIGHTING_PHONG    //Per pixel
+};
+
+enum TransparencyMode {
+	TRANSPARENCY_OFF,
+	TRANSPARENCY_BLEND, //Blended in submission order
+	TRANSPARENCY_OIT    //Per pixel fragment lists, sorted at resolve
+};
+
+struct Instance {
+	Vec3f position;
+};
+
+//Face counters of one geometry build
+struct GeometryStats {
+	uint32_t facesIn;           //Faces of every drawn instance
+	uint32_t facesCulled;       //Back facing
+	uint32_t facesClipped;      //Crossed a frustum plane, including the ones clipped away entirely
+	uint32_t trianglesEmitted;  //Into trisToRender, clipping can turn one face into several
+};
+
+//Everything Update() produces for one frame and Render() consumes. There are two so that, with
+//two frames in flight, a geometry job can fill one while the main thread draws the other.
+struct FrameGeometry {
+	FrameArena<Triangle> trisToRender; //Rewound, not freed, when the frame is rebuilt
+	FrameArena<TriangleRecord> triangleRecords; //One per trisToRender entry, set up by Render() for every pass
+	std::vector<Line> linesToRender;
+	std::vector<PointLight> cameraSpaceLights; //The first lightCount lights
+	LightingEnvironment lightingEnvironment; //Camera space
+	std::vector<Triangle> shadowCasters; //Shadow map raster space
+	ShadowView shadowView;
+	std::vector<Mat4f> modelViewMats; //Per instance
+	Mat4f normalMat;
+	Vec3f sunDirection; //Camera space
+	double buildMs; //Wall time BuildFrameGeometry() took, 0 when Update() splits the build into jobs
+	GeometryStats stats;
+};
+
+const int MAX_FRAMES_IN_FLIGHT = 2;
+
+//Parts of drawing a frame, timed every frame. The stages of one frame add up to its draw time.
+enum FrameStage {
+	STAGE_CLEAR,    //Buffer clears and the grid
+	STAGE_SHADOWS,  //Shadow map
+	STAGE_RASTER,   //Main pass, including the depth prepass and deferred or visibility shading
+	STAGE_RESOLVE,  //MSAA resolve
+	STAGE_OVERLAYS, //Transparent geometry and wireframe
+	STAGE_COUNT
+};
+extern const char *FRAME_STAGE_NAMES[STAGE_COUNT];
+
 struct Renderer{
 	const int MAX_FPS;
 	const int MIN_MS_PER_FRAME;
@@ -19,20 +88,48 @@ struct Renderer{
 	SDL_Renderer* sdlRenderer;
 	int windowWidth;
 	int windowHeight;
+	PixelFormat colorFormat;
+	DepthFormat depthFormat;
+	int sampleCount; //MSAA samples per pixel: 1 (off), 2, 4 or 8
 	SDL_Texture* sdlColorBufferTexture;
-	std::vector<Triangle> trisToRender;
+	bool headless; //No window, UI or loader threads: frames are drawn with RenderHeadless() and read back
+	FrameGeometry frames[MAX_FRAMES_IN_FLIGHT];
+	int drawnFrame; //Index into frames of the newest finished geometry, the one Render() draws
+	//1 (default): Update() then Render(). 2: the next frame's geometry is built and the last image is
+	//presented while this one is drawn, at two frames more latency.
+	int framesInFlight;
+	int workerThreads; //Job system threads besides the main thread, -1 picks one per extra core at Setup()
+	std::vector<uint8_t> visibleFaces; //Per mesh face, filled during Update() for the wireframe pass
 	bool renderWireframe;
+	bool antialiasedWireframe;
 	RenderMode renderMode;
 	Mat4f projectionMat;
 	bool backfaceCulling;
 	Vec3f rotation;
-	bool showcase;
+	bool showcase; //Plays the turntable camera path
+	float showcaseTime; //Seconds into the path
+	ShadingPath shadingPath;
+	std::vector<PointLight> lights; //World space
+	int lightCount;
+	LightingMode lighting; //Forward path only
+	DirectionalLight sun; //World space
+	bool shadows; //Sun shadows for the lit forward path
+	bool depthPrepass; //Forward path: depth only pass, then shade with a depth equal test
+	std::vector<Instance> instances; //World space placements of the model, the first instanceCount are drawn
+	int instanceCount;
+	bool sortFrontToBack; //Instances, then clusters within each instance, by view depth
+	TransparencyMode transparency; //Forward path: draws the model transparent, unlit
+	float opacity; //Multiplies the texture's alpha
+	double stageMs[STAGE_COUNT]; //Wall time per stage of the last drawn frame
 };
 extern Renderer renderer;
 
 bool InitWindow();
 void Setup();
+void SetupHeadless(int width, int height);
 void ProcessInput(bool &isRunning);
 void Update();
 void Render();
+void RenderHeadless(const Mesh *mesh, const Texture *texture);
+void RenderHeadlessInFlight(const Mesh *mesh, const Texture *texture, int frameCount, const std::function<void(int)> &setup, const std::function<void(int)> &drawn);
 void CleanUp();
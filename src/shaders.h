@@ -0,0 +1,206 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include "deferred.h"
+#include "lighting.h"
+#include "model.h"
+#include "oit.h"
+#include "pipeline.h"
+#include "shadow.h"
+#include "texture.h"
+#include "visibility.h"
+
+//Built in shaders for the raster pipeline (see pipeline.h)
+
+//Wrapping, point sampled texture lookup
+inline uint32_t SampleWrapped(const Texture &texture, float u, float v) {
+	int textureX = abs((int)(u * texture.width)) % texture.width;
+	int textureY = abs((int)(v * texture.height)) % texture.height;
+	return SampleTexel(texture, textureX, textureY);
+}
+
+//Constant color, no depth test (the original "Filled" mode)
+struct FlatColorShader {
+	static constexpr int VARYINGS = 0;
+	static constexpr bool DEPTH_TEST = false;
+	uint32_t color;
+
+	void Vertex(const Triangle&, int, Varyings<VARYINGS>&) const {}
+	uint32_t Pixel(const Varyings<VARYINGS>&) const { return color; }
+};
+
+//Perspective correct, wrapping, point sampled texture
+struct TextureShader {
+	static constexpr int VARYINGS = 2; //u, v
+	static constexpr bool DEPTH_TEST = true;
+	const Texture *texture;
+
+	void Vertex(const Triangle &tri, int vertex, Varyings<VARYINGS> &out) const {
+		out.v[0] = tri.texCoords[vertex].u;
+		out.v[1] = tri.texCoords[vertex].v;
+	}
+	uint32_t Pixel(const Varyings<VARYINGS> &in) const {
+		return SampleWrapped(*texture, in.v[0], in.v[1]);
+	}
+};
+
+//Unclamped, so HDR color buffers accumulate the full range and the resolve tone maps it
+inline Float4 LitColor(Vec3f albedo, const Vec3f &diffuse, const Vec3f &specular) {
+	Vec3f c = albedo * diffuse + specular;
+	return {c.x, c.y, c.z, 1.0f};
+}
+
+//Gouraud: lighting was evaluated per vertex (see Triangle::diffuse/specular), only interpolated here
+template<bool TEXTURED>
+struct GouraudShader {
+	static constexpr int VARYINGS = TEXTURED ? 8 : 6; //diffuse rgb, specular rgb, [u, v]
+	static constexpr bool DEPTH_TEST = true;
+	const Texture *texture;
+
+	void Vertex(const Triangle &tri, int vertex, Varyings<VARYINGS> &out) const {
+		const Vec3f &diffuse = tri.diffuse[vertex];
+		const Vec3f &specular = tri.specular[vertex];
+		out.v[0] = diffuse.x; out.v[1] = diffuse.y; out.v[2] = diffuse.z;
+		out.v[3] = specular.x; out.v[4] = specular.y; out.v[5] = specular.z;
+		if constexpr (TEXTURED) {
+			out.v[6] = tri.texCoords[vertex].u;
+			out.v[7] = tri.texCoords[vertex].v;
+		}
+	}
+	Float4 Pixel(const Varyings<VARYINGS> &in) const {
+		Vec3f albedo = Vec3f(1.0f);
+		if constexpr (TEXTURED) albedo = UnpackAlbedo(SampleWrapped(*texture, in.v[6], in.v[7]));
+		return LitColor(albedo, Vec3f(in.v[0], in.v[1], in.v[2]), Vec3f(in.v[3], in.v[4], in.v[5]));
+	}
+};
+
+//Phong: the normal and camera space position are interpolated and lit per pixel
+template<bool TEXTURED>
+struct PhongShader {
+	static constexpr int VARYINGS = TEXTURED ? 8 : 6; //normal xyz, camera space position xyz, [u, v]
+	static constexpr bool DEPTH_TEST = true;
+	const Texture *texture;
+	const LightingEnvironment *environment;
+	const ShadowMap *shadows; //Null when shadows are off
+
+	void Vertex(const Triangle &tri, int vertex, Varyings<VARYINGS> &out) const {
+		const Vec3f &normal = tri.normals[vertex];
+		Vec3f position = GetViewCoords(tri.points[vertex], renderer.projectionMat, renderer.windowWidth, renderer.windowHeight);
+		out.v[0] = normal.x; out.v[1] = normal.y; out.v[2] = normal.z;
+		out.v[3] = position.x; out.v[4] = position.y; out.v[5] = position.z;
+		if constexpr (TEXTURED) {
+			out.v[6] = tri.texCoords[vertex].u;
+			out.v[7] = tri.texCoords[vertex].v;
+		}
+	}
+	Float4 Pixel(const Varyings<VARYINGS> &in) const {
+		Vec3f normal = Vec3f(in.v[0], in.v[1], in.v[2]).Normalized();
+		Vec3f position = Vec3f(in.v[3], in.v[4], in.v[5]);
+		float sunVisibility = shadows ? SampleShadow(*shadows, position) : 1.0f;
+		LightSample light = ShadePoint(*environment, position, normal, sunVisibility);
+		Vec3f albedo = Vec3f(1.0f);
+		if constexpr (TEXTURED) albedo = UnpackAlbedo(SampleWrapped(*texture, in.v[6], in.v[7]));
+		return LitColor(albedo, light.diffuse, light.specular);
+	}
+};
+
+//Transparent pass, drawn over the resolved opaque image with DEPTH_TEST_READ: the opaque geometry
+//occludes and nothing transparent writes depth. Alpha is the texel's (or color's) alpha times opacity.
+//Fragments are blended straight into the color buffer in submission order, or appended to the OIT
+//lists for ResolveOitBuffer() when oit is set.
+template<bool TEXTURED>
+struct TransparentShader {
+	static constexpr int VARYINGS = TEXTURED ? 2 : 0; //[u, v]
+	static constexpr bool DEPTH_TEST = true;
+	const Texture *texture;
+	uint32_t color; //Untextured
+	float opacity;
+	OitBuffer *oit;
+
+	void Vertex(const Triangle &tri, int vertex, Varyings<VARYINGS> &out) const {
+		if constexpr (TEXTURED) {
+			out.v[0] = tri.texCoords[vertex].u;
+			out.v[1] = tri.texCoords[vertex].v;
+		}
+	}
+	uint32_t Pixel(const Varyings<VARYINGS> &in) const {
+		uint32_t texel = color;
+		if constexpr (TEXTURED) texel = SampleWrapped(*texture, in.v[0], in.v[1]);
+		uint32_t alpha = (uint32_t)((texel >> 24) * opacity + 0.5f);
+		return (texel & 0x00FFFFFF) | (alpha << 24);
+	}
+	void MaterializeTarget(int xMin, int yMin, int xMax, int yMax) const {
+		if (oit) MaterializeOitRect(*oit, xMin, yMin, xMax, yMax);
+		else MaterializeColorRect(display.colorBuffer, xMin, yMin, xMax, yMax);
+	}
+	void Output(int index, float reciprocalW, uint32_t, uint32_t fragment) const {
+		uint32_t alpha = fragment >> 24;
+		if (alpha == 0) return;
+		if (oit) {
+			AppendOitFragment(*oit, index, fragment, reciprocalW);
+			return;
+		}
+		Float4 dst = LoadColor(display.colorBuffer, index);
+		float a = alpha / 255.0f;
+		StoreColorHDR(
+			display.colorBuffer, index,
+			dst.r + ((fragment & 0xFF) / 255.0f - dst.r) * a,
+			dst.g + (((fragment >> 8) & 0xFF) / 255.0f - dst.g) * a,
+			dst.b + (((fragment >> 16) & 0xFF) / 255.0f - dst.b) * a,
+			1.0f
+		);
+	}
+};
+
+//ID pass of the visibility path: depth and which triangle won, no color. Single sampled, into
+//display.visibility; ShadeVisibilityBuffer() shades the winners afterwards.
+struct VisibilityShader {
+	static constexpr int VARYINGS = 0;
+	static constexpr bool DEPTH_TEST = true;
+	const Triangle *tris; //The batch being drawn, for the instance half of the ID
+
+	void Vertex(const Triangle&, int, Varyings<VARYINGS>&) const {}
+	uint32_t Pixel(const Varyings<VARYINGS>&) const { return 0; }
+	void MaterializeTarget(int xMin, int yMin, int xMax, int yMax) const {
+		MaterializeVisibilityRect(display.visibility, xMin, yMin, xMax, yMax);
+	}
+	void Output(int index, float, uint32_t triangle, uint32_t) const {
+		display.visibility.ids[index] = PackVisibilityId(tris[triangle].instance, triangle);
+	}
+};
+
+//What the geometry pass stores per pixel
+struct GBufferTexel {
+	uint32_t normal; //EncodeNormal()
+	uint32_t albedo;
+};
+
+//Geometry pass of the deferred path: the closest surface's interpolated normal and albedo go to the
+//G-buffer instead of a color, ShadeGBuffer() lights them afterwards. Single sampled, into display.gbuffer.
+template<bool TEXTURED>
+struct GBufferShader {
+	static constexpr int VARYINGS = TEXTURED ? 5 : 3; //normal xyz, [u, v]
+	static constexpr bool DEPTH_TEST = true;
+	const Texture *texture;
+	uint32_t color; //Untextured
+
+	void Vertex(const Triangle &tri, int vertex, Varyings<VARYINGS> &out) const {
+		const Vec3f &normal = tri.normals[vertex];
+		out.v[0] = normal.x; out.v[1] = normal.y; out.v[2] = normal.z;
+		if constexpr (TEXTURED) {
+			out.v[3] = tri.texCoords[vertex].u;
+			out.v[4] = tri.texCoords[vertex].v;
+		}
+	}
+	GBufferTexel Pixel(const Varyings<VARYINGS> &in) const {
+		uint32_t albedo = color;
+		if constexpr (TEXTURED) albedo = SampleWrapped(*texture, in.v[3], in.v[4]);
+		return {EncodeNormal(Vec3f(in.v[0], in.v[1], in.v[2]).Normalized()), albedo};
+	}
+	void MaterializeTarget(int xMin, int yMin, int xMax, int yMax) const {
+		MaterializeGBufferRect(display.gbuffer, xMin, yMin, xMax, yMax);
+	}
+	void Output(int index, float reciprocalW, uint32_t, const GBufferTexel &texel) const {
+		WriteGBuffer(display.gbuffer, index, reciprocalW, texel.normal, texel.albedo, MATERIAL_DEFAULT);
+	}
+};
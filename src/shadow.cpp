@@ -0,0 +1,107 @@
+#include "shadow.h"
+#include <algorithm>
+#include <cmath>
+#include "pipeline.h"
+
+ShadowMap CreateShadowMap(int size) {
+	return {
+		.size = size,
+		.depth = CreateDepthBuffer(DEPTH_F32, size, size, 1, 1.0f),
+		.view = {},
+	};
+}
+
+void DestroyShadowMap(ShadowMap &shadowMap) {
+	DestroyDepthBuffer(shadowMap.depth);
+	shadowMap.view.active = false;
+}
+
+void BuildShadowCasters(int shadowMapSize, const Mesh &mesh, const std::vector<Mat4f> &modelViewMats, const Vec3f &sunDirection, ShadowView &view, std::vector<Triangle> &casters) {
+	casters.clear();
+	view.active = false;
+	if (mesh.vertices.empty() or modelViewMats.empty()) return;
+
+	//Camera space bounding sphere of all instances, box center and farthest vertex from it
+	static std::vector<Vec3f> positions;
+	size_t vertexCount = mesh.vertices.size();
+	positions.resize(vertexCount * modelViewMats.size());
+	Vec3f boundsMin = Vec3f(1e30f);
+	Vec3f boundsMax = Vec3f(-1e30f);
+	for (size_t instance = 0; instance < modelViewMats.size(); instance++) {
+		for (size_t i = 0; i < vertexCount; i++) {
+			Vec3f p = Vec4MultMat4(Vec4f(mesh.vertices[i]), modelViewMats[instance]);
+			positions[instance * vertexCount + i] = p;
+			boundsMin = {std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z)};
+			boundsMax = {std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z)};
+		}
+	}
+	Vec3f center = (boundsMin + boundsMax) * 0.5f;
+	float radius = 0;
+	for (Vec3f &p : positions) {
+		Vec3f d = p - center;
+		radius = std::max(radius, Vec3Dot(d, d));
+	}
+	radius = std::sqrt(radius) + 1e-3f;
+
+	//The sphere fits in the frustum and between the planes, so the casters never need clipping
+	Vec3f toLight = Vec3f(sunDirection).Normalized();
+	float distance = radius * 3.0f;
+	Vec3f eye = center + toLight * distance;
+	Vec3f up = std::abs(toLight.y) > 0.99f ? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+	float fov = 2.0f * std::asin(radius / distance);
+	Mat4f lightView = GetLookAtMat(eye, center, up);
+	Mat4f lightProjection = GetPerspectiveMat(fov, shadowMapSize, shadowMapSize, distance - radius * 1.01f, distance + radius * 1.01f);
+	view.cameraToLight = lightView * lightProjection;
+	view.bias = 2.0f * (2.0f * radius / shadowMapSize);
+
+	static std::vector<Vec4f> rasterPositions;
+	rasterPositions.resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		Vec3f p = positions[i];
+		Vec4f clip = Vec4MultMat4({p.x, p.y, p.z, 1}, view.cameraToLight);
+		rasterPositions[i] = GetScreenCoords(clip, {}, shadowMapSize, shadowMapSize, false);
+	}
+
+	casters.reserve(mesh.faces.size() * modelViewMats.size());
+	for (size_t instance = 0; instance < modelViewMats.size(); instance++) {
+		const Vec4f *instancePositions = rasterPositions.data() + instance * vertexCount;
+		for (size_t f = 0; f < mesh.faces.size(); f++) {
+			Triangle tri = {};
+			for (int k = 0; k < 3; k++) tri.points[k] = instancePositions[mesh.indices[f * 3 + k]];
+			//Back faces cast shadows too, they just need the rasterizer's winding
+			if (Vec2Cross(Vec2f(tri.points[1] - tri.points[0]), Vec2f(tri.points[2] - tri.points[0])) < 0) std::swap(tri.points[1], tri.points[2]);
+			tri.instance = (uint32_t)instance;
+			casters.push_back(tri);
+		}
+	}
+	view.active = true;
+}
+
+void RenderShadowMap(ShadowMap &shadowMap, const std::vector<Triangle> &casters) {
+	FastClearDepthBuffer(shadowMap.depth);
+	DrawTrianglesDepthOnly(shadowMap.depth, casters);
+}
+
+float SampleShadow(const ShadowMap &shadowMap, const Vec3f &position) {
+	if (!shadowMap.view.active) return 1.0f;
+	Vec4f clip = Vec4MultMat4({position.x, position.y, position.z, 1}, shadowMap.view.cameraToLight);
+	if (clip.w <= 0) return 1.0f;
+	Vec4f raster = GetScreenCoords(clip, {}, shadowMap.size, shadowMap.size, false);
+	float receiverW = clip.w - shadowMap.view.bias;
+
+	const DepthBuffer &depth = shadowMap.depth;
+	const float *stored = DepthAs<DEPTH_F32>(depth);
+	int centerX = (int)std::floor(raster.x);
+	int centerY = (int)std::floor(raster.y);
+	int lit = 0;
+	for (int y = centerY - 1; y <= centerY + 1; y++) {
+		for (int x = centerX - 1; x <= centerX + 1; x++) {
+			//Outside the map or in a never written tile means no occluder
+			if (x < 0 or y < 0 or x >= depth.width or y >= depth.height) { lit++; continue; }
+			if (depth.tileStates[(y / TILE_SIZE) * depth.tilesWide + (x / TILE_SIZE)] != TILE_DIRTY) { lit++; continue; }
+			//Both sides as 1/w: the receiver is lit unless the stored occluder is closer to the light
+			if (receiverW * stored[y * depth.width + x] <= 1.0f) lit++;
+		}
+	}
+	return lit / 9.0f;
+}
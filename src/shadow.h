@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include "framebuffer.h"
+#include "linear_algebra.h"
+#include "model.h"
+
+//Sun shadows: the mesh is rendered depth only from the sun's point of view into a shadow map,
+//then shading compares each point's light space depth against it with a 3x3 PCF kernel.
+//The light frustum is a narrow perspective one fitted around the mesh's bounding sphere, so the
+//shadow map uses the same 1/w depth convention (larger is closer) as the main depth buffer.
+//Light frustum of one frame. Built together with the casters, so it travels with the frame's geometry.
+struct ShadowView {
+	Mat4f cameraToLight; //Camera space -> light clip space
+	float bias;          //Camera space units, about two texels at the mesh center
+	bool active;         //False if nothing was rendered this frame, everything is lit
+};
+
+struct ShadowMap {
+	int size;
+	DepthBuffer depth; //DEPTH_F32, one sample
+	ShadowView view;   //Of the frame last rendered into depth
+};
+
+ShadowMap CreateShadowMap(int size);
+void DestroyShadowMap(ShadowMap &shadowMap);
+
+//Fits the light frustum around every instance of the mesh and emits their faces (both windings) in
+//shadow map raster space. sunDirection points towards the light, it and modelViewMats are camera space.
+void BuildShadowCasters(int shadowMapSize, const Mesh &mesh, const std::vector<Mat4f> &modelViewMats, const Vec3f &sunDirection, ShadowView &view, std::vector<Triangle> &casters);
+void RenderShadowMap(ShadowMap &shadowMap, const std::vector<Triangle> &casters);
+
+//Fraction of the sun reaching a camera space point, 0 (shadowed) to 1 (lit)
+float SampleShadow(const ShadowMap &shadowMap, const Vec3f &position);
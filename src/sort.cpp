@@ -0,0 +1,40 @@
+#include "sort.h"
+#include <utility>
+
+void RadixSort(std::vector<uint32_t> &keys, std::vector<uint32_t> &values) {
+	size_t count = keys.size();
+	if (count < 2) return;
+
+	//One histogram per byte, all built in a single read over the keys
+	uint32_t histograms[4][256] = {};
+	for (uint32_t key : keys) {
+		histograms[0][key & 0xFF]++;
+		histograms[1][(key >> 8) & 0xFF]++;
+		histograms[2][(key >> 16) & 0xFF]++;
+		histograms[3][key >> 24]++;
+	}
+
+	static thread_local std::vector<uint32_t> scratchKeys, scratchValues;
+	scratchKeys.resize(count);
+	scratchValues.resize(count);
+
+	for (int pass = 0; pass < 4; pass++) {
+		uint32_t *histogram = histograms[pass];
+		int shift = pass * 8;
+		if (histogram[(keys[0] >> shift) & 0xFF] == count) continue;
+
+		uint32_t offset = 0;
+		for (int i = 0; i < 256; i++) {
+			uint32_t bucketSize = histogram[i];
+			histogram[i] = offset;
+			offset += bucketSize;
+		}
+		for (size_t i = 0; i < count; i++) {
+			uint32_t destination = histogram[(keys[i] >> shift) & 0xFF]++;
+			scratchKeys[destination] = keys[i];
+			scratchValues[destination] = values[i];
+		}
+		std::swap(keys, scratchKeys);
+		std::swap(values, scratchValues);
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+//Maps a float to an unsigned key with the same ordering, negative values included
+inline uint32_t FloatToSortKey(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+//Stable LSD radix sort of values by their 32 bit keys, ascending, 8 bits per pass.
+//Passes where every key has the same byte are skipped. Both vectors are reordered in place.
+void RadixSort(std::vector<uint32_t> &keys, std::vector<uint32_t> &values);
@@ -0,0 +1,203 @@
+#include "texture.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stb_image.h>
+
+//Texels are stored as 0xAABBGGRR (RGBA byte order)
+static inline int Red(uint32_t c) { return c & 0xFF; }
+static inline int Green(uint32_t c) { return (c >> 8) & 0xFF; }
+static inline int Blue(uint32_t c) { return (c >> 16) & 0xFF; }
+static inline int Alpha(uint32_t c) { return c >> 24; }
+static inline uint32_t PackRGBA(int r, int g, int b, int a) {
+	return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)a << 24);
+}
+
+static inline uint16_t PackRGB565(int r, int g, int b) {
+	return (uint16_t)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+}
+
+static inline void UnpackRGB565(uint16_t c, int &r, int &g, int &b) {
+	r = ((c >> 11) & 31) * 255 / 31;
+	g = ((c >> 5) & 63) * 255 / 63;
+	b = (c & 31) * 255 / 31;
+}
+
+static inline uint16_t ReadU16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static inline uint32_t ReadU32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+size_t TextureBytes(const Texture &texture) {
+	size_t blockCount = (size_t)((texture.width + 3) / 4) * ((texture.height + 3) / 4);
+	switch (texture.format) {
+	case TEXTURE_RGBA8: return (size_t)texture.width * texture.height * sizeof(uint32_t);
+	case TEXTURE_BC1: return blockCount * 8;
+	case TEXTURE_BC3: return blockCount * 16;
+	}
+	return 0;
+}
+
+//////////////////////////////////////////////////
+/// Decoding
+//////////////////////////////////////////////////
+//The four color palette of a block. BC1 drops to three colors + black when c0 <= c1.
+static inline uint32_t DecodeColorBlockTexel(const uint8_t *block, int index, bool allowThreeColor) {
+	uint16_t c0 = ReadU16(block);
+	uint16_t c1 = ReadU16(block + 2);
+	int selector = (ReadU32(block + 4) >> (index * 2)) & 3;
+
+	int r0, g0, b0, r1, g1, b1;
+	UnpackRGB565(c0, r0, g0, b0);
+	UnpackRGB565(c1, r1, g1, b1);
+
+	if (c0 > c1 or !allowThreeColor) {
+		switch (selector) {
+		case 0: return PackRGBA(r0, g0, b0, 255);
+		case 1: return PackRGBA(r1, g1, b1, 255);
+		case 2: return PackRGBA((2*r0 + r1) / 3, (2*g0 + g1) / 3, (2*b0 + b1) / 3, 255);
+		default: return PackRGBA((r0 + 2*r1) / 3, (g0 + 2*g1) / 3, (b0 + 2*b1) / 3, 255);
+		}
+	}
+	switch (selector) {
+	case 0: return PackRGBA(r0, g0, b0, 255);
+	case 1: return PackRGBA(r1, g1, b1, 255);
+	case 2: return PackRGBA((r0 + r1) / 2, (g0 + g1) / 2, (b0 + b1) / 2, 255);
+	default: return PackRGBA(0, 0, 0, 0);
+	}
+}
+
+static inline int AlphaPaletteEntry(int a0, int a1, int selector) {
+	if (selector == 0) return a0;
+	if (selector == 1) return a1;
+	if (a0 > a1) return ((8 - selector) * a0 + (selector - 1) * a1) / 7;
+	if (selector == 6) return 0;
+	if (selector == 7) return 255;
+	return ((6 - selector) * a0 + (selector - 1) * a1) / 5;
+}
+
+uint32_t DecodeBC1Texel(const uint8_t *block, int index) {
+	return DecodeColorBlockTexel(block, index, true);
+}
+
+uint32_t DecodeBC3Texel(const uint8_t *block, int index) {
+	uint64_t alphaBits = 0;
+	for (int i = 0; i < 6; i++) alphaBits |= (uint64_t)block[2 + i] << (8 * i);
+	int selector = (alphaBits >> (index * 3)) & 7;
+	int alpha = AlphaPaletteEntry(block[0], block[1], selector);
+
+	uint32_t color = DecodeColorBlockTexel(block + 8, index, false);
+	return (color & 0x00FFFFFF) | ((uint32_t)alpha << 24);
+}
+
+//////////////////////////////////////////////////
+/// Encoding
+//////////////////////////////////////////////////
+//Bounding box endpoints inset by 1/16 of the range, then nearest palette entry per texel.
+static void EncodeColorBlock(const uint32_t texels[16], uint8_t *out) {
+	int minC[3] = {255, 255, 255};
+	int maxC[3] = {0, 0, 0};
+	for (int i = 0; i < 16; i++) {
+		int c[3] = {Red(texels[i]), Green(texels[i]), Blue(texels[i])};
+		for (int k = 0; k < 3; k++) {
+			minC[k] = std::min(minC[k], c[k]);
+			maxC[k] = std::max(maxC[k], c[k]);
+		}
+	}
+	for (int k = 0; k < 3; k++) {
+		int inset = (maxC[k] - minC[k]) / 16;
+		minC[k] += inset;
+		maxC[k] -= inset;
+	}
+
+	uint16_t c0 = PackRGB565(maxC[0], maxC[1], maxC[2]);
+	uint16_t c1 = PackRGB565(minC[0], minC[1], minC[2]);
+	if (c0 < c1) std::swap(c0, c1);
+
+	//Palette as the decoder will see it (always four color mode, c0 == c1 selects index 0)
+	uint8_t encodedEndpoints[8] = {(uint8_t)c0, (uint8_t)(c0 >> 8), (uint8_t)c1, (uint8_t)(c1 >> 8), 0, 0, 0, 0};
+	uint32_t palette[4];
+	for (int s = 0; s < 4; s++) {
+		encodedEndpoints[4] = (uint8_t)s;
+		palette[s] = DecodeColorBlockTexel(encodedEndpoints, 0, false);
+	}
+
+	uint32_t selectors = 0;
+	if (c0 != c1) {
+		for (int i = 0; i < 16; i++) {
+			int best = 0; int bestError = INT32_MAX;
+			for (int s = 0; s < 4; s++) {
+				int dr = Red(texels[i]) - Red(palette[s]);
+				int dg = Green(texels[i]) - Green(palette[s]);
+				int db = Blue(texels[i]) - Blue(palette[s]);
+				int error = dr*dr + dg*dg + db*db;
+				if (error < bestError) { bestError = error; best = s; }
+			}
+			selectors |= (uint32_t)best << (i * 2);
+		}
+	}
+
+	memcpy(out, encodedEndpoints, 4);
+	for (int i = 0; i < 4; i++) out[4 + i] = (uint8_t)(selectors >> (8 * i));
+}
+
+static void EncodeAlphaBlock(const uint32_t texels[16], uint8_t *out) {
+	int a0 = 0; int a1 = 255;
+	for (int i = 0; i < 16; i++) {
+		a0 = std::max(a0, Alpha(texels[i]));
+		a1 = std::min(a1, Alpha(texels[i]));
+	}
+
+	uint64_t selectors = 0;
+	if (a0 != a1) {
+		for (int i = 0; i < 16; i++) {
+			int best = 0; int bestError = INT32_MAX;
+			for (int s = 0; s < 8; s++) {
+				int error = abs(Alpha(texels[i]) - AlphaPaletteEntry(a0, a1, s));
+				if (error < bestError) { bestError = error; best = s; }
+			}
+			selectors |= (uint64_t)best << (i * 3);
+		}
+	}
+
+	out[0] = (uint8_t)a0;
+	out[1] = (uint8_t)a1;
+	for (int i = 0; i < 6; i++) out[2 + i] = (uint8_t)(selectors >> (8 * i));
+}
+
+//Replaces the RGBA8 pixels with block compressed data. Edge blocks clamp to the last row/column.
+void CompressTexture(Texture &texture, TextureFormat format) {
+	if (format == TEXTURE_RGBA8 or texture.format != TEXTURE_RGBA8 or !texture.pixels) return;
+
+	int blocksWide = (texture.width + 3) / 4;
+	int blocksHigh = (texture.height + 3) / 4;
+	int blockSize = format == TEXTURE_BC1 ? 8 : 16;
+	uint8_t *blocks = new uint8_t[(size_t)blocksWide * blocksHigh * blockSize];
+
+	for (int by = 0; by < blocksHigh; by++) {
+		for (int bx = 0; bx < blocksWide; bx++) {
+			uint32_t texels[16];
+			for (int i = 0; i < 16; i++) {
+				int x = std::min(bx * 4 + (i & 3), texture.width - 1);
+				int y = std::min(by * 4 + (i >> 2), texture.height - 1);
+				texels[i] = texture.pixels[(texture.width * y) + x];
+			}
+
+			uint8_t *out = blocks + ((size_t)by * blocksWide + bx) * blockSize;
+			if (format == TEXTURE_BC1) {
+				EncodeColorBlock(texels, out);
+			} else {
+				EncodeAlphaBlock(texels, out);
+				EncodeColorBlock(texels, out + 8);
+			}
+		}
+	}
+
+	stbi_image_free((void*) texture.pixels);
+	texture.pixels = nullptr;
+	texture.blocks = blocks;
+	texture.format = format;
+}
+
+void FreeTextureBlocks(Texture &texture) {
+	delete[] texture.blocks;
+	texture.blocks = nullptr;
+}
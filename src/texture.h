@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+//In-memory texel layout.
+//BC1: 4x4 blocks of two RGB565 endpoints + 2 bit indices, 8 bytes (0.5 byte per texel, no alpha)
+//BC3: BC1 style color block + 8 byte interpolated alpha block, 16 bytes (1 byte per texel)
+enum TextureFormat {
+	TEXTURE_RGBA8,
+	TEXTURE_BC1,
+	TEXTURE_BC3
+};
+
+struct Texture {
+	int width;
+	int height;
+	TextureFormat format;
+	uint32_t *pixels; //TEXTURE_RGBA8 only
+	uint8_t *blocks; //Block compressed formats only
+};
+
+size_t TextureBytes(const Texture &texture);
+void CompressTexture(Texture &texture, TextureFormat format);
+void FreeTextureBlocks(Texture &texture);
+
+uint32_t DecodeBC1Texel(const uint8_t *block, int index);
+uint32_t DecodeBC3Texel(const uint8_t *block, int index);
+
+//Fetches a single RGBA8 texel, decoding block compressed formats on the fly
+inline uint32_t SampleTexel(const Texture &texture, int x, int y) {
+	if (texture.format == TEXTURE_RGBA8) return texture.pixels[(texture.width * y) + x];
+
+	int blocksWide = (texture.width + 3) / 4;
+	int blockIndex = (y / 4) * blocksWide + (x / 4);
+	int texelIndex = (y & 3) * 4 + (x & 3);
+	if (texture.format == TEXTURE_BC1) return DecodeBC1Texel(texture.blocks + blockIndex * 8, texelIndex);
+	return DecodeBC3Texel(texture.blocks + blockIndex * 16, texelIndex);
+}
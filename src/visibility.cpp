@@ -0,0 +1,51 @@
+#include "visibility.h"
+#include "framebuffer.h"
+#include <algorithm>
+
+VisibilityBuffer CreateVisibilityBuffer(int width, int height) {
+	int tilesWide = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesHigh = (height + TILE_SIZE - 1) / TILE_SIZE;
+	VisibilityBuffer buffer = {
+		.width = width,
+		.height = height,
+		.ids = new uint32_t[(size_t)width * height],
+		.tilesWide = tilesWide,
+		.tilesHigh = tilesHigh,
+		.tileStates = new uint8_t[tilesWide * tilesHigh],
+	};
+	ClearVisibilityBuffer(buffer);
+	return buffer;
+}
+
+void DestroyVisibilityBuffer(VisibilityBuffer &buffer) {
+	delete[] buffer.ids;
+	delete[] buffer.tileStates;
+	buffer.ids = nullptr;
+	buffer.tileStates = nullptr;
+}
+
+void ClearVisibilityBuffer(VisibilityBuffer &buffer) {
+	std::fill_n(buffer.tileStates, buffer.tilesWide * buffer.tilesHigh, (uint8_t)TILE_CLEARED);
+}
+
+void MaterializeVisibilityRect(VisibilityBuffer &buffer, int xMin, int yMin, int xMax, int yMax) {
+	if (xMin >= xMax or yMin >= yMax) return;
+	for (int ty = yMin / TILE_SIZE; ty <= (yMax - 1) / TILE_SIZE; ty++) {
+		for (int tx = xMin / TILE_SIZE; tx <= (xMax - 1) / TILE_SIZE; tx++) {
+			uint8_t &state = buffer.tileStates[ty * buffer.tilesWide + tx];
+			if (state == TILE_DIRTY) continue;
+
+			int x0 = tx * TILE_SIZE; int x1 = std::min(x0 + TILE_SIZE, buffer.width);
+			int y0 = ty * TILE_SIZE; int y1 = std::min(y0 + TILE_SIZE, buffer.height);
+			for (int y = y0; y < y1; y++) std::fill(buffer.ids + y * buffer.width + x0, buffer.ids + y * buffer.width + x1, VISIBILITY_EMPTY);
+			state = TILE_DIRTY;
+		}
+	}
+}
+
+uint32_t PickVisibilityId(const VisibilityBuffer &buffer, int x, int y) {
+	if (x < 0 or y < 0 or x >= buffer.width or y >= buffer.height) return VISIBILITY_EMPTY;
+	int tileIndex = (y / TILE_SIZE) * buffer.tilesWide + (x / TILE_SIZE);
+	if (buffer.tileStates[tileIndex] != TILE_DIRTY) return VISIBILITY_EMPTY;
+	return buffer.ids[y * buffer.width + x];
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+//Visibility buffer: the rasterizer only resolves depth and stores which triangle of which instance
+//is closest per pixel. Shading runs afterwards, once per visible pixel, by looking the triangle up
+//and reconstructing its barycentrics. The same IDs answer picking queries for free.
+const int VISIBILITY_TRIANGLE_BITS = 24; //Triangle index within the frame's triangle list
+const int VISIBILITY_INSTANCE_BITS = 32 - VISIBILITY_TRIANGLE_BITS;
+const uint32_t VISIBILITY_TRIANGLE_MASK = (1u << VISIBILITY_TRIANGLE_BITS) - 1;
+const uint32_t VISIBILITY_EMPTY = UINT32_MAX;
+//Triangle indices past this would alias other IDs (the last one would collide with VISIBILITY_EMPTY)
+const uint32_t VISIBILITY_MAX_TRIANGLES = VISIBILITY_TRIANGLE_MASK;
+
+inline bool FitsVisibilityIds(size_t triangleCount) { return triangleCount <= VISIBILITY_MAX_TRIANGLES; }
+//triangle must be below VISIBILITY_MAX_TRIANGLES, see FitsVisibilityIds()
+inline uint32_t PackVisibilityId(uint32_t instance, uint32_t triangle) {
+	return (instance << VISIBILITY_TRIANGLE_BITS) | (triangle & VISIBILITY_TRIANGLE_MASK);
+}
+inline uint32_t VisibilityInstance(uint32_t id) { return id >> VISIBILITY_TRIANGLE_BITS; }
+inline uint32_t VisibilityTriangle(uint32_t id) { return id & VISIBILITY_TRIANGLE_MASK; }
+
+struct VisibilityBuffer {
+	int width;
+	int height;
+	uint32_t *ids; //VISIBILITY_EMPTY where nothing was drawn
+	int tilesWide;
+	int tilesHigh;
+	uint8_t *tileStates;
+};
+
+VisibilityBuffer CreateVisibilityBuffer(int width, int height);
+void DestroyVisibilityBuffer(VisibilityBuffer &buffer);
+void ClearVisibilityBuffer(VisibilityBuffer &buffer);
+void MaterializeVisibilityRect(VisibilityBuffer &buffer, int xMin, int yMin, int xMax, int yMax);
+uint32_t PickVisibilityId(const VisibilityBuffer &buffer, int x, int y);